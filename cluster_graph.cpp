@@ -0,0 +1,247 @@
+#include "stdafx.h"
+#include "cluster_graph.h"
+#include "sectors.h"
+#include "level.h"
+
+const int ClusterGraph::clusterSize = 16;
+
+// Border runs at least this long get an entrance at both ends instead of a single one in the middle.
+constexpr int longEntranceLength = 6;
+
+ClusterGraph::ClusterGraph(Rectangle b) : bounds(b),
+    clusters((b.width() + clusterSize - 1) / clusterSize, (b.height() + clusterSize - 1) / clusterSize) {
+}
+
+Vec2 ClusterGraph::getCluster(Vec2 pos) const {
+  return (pos - bounds.topLeft()) / clusterSize;
+}
+
+Rectangle ClusterGraph::getClusterBounds(Vec2 cluster) const {
+  Vec2 topLeft = bounds.topLeft() + cluster * clusterSize;
+  return Rectangle(topLeft, topLeft + Vec2(clusterSize, clusterSize)).intersection(bounds);
+}
+
+void ClusterGraph::invalidate(Vec2 pos) {
+  if (!pos.inRectangle(bounds))
+    return;
+  Vec2 c = getCluster(pos);
+  auto area = getClusterBounds(c);
+  auto& cluster = clusters[c];
+  cluster.dirty = true;
+  if (pos.x == area.right() - 1)
+    cluster.eastDirty = true;
+  if (pos.y == area.bottom() - 1)
+    cluster.southDirty = true;
+  if (pos.x == area.left() && c.x > 0)
+    clusters[c - Vec2(1, 0)].eastDirty = true;
+  if (pos.y == area.top() && c.y > 0)
+    clusters[c - Vec2(0, 1)].southDirty = true;
+  anyDirty = true;
+}
+
+ClusterGraph::Transitions ClusterGraph::getTransitions(const Sectors& sectors, Vec2 cluster, Vec2 dir) const {
+  Transitions ret;
+  auto area = getClusterBounds(cluster);
+  Vec2 first = dir.x == 1 ? Vec2(area.right() - 1, area.top()) : Vec2(area.left(), area.bottom() - 1);
+  if (!(first + dir).inRectangle(bounds))
+    return ret;
+  Vec2 step = dir.x == 1 ? Vec2(0, 1) : Vec2(1, 0);
+  int length = dir.x == 1 ? area.height() : area.width();
+  auto addRun = [&] (int start, int end) {
+    if (end - start >= longEntranceLength) {
+      ret.push_back(make_pair(first + step * start, first + step * start + dir));
+      ret.push_back(make_pair(first + step * (end - 1), first + step * (end - 1) + dir));
+    } else {
+      Vec2 middle = first + step * ((start + end - 1) / 2);
+      ret.push_back(make_pair(middle, middle + dir));
+    }
+  };
+  int runStart = -1;
+  for (int i : Range(length)) {
+    Vec2 v = first + step * i;
+    bool passable = sectors.contains(v) && sectors.contains(v + dir);
+    if (passable && runStart == -1)
+      runStart = i;
+    if (!passable && runStart > -1) {
+      addRun(runStart, i);
+      runStart = -1;
+    }
+  }
+  if (runStart > -1)
+    addRun(runStart, length);
+  return ret;
+}
+
+static thread_local DirtyTable<int> bfsTable(Level::getMaxBounds(), -1);
+
+vector<int> ClusterGraph::getDistancesToNodes(const Sectors& sectors, Vec2 pos) const {
+  Vec2 c = getCluster(pos);
+  auto& cluster = clusters[c];
+  auto area = getClusterBounds(c);
+  vector<int> ret(cluster.nodes.size(), -1);
+  int numFound = 0;
+  bfsTable.clear();
+  queue<Vec2> q;
+  bfsTable.setValue(pos, 0);
+  q.push(pos);
+  while (!q.empty() && numFound < ret.size()) {
+    Vec2 v = q.front();
+    q.pop();
+    int dist = bfsTable.getDirtyValue(v);
+    if (auto index = cluster.nodes.findElement(v)) {
+      ret[*index] = dist;
+      ++numFound;
+    }
+    for (Vec2 dir : Vec2::directions8()) {
+      Vec2 next = v + dir;
+      if (next.inRectangle(area) && !bfsTable.isDirty(next) && sectors.contains(next)) {
+        bfsTable.setValue(next, dist + 1);
+        q.push(next);
+      }
+    }
+  }
+  return ret;
+}
+
+void ClusterGraph::rebuildCluster(const Sectors& sectors, Vec2 c) {
+  auto& cluster = clusters[c];
+  cluster.nodes.clear();
+  cluster.transitions.clear();
+  cluster.distances.clear();
+  auto add = [&cluster] (Vec2 node, Vec2 other) {
+    auto index = cluster.nodes.findElement(node);
+    if (!index) {
+      index = cluster.nodes.size();
+      cluster.nodes.push_back(node);
+      cluster.transitions.emplace_back();
+    }
+    cluster.transitions[*index].push_back(other);
+  };
+  for (auto& t : cluster.east)
+    add(t.first, t.second);
+  for (auto& t : cluster.south)
+    add(t.first, t.second);
+  if (c.x > 0)
+    for (auto& t : clusters[c - Vec2(1, 0)].east)
+      add(t.second, t.first);
+  if (c.y > 0)
+    for (auto& t : clusters[c - Vec2(0, 1)].south)
+      add(t.second, t.first);
+  for (auto& node : cluster.nodes)
+    cluster.distances.push_back(getDistancesToNodes(sectors, node));
+  cluster.dirty = false;
+}
+
+void ClusterGraph::update(const Sectors& sectors) {
+  if (!anyDirty)
+    return;
+  PROFILE;
+  auto clusterBounds = clusters.getBounds();
+  for (Vec2 c : clusterBounds) {
+    auto& cluster = clusters[c];
+    if (cluster.eastDirty) {
+      cluster.east = getTransitions(sectors, c, Vec2(1, 0));
+      cluster.eastDirty = false;
+      cluster.dirty = true;
+      if (c.x + 1 < clusterBounds.right())
+        clusters[c + Vec2(1, 0)].dirty = true;
+    }
+    if (cluster.southDirty) {
+      cluster.south = getTransitions(sectors, c, Vec2(0, 1));
+      cluster.southDirty = false;
+      cluster.dirty = true;
+      if (c.y + 1 < clusterBounds.bottom())
+        clusters[c + Vec2(0, 1)].dirty = true;
+    }
+  }
+  for (Vec2 c : clusterBounds)
+    if (clusters[c].dirty)
+      rebuildCluster(sectors, c);
+  anyDirty = false;
+}
+
+int ClusterGraph::getNumNodes() const {
+  int ret = 0;
+  for (Vec2 c : clusters.getBounds())
+    ret += clusters[c].nodes.size();
+  return ret;
+}
+
+namespace {
+struct NodeInfo {
+  int dist;
+  optional<Vec2> parent;
+};
+
+struct QueueElem {
+  Vec2 pos;
+  int value;
+};
+
+bool inline operator < (const QueueElem& e1, const QueueElem& e2) {
+  return e1.value > e2.value || (e1.value == e2.value && e1.pos < e2.pos);
+}
+}
+
+static thread_local DirtyTable<NodeInfo> searchTable(Level::getMaxBounds(), NodeInfo{-1, none});
+
+optional<Vec2> ClusterGraph::getWaypoint(const Sectors& sectors, Vec2 from, Vec2 to, int maxClusters) {
+  PROFILE;
+  Vec2 fromCluster = getCluster(from);
+  Vec2 toCluster = getCluster(to);
+  if (fromCluster.dist8(toCluster) <= maxClusters)
+    return none;
+  update(sectors);
+  auto startDistances = getDistancesToNodes(sectors, from);
+  auto goalDistances = getDistancesToNodes(sectors, to);
+  searchTable.clear();
+  priority_queue<QueueElem, vector<QueueElem>> q;
+  auto push = [&] (Vec2 node, int dist, optional<Vec2> parent) {
+    if (!searchTable.isDirty(node) || searchTable.getDirtyValue(node).dist > dist) {
+      searchTable.setValue(node, NodeInfo{dist, parent});
+      q.push(QueueElem{node, dist + node.dist8(to)});
+    }
+  };
+  auto& startCluster = clusters[fromCluster];
+  for (int i : All(startCluster.nodes))
+    if (startDistances[i] >= 0)
+      push(startCluster.nodes[i], startDistances[i], none);
+  optional<int> goalDist;
+  optional<Vec2> goalParent;
+  while (!q.empty()) {
+    auto elem = q.top();
+    q.pop();
+    if (goalDist && elem.value >= *goalDist)
+      break;
+    Vec2 node = elem.pos;
+    int dist = searchTable.getDirtyValue(node).dist;
+    if (elem.value > dist + node.dist8(to))
+      continue;
+    Vec2 c = getCluster(node);
+    auto& cluster = clusters[c];
+    int index = *cluster.nodes.findElement(node);
+    for (int j : All(cluster.nodes))
+      if (j != index && cluster.distances[index][j] >= 0)
+        push(cluster.nodes[j], dist + cluster.distances[index][j], node);
+    for (Vec2 other : cluster.transitions[index])
+      push(other, dist + 1, node);
+    if (c == toCluster && goalDistances[index] >= 0 && (!goalDist || dist + goalDistances[index] < *goalDist)) {
+      goalDist = dist + goalDistances[index];
+      goalParent = node;
+    }
+  }
+  if (!goalParent)
+    return none;
+  vector<Vec2> path;
+  for (optional<Vec2> node = goalParent; node; node = searchTable.getDirtyValue(*node).parent)
+    path.push_back(*node);
+  optional<Vec2> ret;
+  for (Vec2 node : path.reverse())
+    if (getCluster(node).dist8(fromCluster) <= maxClusters)
+      ret = node;
+    else
+      break;
+  if (ret == from)
+    return none;
+  return ret;
+}
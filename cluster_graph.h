@@ -0,0 +1,49 @@
+#pragma once
+
+#include "util.h"
+
+class Sectors;
+
+/** Abstract graph of entrances between fixed-size clusters of a level, used to plan long paths hierarchically.
+    Passability is taken from the Sectors of a single movement type. Clusters are rebuilt lazily, only after
+    their tiles were invalidated.*/
+class ClusterGraph {
+  public:
+  ClusterGraph(Rectangle bounds);
+
+  /** Marks the cluster containing the tile, and its neighbor if the tile lies on a border, for rebuilding.*/
+  void invalidate(Vec2);
+
+  /** Finds an abstract path and returns the farthest entrance on it that is at most \paramname{maxClusters}
+      clusters away from \paramname{from}. Returns none if the tiles are close to each other or if there
+      is no abstract path between them.*/
+  optional<Vec2> getWaypoint(const Sectors&, Vec2 from, Vec2 to, int maxClusters);
+
+  int getNumNodes() const;
+
+  static const int clusterSize;
+
+  private:
+  using Transitions = vector<pair<Vec2, Vec2>>;
+  struct Cluster {
+    vector<Vec2> nodes;
+    // For each node, entrances in the neighboring clusters that it connects to.
+    vector<vector<Vec2>> transitions;
+    // Distances between nodes within the cluster, -1 if they aren't connected.
+    vector<vector<int>> distances;
+    Transitions east;
+    Transitions south;
+    bool dirty = true;
+    bool eastDirty = true;
+    bool southDirty = true;
+  };
+  Vec2 getCluster(Vec2) const;
+  Rectangle getClusterBounds(Vec2 cluster) const;
+  Transitions getTransitions(const Sectors&, Vec2 cluster, Vec2 dir) const;
+  void rebuildCluster(const Sectors&, Vec2 cluster);
+  void update(const Sectors&);
+  vector<int> getDistancesToNodes(const Sectors&, Vec2 pos) const;
+  Rectangle bounds;
+  Table<Cluster> clusters;
+  bool anyDirty = true;
+};
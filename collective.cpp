@@ -56,6 +56,7 @@
 #include "game_event.h"
 #include "view_object.h"
 #include "content_factory.h"
+#include "item_ledger.h"
 
 template <class Archive>
 void Collective::serialize(Archive& ar, const unsigned int version) {
@@ -602,6 +603,7 @@ void Collective::onEvent(const GameEvent& event) {
           populationIncrease -= getGame()->getContentFactory()->furniture.getPopulationIncrease(
               info.type, constructions->getBuiltCount(info.type));
           constructions->onFurnitureDestroyed(info.position, info.layer);
+          updateItemLedger(info.position);
           populationIncrease += getGame()->getContentFactory()->furniture.getPopulationIncrease(
               info.type, constructions->getBuiltCount(info.type));
         }
@@ -691,6 +693,7 @@ void Collective::claimSquare(Position pos) {
           constructions->addFurniture(pos, ConstructionMap::FurnitureInfo::getBuilt(furniture->getType()), layer);
         furniture->setTribe(getTribeId());
       }
+  updateItemLedger(pos);
   control->onClaimedSquare(pos);
 }
 
@@ -709,9 +712,17 @@ GlobalTime Collective::getGlobalTime() const {
 int Collective::numResource(ResourceId id) const {
   int ret = credit[id];
   if (auto itemIndex = config->getResourceInfo(id).itemIndex)
-    if (auto storage = config->getResourceInfo(id).storageId)
+    if (auto storage = config->getResourceInfo(id).storageId) {
+      int count = getItemLedger().getStorageCount(*storage, *itemIndex);
+#ifdef CHECK_ITEM_LEDGER
+      int scanned = 0;
       for (auto& pos : getStoragePositions(*storage))
-        ret += pos.getItems(*itemIndex).size();
+        scanned += pos.getItems(*itemIndex).size();
+      CHECK(count == scanned) << "Item ledger mismatch for " << config->getResourceInfo(id).name << ": " << count
+          << " " << scanned;
+#endif
+      ret += count;
+    }
   return ret;
 }
 
@@ -720,12 +731,16 @@ int Collective::numResourcePlusDebt(ResourceId id) const {
 }
 
 int Collective::getDebt(ResourceId id) const {
-  int ret = constructions->getDebt(id);
+  int unfinished = taskMap->getUnfinishedCost(id);
+#ifdef CHECK_ITEM_LEDGER
+  int scanned = 0;
   for (auto& elem : taskMap->getCompletionCosts())
     if (elem.second.id == id && !taskMap->getTask(elem.first)->isDone())
-      ret -= elem.second.value;
-  ret += workshops->getDebt(id);
-  return ret;
+      scanned += elem.second.value;
+  CHECK(unfinished == scanned) << "Task cost mismatch for " << config->getResourceInfo(id).name << ": "
+      << unfinished << " " << scanned;
+#endif
+  return constructions->getDebt(id) - unfinished + workshops->getDebt(id);
 }
 
 bool Collective::hasResource(const CostInfo& cost) const {
@@ -806,11 +821,33 @@ vector<Item*> Collective::getAllItems(ItemIndex index, bool includeMinions) cons
 
 vector<Item*> Collective::getAllItemsImpl(optional<ItemIndex> index, bool includeMinions) const {
   vector<Item*> allItems;
+  auto& equipmentStorage = zones->getPositions(ZoneId::STORAGE_EQUIPMENT);
+  // The ledger's set is unordered and its order changes after loading a game, so the squares are sorted to keep
+  // the order of the items deterministic.
+  auto& withItems = getItemLedger().getSquaresWithItems();
+  vector<Position> squares(withItems.begin(), withItems.end());
+  std::sort(squares.begin(), squares.end(), [](const Position& p1, const Position& p2) {
+    auto id1 = p1.getLevel()->getUniqueId();
+    auto id2 = p2.getLevel()->getUniqueId();
+    return id1 < id2 || (id1 == id2 && p1.getCoord() < p2.getCoord());
+  });
+  for (auto& v : squares)
+    if (territory->contains(v))
+      append(allItems, index ? v.getItems(*index) : v.getItems());
+    else if (equipmentStorage.count(v))
+      append(allItems, v.getItems());
+#ifdef CHECK_ITEM_LEDGER
+  vector<Item*> scanned;
   for (auto& v : territory->getAll())
-    append(allItems, index ? v.getItems(*index) : v.getItems());
-  for (auto& v : zones->getPositions(ZoneId::STORAGE_EQUIPMENT))
+    append(scanned, index ? v.getItems(*index) : v.getItems());
+  for (auto& v : equipmentStorage)
     if (!territory->contains(v))
-      append(allItems, v.getItems());
+      append(scanned, v.getItems());
+  auto sortedItems = allItems;
+  std::sort(sortedItems.begin(), sortedItems.end());
+  std::sort(scanned.begin(), scanned.end());
+  CHECK(sortedItems == scanned) << "Item ledger mismatch: " << sortedItems.size() << " " << scanned.size();
+#endif
   if (includeMinions)
     for (Creature* c : getCreatures())
       append(allItems, index ? c->getEquipment().getItems(*index) : c->getEquipment().getItems());
@@ -818,15 +855,49 @@ vector<Item*> Collective::getAllItemsImpl(optional<ItemIndex> index, bool includ
 }
 
 int Collective::getNumItems(ItemIndex index, bool includeMinions) const {
-  int ret = 0;
+  int ret = getItemLedger().getTerritoryCount(index);
+#ifdef CHECK_ITEM_LEDGER
+  int scanned = 0;
   for (Position v : territory->getAll())
-    ret += v.getItems(index).size();
+    scanned += v.getItems(index).size();
+  CHECK(ret == scanned) << "Item ledger mismatch for " << ::getName(index) << ": " << ret << " " << scanned;
+#endif
   if (includeMinions)
     for (Creature* c : getCreatures())
       ret += c->getEquipment().getItems(index).size();
   return ret;
 }
 
+EnumSet<StorageId> Collective::getStorageIds(Position pos) const {
+  EnumSet<StorageId> ret;
+  for (auto id : ENUM_ALL(StorageId))
+    if (getStoragePositions(id).count(pos))
+      ret.insert(id);
+  return ret;
+}
+
+const ItemLedger& Collective::getItemLedger() const {
+  if (!itemLedger) {
+    itemLedger = unique<ItemLedger>();
+    for (auto& pos : territory->getAll())
+      itemLedger->setAreas(pos, true, getStorageIds(pos));
+    for (auto id : ENUM_ALL(StorageId))
+      for (auto& pos : getStoragePositions(id))
+        itemLedger->setAreas(pos, territory->contains(pos), getStorageIds(pos));
+  }
+  return *itemLedger;
+}
+
+void Collective::updateItemLedger(Position pos) {
+  if (itemLedger)
+    itemLedger->setAreas(pos, territory->contains(pos), getStorageIds(pos));
+}
+
+void Collective::onItemsChanged(Position pos) {
+  if (itemLedger)
+    itemLedger->onItemsChanged(pos);
+}
+
 const PositionSet& Collective::getStorageForPillagedItem(const Item* item) const {
   for (auto& info : config->getFetchInfo())
     if (hasIndex(info.index, item))
@@ -893,6 +964,7 @@ void Collective::destroyOrder(Position pos, FurnitureLayer layer) {
   }
   if (layer == FurnitureLayer::MIDDLE) {
     zones->onDestroyOrder(pos);
+    updateItemLedger(pos);
     if (constructions->getTrap(pos))
       removeTrap(pos);
   }
@@ -902,6 +974,7 @@ void Collective::addFurniture(Position pos, FurnitureType type, const CostInfo&
   if (!noCredit || hasResource(cost)) {
     auto layer = getGame()->getContentFactory()->furniture.getData(type).getLayer();
     constructions->addFurniture(pos, ConstructionMap::FurnitureInfo(type, cost), layer);
+    updateItemLedger(pos);
     updateConstructions();
   }
 }
@@ -955,8 +1028,10 @@ void Collective::addTrap(Position pos, FurnitureType type) {
 
 void Collective::onAppliedItem(Position pos, Item* item) {
   CHECK(!!item->getEffect()->getValueMaybe<Effect::PlaceFurniture>());
-  if (auto trap = constructions->getTrap(pos))
+  if (auto trap = constructions->getTrap(pos)) {
     trap->setArmed();
+    pos.setNeedsRenderUpdate(true);
+  }
 }
 
 bool Collective::isConstructionReachable(Position pos) {
@@ -969,6 +1044,7 @@ void Collective::onConstructed(Position pos, FurnitureType type) {
     constructions->removeFurniturePlan(pos, getGame()->getContentFactory()->furniture.getData(type).getLayer());
     if (territory->contains(pos))
       territory->remove(pos);
+    updateItemLedger(pos);
     control->onConstructed(pos, type);
     return;
   }
@@ -990,6 +1066,7 @@ void Collective::onDestructed(Position pos, FurnitureType type, const DestroyAct
       break;
     case DestroyAction::Type::DIG:
       territory->insert(pos);
+      updateItemLedger(pos);
       break;
     default:
       break;
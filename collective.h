@@ -51,6 +51,7 @@ class Immigration;
 class Quarters;
 class PositionMatching;
 class MinionActivities;
+class ItemLedger;
 
 class Collective : public TaskCallback, public UniqueEntity<Collective>, public EventListener<Collective> {
   public:
@@ -109,6 +110,10 @@ class Collective : public TaskCallback, public UniqueEntity<Collective>, public
   Territory& getTerritory();
   bool canClaimSquare(Position pos) const;
   void claimSquare(Position);
+  /** Must be called whenever the square joins or leaves the territory or a storage.*/
+  void updateItemLedger(Position);
+  /** Called by the model whenever items are added to or removed from a square.*/
+  void onItemsChanged(Position);
   const KnownTiles& getKnownTiles() const;
   void retire();
   CollectiveWarnings& getWarnings();
@@ -307,6 +312,10 @@ class Collective : public TaskCallback, public UniqueEntity<Collective>, public
   DungeonLevel SERIAL(dungeonLevel);
   bool SERIAL(hadALeader) = false;
   vector<Item*> getAllItemsImpl(optional<ItemIndex>, bool includeMinions) const;
+  EnumSet<StorageId> getStorageIds(Position) const;
+  const ItemLedger& getItemLedger() const;
+  // Built on first use from the current squares, so it isn't serialized.
+  mutable unique_ptr<ItemLedger> itemLedger;
   // Remove after alpha 27
   void updateBorderTiles();
   bool updatedBorderTiles = false;
@@ -0,0 +1,243 @@
+#include "stdafx.h"
+#include "compressed_stream.h"
+#include <zlib.h>
+#include <future>
+
+namespace {
+
+/* Every chunk is stored as a gzip member with a 'KR' extra subfield:
+     1f 8b 08 04 | mtime (4) | xfl | os | xlen = 16 (2) | 'K' 'R' | len = 12 (2)
+     | version | 3 padding bytes | member size (4) | uncompressed size (4)
+   followed by raw deflate data, CRC32 and ISIZE. All numbers are little endian.*/
+const int chunkSize = 1 << 20;
+const int headerSize = 28;
+const int trailerSize = 8;
+const unsigned char formatVersion = 1;
+
+int getMaxChunksInFlight() {
+  return 2 * max<int>(1, thread::hardware_concurrency());
+}
+
+void setUint32(char* dest, uint32_t value) {
+  for (int i = 0; i < 4; ++i)
+    dest[i] = (value >> (8 * i)) & 0xff;
+}
+
+uint32_t getUint32(const char* src) {
+  uint32_t ret = 0;
+  for (int i = 0; i < 4; ++i)
+    ret |= uint32_t((unsigned char) src[i]) << (8 * i);
+  return ret;
+}
+
+bool isChunkHeader(const char* header) {
+  const unsigned char expected[] = {0x1f, 0x8b, 8, 4};
+  return !memcmp(header, expected, 4) && header[10] == 16 && header[11] == 0 && header[12] == 'K' &&
+      header[13] == 'R' && header[14] == 12 && header[15] == 0 && (unsigned char) header[16] == formatVersion;
+}
+
+string compressChunk(string data) {
+  z_stream stream {};
+  CHECK(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+  string ret(headerSize + deflateBound(&stream, data.size()) + trailerSize, 0);
+  stream.next_in = (Bytef*) data.data();
+  stream.avail_in = data.size();
+  stream.next_out = (Bytef*) &ret[headerSize];
+  stream.avail_out = ret.size() - headerSize - trailerSize;
+  CHECK(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+  ret.resize(headerSize + stream.total_out + trailerSize);
+  deflateEnd(&stream);
+  const unsigned char header[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255, 16, 0, 'K', 'R', 12, 0, formatVersion, 0, 0, 0};
+  memcpy(&ret[0], header, sizeof(header));
+  setUint32(&ret[20], ret.size());
+  setUint32(&ret[24], data.size());
+  setUint32(&ret[ret.size() - 8], crc32(0, (const Bytef*) data.data(), data.size()));
+  setUint32(&ret[ret.size() - 4], data.size());
+  return ret;
+}
+
+optional<string> decompressChunk(string member) {
+  uint32_t size = getUint32(&member[24]);
+  if (size > 4 * chunkSize || getUint32(&member[member.size() - 4]) != size)
+    return none;
+  string ret(size, 0);
+  z_stream stream {};
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+    return none;
+  stream.next_in = (Bytef*) &member[headerSize];
+  stream.avail_in = member.size() - headerSize - trailerSize;
+  stream.next_out = (Bytef*) &ret[0];
+  stream.avail_out = size;
+  int result = inflate(&stream, Z_FINISH);
+  inflateEnd(&stream);
+  if (result != Z_STREAM_END || stream.total_out != size ||
+      crc32(0, (const Bytef*) ret.data(), size) != getUint32(&member[member.size() - 8]))
+    return none;
+  return ret;
+}
+
+}
+
+class CompressedOutputStream::Buffer : public std::streambuf {
+  public:
+  Buffer(const char* path) : file(path, std::ios::binary), chunk(chunkSize, 0) {
+    setp(&chunk[0], &chunk[0] + chunk.size());
+  }
+
+  bool isOpen() const {
+    return file.is_open();
+  }
+
+  bool flushAll() {
+    submitChunk();
+    while (!pending.empty())
+      writeChunk();
+    file.flush();
+    return !!file;
+  }
+
+  protected:
+  virtual int overflow(int c) override {
+    submitChunk();
+    if (c != EOF) {
+      *pptr() = c;
+      pbump(1);
+    }
+    return file ? traits_type::not_eof(c) : EOF;
+  }
+
+  virtual int sync() override {
+    return flushAll() ? 0 : -1;
+  }
+
+  private:
+  void submitChunk() {
+    if (pptr() == pbase())
+      return;
+    pending.push_back(std::async(std::launch::async, compressChunk, string(pbase(), pptr())));
+    setp(&chunk[0], &chunk[0] + chunk.size());
+    if (pending.size() > getMaxChunksInFlight())
+      writeChunk();
+  }
+
+  void writeChunk() {
+    string data = pending.front().get();
+    pending.pop_front();
+    file.write(data.data(), data.size());
+  }
+
+  ofstream file;
+  string chunk;
+  deque<std::future<string>> pending;
+};
+
+CompressedOutputStream::CompressedOutputStream(const char* path)
+    : std::ostream(nullptr), buffer(new Buffer(path)) {
+  rdbuf(buffer.get());
+  if (!buffer->isOpen())
+    setstate(std::ios::badbit);
+}
+
+CompressedOutputStream::~CompressedOutputStream() {
+  buffer->flushAll();
+}
+
+class CompressedInputStream::Buffer : public std::streambuf {
+  public:
+  Buffer(const char* path) : file(path, std::ios::binary) {
+    char header[headerSize];
+    if (file.read(header, headerSize) && isChunkHeader(header)) {
+      file.seekg(0);
+      chunked = true;
+    } else {
+      file.close();
+      gzInput = gzopen(path, "rb");
+    }
+  }
+
+  ~Buffer() {
+    if (gzInput)
+      gzclose(gzInput);
+  }
+
+  bool isOpen() const {
+    return chunked || !!gzInput;
+  }
+
+  protected:
+  virtual int underflow() override {
+    if (gptr() < egptr() || nextChunk())
+      return traits_type::to_int_type(*gptr());
+    return EOF;
+  }
+
+  private:
+  bool nextChunk() {
+    do {
+      if (chunked) {
+        readAhead();
+        if (pending.empty())
+          return false;
+        auto data = pending.front().get();
+        pending.pop_front();
+        if (!data) {
+          pending.clear();
+          chunked = false;
+          return false;
+        }
+        current = std::move(*data);
+        // Start with a single chunk, so that reading just the beginning of a file stays cheap.
+        maxInFlight = min(2 * maxInFlight, getMaxChunksInFlight());
+        readAhead();
+      } else {
+        if (!gzInput)
+          return false;
+        current.resize(chunkSize);
+        int size = gzread(gzInput, &current[0], chunkSize);
+        if (size <= 0)
+          return false;
+        current.resize(size);
+      }
+    } while (current.empty());
+    setg(&current[0], &current[0], &current[0] + current.size());
+    return true;
+  }
+
+  void readAhead() {
+    while (pending.size() < maxInFlight)
+      if (auto member = readMember())
+        pending.push_back(std::async(std::launch::async, decompressChunk, std::move(*member)));
+      else
+        break;
+  }
+
+  optional<string> readMember() {
+    string member(headerSize, 0);
+    if (!file.read(&member[0], headerSize) || !isChunkHeader(member.data()))
+      return none;
+    uint32_t size = getUint32(&member[20]);
+    if (size < headerSize + trailerSize || size > 8 * chunkSize)
+      return none;
+    member.resize(size);
+    if (!file.read(&member[headerSize], size - headerSize))
+      return none;
+    return member;
+  }
+
+  ifstream file;
+  gzFile gzInput = nullptr;
+  bool chunked = false;
+  string current;
+  int maxInFlight = 1;
+  deque<std::future<optional<string>>> pending;
+};
+
+CompressedInputStream::CompressedInputStream(const char* path)
+    : std::istream(nullptr), buffer(new Buffer(path)) {
+  rdbuf(buffer.get());
+  if (!buffer->isOpen())
+    setstate(std::ios::badbit);
+}
+
+CompressedInputStream::~CompressedInputStream() {
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "util.h"
+
+/** Writes a gzip file as a sequence of independently compressed members. Data is gathered into large
+    chunks, which are compressed on worker threads and written in order. Each member stores its sizes
+    in the gzip extra field, so that CompressedInputStream can find and decompress the following chunks
+    ahead of the reader. Any gzip reader still sees an ordinary file.*/
+class CompressedOutputStream : public std::ostream {
+  public:
+  CompressedOutputStream(const char* path);
+  ~CompressedOutputStream();
+
+  private:
+  class Buffer;
+  unique_ptr<Buffer> buffer;
+};
+
+/** Reads files written by CompressedOutputStream, decompressing chunks on worker threads ahead of the
+    reader. Falls back to sequential decompression for other gzip files.*/
+class CompressedInputStream : public std::istream {
+  public:
+  CompressedInputStream(const char* path);
+  ~CompressedInputStream();
+
+  private:
+  class Buffer;
+  unique_ptr<Buffer> buffer;
+};
@@ -18,24 +18,64 @@ void setInitializedStatics() {
 }
 
 
+// Ids are created and looked up from world generation threads and parallel battles. The names are stored in
+// chunks that never move, so that data() can read them without locking. The lookup table is only read once it's
+// frozen, and ids created after that go into a second table, which is guarded by the mutex.
+template <typename T>
+struct ContentId<T>::Registry {
+  static constexpr int chunkSize = 1024;
+  array<unique_ptr<string[]>, 1024> names;
+  int numIds = 0;
+  unordered_map<string, int> ids;
+  unordered_map<string, int> idsAfterFreeze;
+  atomic<bool> frozen{false};
+  std::mutex mutex;
+};
+
 template<typename T>
-vector<string>& ContentId<T>::getAllIds() {
-  static vector<string> ret;
+typename ContentId<T>::Registry& ContentId<T>::getRegistry() {
+  static Registry ret;
   assert(staticsInitialized && !strcmp(staticsInitialized, "initialized"));
   return ret;
 }
 
 template <typename T>
 int ContentId<T>::getId(const char* text) {
-  static unordered_map<string, int> ids;
-  static int generatedId = 0;
-  if (!ids.count(text)) {
-    ids[text] = generatedId;
-    getAllIds().push_back(text);
-    ++generatedId;
+  auto& registry = getRegistry();
+  if (registry.frozen.load(std::memory_order_acquire)) {
+    auto it = registry.ids.find(text);
+    if (it != registry.ids.end())
+      return it->second;
   }
-  auto ret = getReferenceMaybe(ids, text);
-  return *ret;
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto it = registry.ids.find(text);
+  if (it != registry.ids.end())
+    return it->second;
+  auto& ids = registry.frozen ? registry.idsAfterFreeze : registry.ids;
+  it = ids.find(text);
+  if (it != ids.end())
+    return it->second;
+  int id = registry.numIds;
+  CHECK(id < int(registry.names.size()) * Registry::chunkSize) << "Too many content ids";
+  auto& chunk = registry.names[id / Registry::chunkSize];
+  if (!chunk)
+    chunk.reset(new string[Registry::chunkSize]);
+  chunk[id % Registry::chunkSize] = text;
+  ids[text] = id;
+  ++registry.numIds;
+  return id;
+}
+
+template <typename T>
+const char* ContentId<T>::getName(InternalId id) {
+  return getRegistry().names[id / Registry::chunkSize][id % Registry::chunkSize].data();
+}
+
+template <typename T>
+void ContentId<T>::freeze() {
+  auto& registry = getRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.frozen.store(true, std::memory_order_release);
 }
 
 template <typename T>
@@ -76,7 +116,7 @@ int ContentId<T>::getHash() const {
 
 template <typename T>
 const char* ContentId<T>::data() const {
-  return getAllIds()[id].data();
+  return getName(id);
 }
 
 template <typename T>
@@ -141,7 +181,7 @@ int PrimaryId<T>::getHash() const {
 
 template<typename T>
 const char* PrimaryId<T>::data() const {
-  return ContentId<T>::getAllIds()[id].data();
+  return ContentId<T>::getName(id);
 }
 
 template<typename T>
@@ -186,13 +226,22 @@ template void PrimaryId<T>::serialize(TextOutputArchive&, unsigned); \
 template std::ostream& operator <<(std::ostream& d, ContentId<T> id); \
 PRETTY_SPEC(T)
 
-INST(ViewId)
-INST(FurnitureType)
-INST(ItemListId)
-INST(EnemyId)
-INST(FurnitureListId)
-INST(SpellId)
-INST(TechId)
-INST(CreatureId)
-INST(SpellSchoolId)
-INST(CustomItemId)
+#define CONTENT_ID_TYPES(X) \
+X(ViewId) \
+X(FurnitureType) \
+X(ItemListId) \
+X(EnemyId) \
+X(FurnitureListId) \
+X(SpellId) \
+X(TechId) \
+X(CreatureId) \
+X(SpellSchoolId) \
+X(CustomItemId)
+
+CONTENT_ID_TYPES(INST)
+
+void freezeContentIds() {
+#define FREEZE(T) ContentId<T>::freeze();
+  CONTENT_ID_TYPES(FREEZE)
+#undef FREEZE
+}
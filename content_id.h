@@ -27,13 +27,21 @@ class ContentId {
 
   private:
   friend PrimaryId<T>;
+  friend void freezeContentIds();
   InternalId id;
-  static vector<string>& getAllIds();
+  struct Registry;
+  static Registry& getRegistry();
   static int getId(const char* text);
+  static const char* getName(InternalId);
+  static void freeze();
 };
 
 void setInitializedStatics();
 
+/** Should be called once the content is loaded. Afterwards the ids that already exist are looked up without
+    locking, which matters when they are used from many threads.*/
+void freezeContentIds();
+
 template <typename T>
 class PrimaryId {
   public:
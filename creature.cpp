@@ -173,7 +173,7 @@ CreatureAction Creature::castSpell(const Spell* spell, Position target) const {
 
 void Creature::updateLastingFX(ViewObject& object) {
   object.particleEffects.clear();
-  for (auto effect : ENUM_ALL(LastingEffect))
+  for (auto effect : attributes->getActiveEffects())
     if (isAffected(effect))
       if (auto fx = LastingEffects::getFX(effect))
         object.particleEffects.insert(*fx);
@@ -582,9 +582,14 @@ CreatureAction Creature::pickUp(const vector<Item*>& itemsAll) const {
 }
 
 vector<vector<Item*>> Creature::stackItems(vector<Item*> items) const {
-  map<string, vector<Item*> > stacks = groupBy<Item*, string>(items,
-      [this] (Item* const& item) { return item->getNameAndModifiers(false, this); });
-  return getValues(stacks);
+  if (isAffected(LastingEffect::BLIND)) {
+    map<string, vector<Item*> > stacks = groupBy<Item*, string>(items,
+        [this] (Item* const& item) { return item->getNameAndModifiers(false, this); });
+    return getValues(stacks);
+  }
+  // Items for sale show their price next to the name.
+  return Item::stackItems(items, [this] (const Item* item) {
+      return item->getShopkeeper(this) ? " (" + toString(item->getPrice()) + " gold)" : string(); });
 }
 
 CreatureAction Creature::drop(const vector<Item*>& items) const {
@@ -1007,7 +1012,9 @@ void Creature::tick() {
   equipment->tick(position);
   if (isDead())
     return;
-  for (LastingEffect effect : ENUM_ALL(LastingEffect)) {
+  // Other effects can neither time out nor tick. Ticking an effect may add or remove others, which the iteration
+  // picks up, since it checks the live set in enum order.
+  for (LastingEffect effect : attributes->getActiveEffects()) {
     if (attributes->considerTimeout(effect, *getGlobalTime()))
       LastingEffects::onTimedOut(this, effect, true);
     if (isDead())
@@ -1166,7 +1173,7 @@ bool Creature::takeDamage(const Attack& attack) {
         c->removeEffect(LastingEffect::SLEEP);
   }
   double defense = getAttr(AttrType::DEFENSE);
-  for (LastingEffect effect : ENUM_ALL(LastingEffect))
+  for (LastingEffect effect : attributes->getActiveEffects())
     if (isAffected(effect))
       defense = LastingEffects::modifyCreatureDefense(effect, defense, attack.damageType);
   double damage = getDamage((double) attack.strength / defense);
@@ -1192,7 +1199,7 @@ bool Creature::takeDamage(const Attack& attack) {
     you(MsgType::GET_HIT_NODAMAGE);
   for (auto& e : attack.effect)
     e.apply(position, attack.attacker);
-  for (LastingEffect effect : ENUM_ALL(LastingEffect))
+  for (LastingEffect effect : attributes->getActiveEffects())
     if (isAffected(effect))
       LastingEffects::afterCreatureDamage(this, effect);
   return returnValue;
@@ -1409,7 +1416,7 @@ CreatureAction Creature::torture(Creature* other) const {
 }
 
 void Creature::retire() {
-  for (LastingEffect effect : ENUM_ALL(LastingEffect))
+  for (LastingEffect effect : attributes->getActiveEffects())
     if (attributes->considerTimeout(effect, GlobalTime(1000000)))
       LastingEffects::onTimedOut(this, effect, false);
   spellMap->setAllReady();
@@ -1802,11 +1809,21 @@ CreatureAction Creature::moveTowards(Position pos, bool away, NavigationFlags fl
   if (!away && !canNavigateToOrNeighbor(pos))
     return CreatureAction();
   auto currentPath = shortestPath;
+  auto tryDetour = [&] (Position blocked) -> CreatureAction {
+    if (!away && currentPath->repair(this, blocked)) {
+      Position next = currentPath->getNextMove(position);
+      if (!next.getCreature())
+        if (auto action = move(next, currentPath->getNextNextMove(position)))
+          return action.append([path = *currentPath](Creature* c) { c->shortestPath = path; });
+    }
+    return CreatureAction();
+  };
   for (int i : Range(2)) {
     bool wasNew = false;
-    INFO << identify() << (away ? " retreating " : " navigating ") << position.getCoord() << " to " << pos.getCoord();
-    if (!currentPath || Random.roll(10) || currentPath->isReversed() != away ||
-        currentPath->getTarget().dist8(pos).value_or(10000000) > *position.dist8(pos) / 10) {
+    INFO_LIMITED(50) << identify() << (away ? " retreating " : " navigating ") << position.getCoord() << " to " << pos.getCoord();
+    if (!currentPath || currentPath->isReversed() != away ||
+        currentPath->getTarget().dist8(pos).value_or(10000000) > *position.dist8(pos) / 10 ||
+        (!away && !currentPath->repair(this))) {
       INFO << "Calculating new path";
       currentPath = LevelShortestPath(this, pos, away ? -1.5 : 0);
       wasNew = true;
@@ -1822,7 +1839,7 @@ CreatureAction Creature::moveTowards(Position pos, bool away, NavigationFlags fl
         if (flags.swapPosition || !pos2.getCreature())
           return action.append([path = *currentPath](Creature* c) { c->shortestPath = path; });
         else
-          return CreatureAction();
+          return tryDetour(pos2);
       } else {
         INFO << "Trying to destroy";
         if (!pos2.canEnterEmpty(this) && flags.destroy) {
@@ -1834,6 +1851,9 @@ CreatureAction Creature::moveTowards(Position pos, bool away, NavigationFlags fl
           if (auto bridgeAction = construct(getPosition().getDir(pos2), FurnitureType("BRIDGE")))
             return bridgeAction.append([path = *currentPath](Creature* c) { c->shortestPath = path; });
         }
+        if (pos2.getCreature())
+          if (auto action = tryDetour(pos2))
+            return action;
       }
     } else
       INFO << "Position unreachable";
@@ -1889,12 +1909,7 @@ Creature::MoveId Creature::getCurrentMoveId() const {
 
 const vector<Creature*>& Creature::getVisibleEnemies() const {
   auto get = [&] {
-    vector<Creature*> ret;
-    for (Creature* c : position.getAllCreatures(FieldOfView::sightRange))
-      if ((canSee(c) || isUnknownAttacker(c)) && isEnemy(c)) {
-        ret.push_back(c);
-      }
-    return ret;
+    return getVisibleCreatures().filter([&](const Creature* c) { return isEnemy(c); });
   };
   auto currentMoveId = getCurrentMoveId();
   if (!visibleEnemies || visibleEnemies->first != currentMoveId)
@@ -1905,10 +1920,20 @@ const vector<Creature*>& Creature::getVisibleEnemies() const {
 const vector<Creature*>& Creature::getVisibleCreatures() const {
   auto get = [&] {
     vector<Creature*> ret;
-    for (Creature* c : position.getAllCreatures(FieldOfView::sightRange))
-      if (canSee(c) || isUnknownAttacker(c)) {
+    auto candidates = position.getAllCreatures(FieldOfView::sightRange);
+    // Same as canSee for every candidate, but the viewer is only checked once.
+    vector<int> inSight;
+    if (!candidates.empty() && position.isValid() && !isAffected(LastingEffect::BLIND))
+      inSight = getLevel()->getVisible(position.getCoord(), candidates, getVision());
+    int nextInSight = 0;
+    for (int i : All(candidates)) {
+      Creature* c = candidates[i];
+      bool isInSight = nextInSight < inSight.size() && inSight[nextInSight] == i;
+      if (isInSight)
+        ++nextInSight;
+      if ((isInSight && canSeeInPosition(c)) || canSeeOutsidePosition(c) || isUnknownAttacker(c))
         ret.push_back(c);
-      }
+    }
     return ret;
   };
   auto currentMoveId = getCurrentMoveId();
@@ -1965,7 +1990,7 @@ vector<AdjectiveInfo> Creature::getGoodAdjectives() const {
   PROFILE;
   vector<AdjectiveInfo> ret;
   if (auto time = getGlobalTime()) {
-    for (LastingEffect effect : ENUM_ALL(LastingEffect))
+    for (LastingEffect effect : attributes->getActiveEffects())
       if (attributes->isAffected(effect, *time))
         if (auto name = LastingEffects::getGoodAdjective(effect)) {
           ret.push_back({ *name, LastingEffects::getDescription(effect) });
@@ -1973,7 +1998,7 @@ vector<AdjectiveInfo> Creature::getGoodAdjectives() const {
             ret.back().name += attributes->getRemainingString(effect, *getGlobalTime());
         }
   } else
-    for (LastingEffect effect : ENUM_ALL(LastingEffect))
+    for (LastingEffect effect : attributes->getActiveEffects())
       if (attributes->isAffectedPermanently(effect))
         if (auto name = LastingEffects::getGoodAdjective(effect))
           ret.push_back({ *name, LastingEffects::getDescription(effect) });
@@ -1992,7 +2017,7 @@ vector<AdjectiveInfo> Creature::getBadAdjectives() const {
   vector<AdjectiveInfo> ret;
   getBody().getBadAdjectives(ret);
   if (auto time = getGlobalTime()) {
-    for (LastingEffect effect : ENUM_ALL(LastingEffect))
+    for (LastingEffect effect : attributes->getActiveEffects())
       if (attributes->isAffected(effect, *time))
         if (auto name = LastingEffects::getBadAdjective(effect)) {
           ret.push_back({ *name, LastingEffects::getDescription(effect) });
@@ -2000,7 +2025,7 @@ vector<AdjectiveInfo> Creature::getBadAdjectives() const {
             ret.back().name += attributes->getRemainingString(effect, *getGlobalTime());
         }
   } else
-    for (LastingEffect effect : ENUM_ALL(LastingEffect))
+    for (LastingEffect effect : attributes->getActiveEffects())
       if (attributes->isAffectedPermanently(effect))
         if (auto name = LastingEffects::getBadAdjective(effect))
           ret.push_back({ *name, LastingEffects::getDescription(effect) });
@@ -36,6 +36,16 @@ void CreatureAttributes::initializeLastingEffects() {
   for (auto effect : ENUM_ALL(LastingEffect))
     if (body->isIntrinsicallyAffected(effect))
       ++permanentEffects[effect];
+  updateActiveEffects();
+}
+
+void CreatureAttributes::updateActiveEffect(LastingEffect effect) {
+  activeEffects.set(effect, lastingEffects[effect] > GlobalTime(0) || permanentEffects[effect] > 0);
+}
+
+void CreatureAttributes::updateActiveEffects() {
+  for (auto effect : ENUM_ALL(LastingEffect))
+    updateActiveEffect(effect);
 }
 
 void CreatureAttributes::randomize() {
@@ -71,6 +81,8 @@ void CreatureAttributes::serializeImpl(Archive& ar, const unsigned int version)
 template <class Archive>
 void CreatureAttributes::serialize(Archive& ar, const unsigned int version) {
   serializeImpl(ar, version);
+  if (Archive::is_loading::value)
+    updateActiveEffects();
 }
 
 SERIALIZABLE(CreatureAttributes);
@@ -212,6 +224,7 @@ void CreatureAttributes::add(BodyPart p, int count) {
   for (auto effect : ENUM_ALL(LastingEffect))
     if (body->isIntrinsicallyAffected(effect))
       ++permanentEffects[effect];
+  updateActiveEffects();
 }
 
 optional<string> CreatureAttributes::getPetReaction(const Creature* me) const {
@@ -240,16 +253,22 @@ void CreatureAttributes::chatReaction(Creature* me, Creature* other) {
 
 bool CreatureAttributes::isAffected(LastingEffect effect, GlobalTime time) const {
   PROFILE;
+  if (lastingEffects[effect] <= time && !isAffectedPermanently(effect))
+    return false;
   if (auto suppressor = LastingEffects::getSuppressor(effect))
     if (isAffected(*suppressor, time))
       return false;
-  return lastingEffects[effect] > time || isAffectedPermanently(effect);
+  return true;
 }
 
 GlobalTime CreatureAttributes::getTimeOut(LastingEffect effect) const {
   return lastingEffects[effect];
 }
 
+const EnumSet<LastingEffect>& CreatureAttributes::getActiveEffects() const {
+  return activeEffects;
+}
+
 bool CreatureAttributes::considerTimeout(LastingEffect effect, GlobalTime current) {
   if (lastingEffects[effect] > GlobalTime(0) && lastingEffects[effect] <= current) {
     clearLastingEffect(effect);
@@ -262,6 +281,7 @@ bool CreatureAttributes::considerTimeout(LastingEffect effect, GlobalTime curren
 void CreatureAttributes::addLastingEffect(LastingEffect effect, GlobalTime endTime) {
   if (lastingEffects[effect] < endTime)
     lastingEffects[effect] = endTime;
+  updateActiveEffect(effect);
 }
 
 static bool consumeProb() {
@@ -390,14 +410,17 @@ bool CreatureAttributes::isAffectedPermanently(LastingEffect effect) const {
 
 void CreatureAttributes::clearLastingEffect(LastingEffect effect) {
   lastingEffects[effect] = GlobalTime(0);
+  updateActiveEffect(effect);
 }
 
 void CreatureAttributes::addPermanentEffect(LastingEffect effect, int count) {
   permanentEffects[effect] += count;
+  updateActiveEffect(effect);
 }
 
 void CreatureAttributes::removePermanentEffect(LastingEffect effect, int count) {
   permanentEffects[effect] -= count;
+  updateActiveEffect(effect);
 }
 
 const MinionActivityMap& CreatureAttributes::getMinionActivities() const {
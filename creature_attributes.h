@@ -98,6 +98,8 @@ class CreatureAttributes {
   GlobalTime getTimeOut(LastingEffect) const;
   string getRemainingString(LastingEffect, GlobalTime) const;
   void clearLastingEffect(LastingEffect);
+  /** Effects that are timed or permanent, the only ones that can affect the creature or time out.*/
+  const EnumSet<LastingEffect>& getActiveEffects() const;
   void addPermanentEffect(LastingEffect, int count);
   void removePermanentEffect(LastingEffect, int count);
   bool considerTimeout(LastingEffect, GlobalTime current);
@@ -152,4 +154,7 @@ class CreatureAttributes {
   optional<string> SERIAL(petReaction);
   optional<LastingEffect> SERIAL(hatedByEffect);
   void initializeLastingEffects();
+  EnumSet<LastingEffect> activeEffects;
+  void updateActiveEffect(LastingEffect);
+  void updateActiveEffects();
 };
@@ -48,6 +48,18 @@ DebugLog::Logger DebugLog::get() {
   return Logger(outputs);
 }
 
+LogRateLimiter::LogRateLimiter(int m) : maxPerSecond(m), periodStart(steady_clock::now()) {
+}
+
+bool LogRateLimiter::allow() {
+  auto now = steady_clock::now();
+  if (now - periodStart >= milliseconds(1000)) {
+    periodStart = now;
+    count = 0;
+  }
+  return count++ < maxPerSecond;
+}
+
 DebugLog InfoLog;
 DebugLog FatalLog;
 DebugLog UserInfoLog;
@@ -21,7 +21,18 @@
 #define FATAL FatalLog.get() << "FATAL " << __FILE__ << ":" << __LINE__ << " "
 #define USER_FATAL UserErrorLog.get()
 #define USER_INFO UserInfoLog.get()
-#define INFO InfoLog.get() << __FILE__ << ":" <<  __LINE__ << " "
+// The arguments aren't evaluated if no output is attached to InfoLog. Building with DISABLE_INFO_LOG
+// removes the statements altogether.
+#define INFO_IF(cond) !(cond) ? (void) 0 : LogVoidify() & InfoLog.get() << __FILE__ << ":" <<  __LINE__ << " "
+#ifdef DISABLE_INFO_LOG
+#define INFO INFO_IF(false)
+#define INFO_LIMITED(maxPerSecond) INFO_IF(false)
+#else
+#define INFO INFO_IF(InfoLog.isEnabled())
+// Like INFO, but each call site logs at most maxPerSecond messages per second.
+#define INFO_LIMITED(maxPerSecond) INFO_IF(InfoLog.isEnabled() && \
+    []() -> LogRateLimiter& { static LogRateLimiter limiter(maxPerSecond); return limiter; }().allow())
+#endif
 #define CHECK(exp) if (!(exp)) FATAL << ": " << #exp << " is false. "
 #define USER_CHECK(exp) if (!(exp)) USER_FATAL
 //#define CHECKEQ(exp, exp2) if ((exp) != (exp2)) FATAL << __FILE__ << ":" << __LINE__ << ": " << #exp << " = " << #exp2 << " is false. " << exp << " " << exp2
@@ -75,6 +86,9 @@ class DebugOutput {
 class DebugLog {
   public:
   void addOutput(DebugOutput);
+  bool isEnabled() const {
+    return !outputs.empty();
+  }
 
   class Logger {
     public:
@@ -101,6 +115,23 @@ class DebugLog {
   std::vector<DebugOutput> outputs;
 };
 
+// Turns a log statement into a void expression, so that it can be a branch of ?: in INFO_IF.
+struct LogVoidify {
+  template <typename T>
+  void operator & (const T&) {}
+};
+
+class LogRateLimiter {
+  public:
+  LogRateLimiter(int maxPerSecond);
+  bool allow();
+
+  private:
+  int maxPerSecond;
+  int count = 0;
+  steady_clock::time_point periodStart;
+};
+
 extern DebugLog InfoLog;
 extern DebugLog FatalLog;
 extern DebugLog UserErrorLog;
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "util.h"
+
+/** Open addressing hash table of elements identified by a UniqueEntity id, used by EntityMap and EntitySet.
+    Elements are stored densely and iterated in insertion order, except that erasing an element moves the last
+    one into its place.*/
+template <typename Id, typename Elem>
+class EntityIdTable {
+  public:
+  using Iter = typename std::vector<Elem>::const_iterator;
+
+  const Elem* find(const Id& id) const {
+    int bucket = findBucket(id);
+    return bucket > -1 ? &elems[buckets[bucket]] : nullptr;
+  }
+
+  Elem* find(const Id& id) {
+    int bucket = findBucket(id);
+    return bucket > -1 ? &elems[buckets[bucket]] : nullptr;
+  }
+
+  // The element's id must not be present yet.
+  Elem& insert(Elem elem) {
+    if (2 * (elems.size() + 1) > buckets.size())
+      rehash(max<int>(16, 2 * buckets.size()));
+    int bucket = getHome(getId(elem));
+    while (buckets[bucket] > -1)
+      bucket = (bucket + 1) & mask;
+    buckets[bucket] = elems.size();
+    elems.push_back(std::move(elem));
+    return elems.back();
+  }
+
+  bool erase(const Id& id) {
+    int bucket = findBucket(id);
+    if (bucket == -1)
+      return false;
+    int index = buckets[bucket];
+    // Shift back the following elements of the probe sequence, so that no tombstones are needed.
+    for (int next = (bucket + 1) & mask; buckets[next] > -1; next = (next + 1) & mask) {
+      int home = getHome(getId(elems[buckets[next]]));
+      if (((next - home) & mask) >= ((next - bucket) & mask)) {
+        buckets[bucket] = buckets[next];
+        bucket = next;
+      }
+    }
+    buckets[bucket] = -1;
+    if (index < elems.size() - 1) {
+      buckets[findBucket(getId(elems.back()))] = index;
+      elems[index] = std::move(elems.back());
+    }
+    elems.pop_back();
+    return true;
+  }
+
+  void clear() {
+    elems.clear();
+    buckets.clear();
+  }
+
+  int size() const {
+    return elems.size();
+  }
+
+  bool empty() const {
+    return elems.empty();
+  }
+
+  Iter begin() const {
+    return elems.begin();
+  }
+
+  Iter end() const {
+    return elems.end();
+  }
+
+  private:
+  static const Id& getId(const Id& id) {
+    return id;
+  }
+
+  template <typename Value>
+  static const Id& getId(const pair<Id, Value>& elem) {
+    return elem.first;
+  }
+
+  int getHome(const Id& id) const {
+    return int((uint32_t(id.getHash()) * 2654435769u) >> shift);
+  }
+
+  int findBucket(const Id& id) const {
+    if (buckets.empty())
+      return -1;
+    for (int bucket = getHome(id);; bucket = (bucket + 1) & mask) {
+      int index = buckets[bucket];
+      if (index == -1)
+        return -1;
+      if (getId(elems[index]) == id)
+        return bucket;
+    }
+  }
+
+  void rehash(int size) {
+    buckets.assign(size, -1);
+    mask = size - 1;
+    shift = 32;
+    while ((1 << (32 - shift)) < size)
+      --shift;
+    for (int index = 0; index < elems.size(); ++index) {
+      int bucket = getHome(getId(elems[index]));
+      while (buckets[bucket] > -1)
+        bucket = (bucket + 1) & mask;
+      buckets[bucket] = index;
+    }
+  }
+
+  std::vector<Elem> elems;
+  // Indexes into elems, -1 for empty buckets. The size is a power of two and at least twice the number of elements.
+  std::vector<int> buckets;
+  int mask = 0;
+  int shift = 32;
+};
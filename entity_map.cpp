@@ -109,6 +109,18 @@ int EntityMap<Key, Value>::getSize() const {
   return elems.size();
 }
 
+template <typename Key, typename Value>
+typename EntityMap<Key, Value>::Iter EntityMap<Key, Value>::begin() const {
+  return elems.begin();
+}
+
+template <typename Key, typename Value>
+typename EntityMap<Key, Value>::Iter EntityMap<Key, Value>::end() const {
+  return elems.end();
+}
+
+#ifdef ORDERED_ENTITY_CONTAINERS
+
 template <typename Key, typename Value>
 vector<typename UniqueEntity<Key>::Id> EntityMap<Key, Value>::getKeys() const {
   return ::getKeys(elems);
@@ -159,20 +171,94 @@ bool EntityMap<Key,Value>::hasKey(EntityId key) const {
 }
 
 template <typename Key, typename Value>
-typename EntityMap<Key, Value>::Iter EntityMap<Key, Value>::begin() const {
-  return elems.begin();
+template <class Archive> 
+void EntityMap<Key, Value>::serialize(Archive& ar, const unsigned int version) {
+  ar(elems);
 }
 
+#else
+
 template <typename Key, typename Value>
-typename EntityMap<Key, Value>::Iter EntityMap<Key, Value>::end() const {
-  return elems.end();
+vector<typename UniqueEntity<Key>::Id> EntityMap<Key, Value>::getKeys() const {
+  vector<EntityId> ret;
+  ret.reserve(elems.size());
+  for (auto& elem : elems)
+    ret.push_back(elem.first);
+  return ret;
+}
+
+template <typename Key, typename Value>
+void EntityMap<Key, Value>::set(EntityId id, const Value& value) {
+  if (auto elem = elems.find(id))
+    elem->second = value;
+  else
+    elems.insert({id, value});
+}
+
+template <typename Key, typename Value>
+void EntityMap<Key, Value>::erase(EntityId id) {
+  elems.erase(id);
+}
+
+template <typename Key, typename Value>
+const Value& EntityMap<Key, Value>::getOrFail(EntityId id) const {
+  auto elem = elems.find(id);
+  CHECK(elem) << "Entity not found in EntityMap";
+  return elem->second;
+}
+
+template <typename Key, typename Value>
+Value& EntityMap<Key, Value>::getOrFail(EntityId id) {
+  auto elem = elems.find(id);
+  CHECK(elem) << "Entity not found in EntityMap";
+  return elem->second;
+}
+
+template <typename Key, typename Value>
+Value& EntityMap<Key, Value>::getOrInit(EntityId id) {
+  if (auto elem = elems.find(id))
+    return elem->second;
+  return elems.insert({id, Value()}).second;
+}
+
+template <typename Key, typename Value>
+optional<Value> EntityMap<Key, Value>::getMaybe(EntityId id) const {
+  if (auto elem = elems.find(id))
+    return elem->second;
+  return none;
+}
+
+template <typename Key, typename Value>
+const Value& EntityMap<Key, Value>::getOrElse(EntityId id, const Value& value) const {
+  if (auto elem = elems.find(id))
+    return elem->second;
+  else
+    return value;
+}
+
+template<typename Key, typename Value>
+bool EntityMap<Key,Value>::hasKey(EntityId key) const {
+  return !!elems.find(key);
 }
 
 template <typename Key, typename Value>
 template <class Archive> 
 void EntityMap<Key, Value>::serialize(Archive& ar, const unsigned int version) {
-  ar(elems);
-}
+  vector<pair<EntityId, Value>> ordered;
+  if (Archive::is_loading::value) {
+    ar(ordered);
+    elems.clear();
+    for (auto& elem : ordered)
+      elems.insert({elem.first, std::move(elem.second)});
+  } else {
+    ordered.reserve(elems.size());
+    for (auto& elem : elems)
+      ordered.push_back(elem);
+    ar(ordered);
+  }
+}
+
+#endif
 
 SERIALIZABLE_TMPL(EntityMap, Creature, double);
 SERIALIZABLE_TMPL(EntityMap, Creature, TimeQueue::ExtendedTime);
@@ -196,3 +282,4 @@ SERIALIZABLE_TMPL(EntityMap, Task, Creature*);
 SERIALIZABLE_TMPL(EntityMap, Item, Creature::Id);
 SERIALIZABLE_TMPL(EntityMap, Item, WeakPointer<const Task>);
 template class EntityMap<Creature, milliseconds>;
+template class EntityMap<Task, int>;
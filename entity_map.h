@@ -17,6 +17,7 @@
 
 #include "unique_entity.h"
 #include "util.h"
+#include "entity_id_table.h"
 
 template <typename Key, typename Value>
 class EntityMap {
@@ -60,12 +61,22 @@ class EntityMap {
   template <class Archive> 
   void serialize(Archive& ar, const unsigned int version);
 
+#ifdef ORDERED_ENTITY_CONTAINERS
   typedef typename map<EntityId, Value>::const_iterator Iter;
+#else
+  typedef typename EntityIdTable<EntityId, pair<EntityId, Value>>::Iter Iter;
+#endif
 
   Iter begin() const;
   Iter end() const;
 
   private:
+#ifdef ORDERED_ENTITY_CONTAINERS
   map<EntityId, Value> SERIAL(elems);
+#else
+  // Serialized as a map in iteration order, which is the order of the std::map backend and keeps the insertion
+  // order of this one after loading.
+  EntityIdTable<EntityId, pair<EntityId, Value>> elems;
+#endif
 };
 
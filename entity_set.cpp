@@ -46,37 +46,42 @@ int EntitySet<T>::getSize() const {
 
 template <class T>
 void EntitySet<T>::insert(const T* e) {
-  elems.insert(e->getUniqueId());
+  insert(e->getUniqueId());
 }
 
 template <class T>
 void EntitySet<T>::erase(const T* e) {
-  elems.erase(e->getUniqueId());
+  erase(e->getUniqueId());
 }
 
 template <class T>
 bool EntitySet<T>::contains(const T* e) const {
-  return elems.count(e->getUniqueId());
+  return contains(e->getUniqueId());
 }
 
 template <class T>
 void EntitySet<T>::insert(WeakPointer<const T> e) {
-  elems.insert(e->getUniqueId());
+  insert(e->getUniqueId());
 }
 
 template <class T>
 void EntitySet<T>::erase(WeakPointer<const T> e) {
-  elems.erase(e->getUniqueId());
+  erase(e->getUniqueId());
 }
 
 template <class T>
 bool EntitySet<T>::contains(WeakPointer<const T> e) const {
-  return elems.count(e->getUniqueId());
+  return contains(e->getUniqueId());
 }
 
 template <class T>
 void EntitySet<T>::insert(typename UniqueEntity<T>::Id e) {
+#ifdef ORDERED_ENTITY_CONTAINERS
   elems.insert(e);
+#else
+  if (!elems.find(e))
+    elems.insert(e);
+#endif
 }
 
 template <class T>
@@ -91,7 +96,11 @@ void EntitySet<T>::erase(typename UniqueEntity<T>::Id e) {
 
 template <class T>
 bool EntitySet<T>::contains(typename UniqueEntity<T>::Id e) const {
+#ifdef ORDERED_ENTITY_CONTAINERS
   return elems.count(e);
+#else
+  return !!elems.find(e);
+#endif
 }
 
 template <class T>
@@ -109,9 +118,32 @@ ItemPredicate EntitySet<Item>::containsPredicate() const {
   return [this](const Item* it) { return contains(it); };
 }
 
+#ifdef ORDERED_ENTITY_CONTAINERS
+
 template <class T>
 SERIALIZE_TMPL(EntitySet<T>, elems)
 
+#else
+
+template <class T>
+template <class Archive>
+void EntitySet<T>::serialize(Archive& ar, const unsigned int version) {
+  vector<typename UniqueEntity<T>::Id> ordered;
+  if (Archive::is_loading::value) {
+    ar(ordered);
+    elems.clear();
+    for (auto& id : ordered)
+      elems.insert(id);
+  } else {
+    ordered.reserve(elems.size());
+    for (auto& id : elems)
+      ordered.push_back(id);
+    ar(ordered);
+  }
+}
+
+#endif
+
 SERIALIZABLE_TMPL(EntitySet, Item);
 SERIALIZABLE_TMPL(EntitySet, Task);
 SERIALIZABLE_TMPL(EntitySet, Creature);
@@ -17,6 +17,7 @@
 
 #include "unique_entity.h"
 #include "util.h"
+#include "entity_id_table.h"
 
 template <typename T>
 class EntitySet {
@@ -44,16 +45,34 @@ class EntitySet {
 
   ItemPredicate containsPredicate() const;
 
+#ifdef ORDERED_ENTITY_CONTAINERS
   typedef typename set<typename UniqueEntity<T>::Id>::const_iterator Iter;
+#else
+  typedef typename EntityIdTable<typename UniqueEntity<T>::Id, typename UniqueEntity<T>::Id>::Iter Iter;
+#endif
 
   Iter begin() const;
   Iter end() const;
 
   size_t getHash() const {
+#ifdef ORDERED_ENTITY_CONTAINERS
     return combineHashIter(elems.begin(), elems.end());
+#else
+    // Iteration order depends on the insertion history, so combine the hashes independently of it.
+    size_t ret = 0;
+    for (auto& id : elems)
+      ret += id.getHash();
+    return ret;
+#endif
   }
 
   private:
+#ifdef ORDERED_ENTITY_CONTAINERS
   set<typename UniqueEntity<T>::Id> SERIAL(elems);
+#else
+  // Serialized as a set in iteration order, which is the order of the std::set backend and keeps the insertion
+  // order of this one after loading.
+  EntityIdTable<typename UniqueEntity<T>::Id, typename UniqueEntity<T>::Id> elems;
+#endif
 };
 
@@ -20,12 +20,15 @@
 #include "square_array.h"
 #include "level.h"
 #include "position.h"
+#include "job_pool.h"
 
 template <class Archive>
 void FieldOfView::serialize(Archive& ar, const unsigned int) {
   ar(level, vision, blocking);
-  if (Archive::is_loading::value)
-    visibility = Table<unique_ptr<Visibility>>(level->getBounds());
+  if (Archive::is_loading::value) {
+    cacheIndex = Table<int>(level->getBounds(), -1);
+    packedBlocking = PackedBlocking(blocking);
+  }
 }
 
 SERIALIZABLE(FieldOfView)
@@ -33,70 +36,393 @@ SERIALIZABLE(FieldOfView)
 SERIALIZATION_CONSTRUCTOR_IMPL(FieldOfView)
 
 FieldOfView::FieldOfView(WLevel l, VisionId v)
-    : level(l), visibility(l->getBounds()), vision(v), blocking(l->getBounds().minusMargin(-1), true) {
+    : level(l), cacheIndex(l->getBounds(), -1), vision(v), blocking(l->getBounds().minusMargin(-1), true) {
   for (auto v : blocking.getBounds())
     blocking[v] = !Position(v, level).canSeeThru(vision);
+  packedBlocking = PackedBlocking(blocking);
+}
+
+FieldOfView::FieldOfView(const Table<bool>& b, int maxCached, Kernel kernel)
+    : cacheIndex(b.getBounds(), -1), maxCached(maxCached), kernel(kernel),
+      blocking(b.getBounds().minusMargin(-1), true) {
+  CHECK(maxCached > 0);
+  for (auto v : b.getBounds())
+    blocking[v] = b[v];
+  packedBlocking = PackedBlocking(blocking);
+}
+
+FieldOfView::PackedBlocking::PackedBlocking(const Table<bool>& blocking) : bounds(blocking.getBounds()),
+    // One extra word on each side, so that reading 64 bits starting anywhere near the table is safe.
+    rowWords((bounds.width() + 63) / 64 + 2), columnWords((bounds.height() + 63) / 64 + 2),
+    rows(bounds.height() * rowWords, ~uint64_t(0)), columns(bounds.width() * columnWords, ~uint64_t(0)) {
+  for (Vec2 v : bounds)
+    set(v, blocking[v]);
+}
+
+static void setBit(uint64_t& word, int bit, bool value) {
+  if (value)
+    word |= uint64_t(1) << bit;
+  else
+    word &= ~(uint64_t(1) << bit);
+}
+
+void FieldOfView::PackedBlocking::set(Vec2 pos, bool value) {
+  Vec2 v = pos - bounds.topLeft();
+  setBit(rows[v.y * rowWords + 1 + v.x / 64], v.x % 64, value);
+  setBit(columns[v.x * columnWords + 1 + v.y / 64], v.y % 64, value);
+}
+
+uint64_t FieldOfView::PackedBlocking::getBits(const vector<uint64_t>& lines, int line, int numWords, int start) const {
+  if (line < 0 || line >= lines.size() / numWords)
+    return ~uint64_t(0);
+  int bit = start + 64;
+  if (bit < 0 || bit + 64 > numWords * 64)
+    return ~uint64_t(0);
+  const uint64_t* words = lines.data() + line * numWords + bit / 64;
+  int offset = bit % 64;
+  if (offset == 0)
+    return words[0];
+  return (words[0] >> offset) | (words[1] << (64 - offset));
+}
+
+uint64_t FieldOfView::PackedBlocking::getRow(int y, int x) const {
+  return getBits(rows, y - bounds.top(), rowWords, x - bounds.left());
+}
+
+uint64_t FieldOfView::PackedBlocking::getColumn(int x, int y) const {
+  return getBits(columns, x - bounds.left(), columnWords, y - bounds.top());
+}
+
+size_t FieldOfView::PackedBlocking::getMemoryUsage() const {
+  return (rows.capacity() + columns.capacity()) * sizeof(uint64_t);
+}
+
+int FieldOfView::getFreeEntry() {
+  if (!freeEntries.empty()) {
+    int ret = freeEntries.back();
+    freeEntries.pop_back();
+    return ret;
+  }
+  if (entries.size() < maxCached) {
+    entries.emplace_back();
+    return entries.size() - 1;
+  }
+  // Second chance sweep: entries accessed since the last pass are skipped once, and pinned ones always.
+  for (int i : Range(2 * entries.size())) {
+    int index = evictionIndex;
+    evictionIndex = (evictionIndex + 1) % entries.size();
+    auto& entry = entries[index];
+    if (pinned.count(entry.origin))
+      continue;
+    if (entry.referenced)
+      entry.referenced = false;
+    else {
+      cacheIndex[entry.origin] = -1;
+      return index;
+    }
+  }
+  entries.emplace_back();
+  return entries.size() - 1;
+}
+
+FieldOfView::Visibility& FieldOfView::getVisibility(Vec2 from) {
+  int index = cacheIndex[from];
+  if (index > -1) {
+    ++numHits;
+    entries[index].referenced = true;
+    return entries[index].visibility;
+  }
+  ++numMisses;
+  index = getFreeEntry();
+  cacheIndex[from] = index;
+  auto& entry = entries[index];
+  entry.origin = from;
+  entry.referenced = true;
+  entry.visibility.compute(cacheIndex.getBounds(), blocking, *packedBlocking, kernel, from.x, from.y);
+  return entry.visibility;
+}
+
+void FieldOfView::addEntry(Vec2 from, Visibility visibility) {
+  int index = getFreeEntry();
+  cacheIndex[from] = index;
+  auto& entry = entries[index];
+  entry.origin = from;
+  entry.referenced = true;
+  entry.visibility = std::move(visibility);
+}
+
+void FieldOfView::prefetch(const vector<Vec2>& origins, JobPool& jobPool) {
+  PROFILE;
+  auto missing = origins.filter([&](Vec2 v) { return cacheIndex[v] == -1; });
+  sort(missing.begin(), missing.end());
+  missing.resize(std::unique(missing.begin(), missing.end()) - missing.begin());
+  // Don't let the prefetched entries evict each other.
+  if (missing.size() > maxCached / 2)
+    missing.resize(maxCached / 2);
+  if (missing.empty())
+    return;
+  numMisses += missing.size();
+  vector<Visibility> results(missing.size());
+  // The workers only read the blocking tables, which don't change until all of them are finished.
+  jobPool.run(missing.size(), [&] (int i, int) {
+    results[i].compute(cacheIndex.getBounds(), blocking, *packedBlocking, kernel, missing[i].x, missing[i].y);
+  });
+  for (int i : All(missing))
+    addEntry(missing[i], std::move(results[i]));
 }
 
 bool FieldOfView::canSee(Vec2 from, Vec2 to) {
   PROFILE;;
   if ((from - to).lengthD() > sightRange)
     return false;
-  if (!visibility[from])
-    visibility[from].reset(new Visibility(level->getBounds(), blocking, from.x, from.y));
-  return visibility[from]->checkVisible(to.x - from.x, to.y - from.y);
+  return getVisibility(from).checkVisible(to.x - from.x, to.y - from.y);
 }
-  
+
 void FieldOfView::squareChanged(Vec2 pos) {
+  squareChanged(pos, !Position(pos, level).canSeeThru(vision));
+}
+
+void FieldOfView::squareChanged(Vec2 pos, bool blocks) {
   PROFILE;
-  blocking[pos] = !Position(pos, level).canSeeThru(vision);
-  vector<Vec2> updateList;
-  if (!visibility[pos])
-    visibility[pos].reset(new Visibility(level->getBounds(), blocking, pos.x, pos.y));
-  for (Vec2 v : Rectangle::centered(pos, sightRange))
-    if (v.inRectangle(visibility.getBounds()) && visibility[v] && visibility[v]->checkVisible(pos.x - v.x, pos.y - v.y)) {
-      visibility[v].reset();
+  blocking[pos] = blocks;
+  packedBlocking->set(pos, blocks);
+  for (Vec2 v : Rectangle::centered(pos, sightRange).intersection(cacheIndex.getBounds())) {
+    int index = cacheIndex[v];
+    if (index > -1 && entries[index].visibility.dependsOn(pos.x - v.x, pos.y - v.y)) {
+      cacheIndex[v] = -1;
+      freeEntries.push_back(index);
     }
+  }
+}
+
+bool FieldOfView::dependsOn(Vec2 from, Vec2 pos) {
+  return getVisibility(from).dependsOn(pos.x - from.x, pos.y - from.y);
+}
+
+void FieldOfView::setPinned(Vec2 pos, bool state) {
+  if (state)
+    pinned.insert(pos);
+  else
+    pinned.erase(pos);
+}
+
+int FieldOfView::getNumCached() const {
+  return entries.size() - freeEntries.size();
+}
+
+int FieldOfView::getNumHits() const {
+  return numHits;
 }
 
+int FieldOfView::getNumMisses() const {
+  return numMisses;
+}
+
+size_t FieldOfView::getMemoryUsage() const {
+  size_t ret = cacheIndex.getWidth() * cacheIndex.getHeight() * sizeof(int)
+      + blocking.getWidth() * blocking.getHeight() * sizeof(bool)
+      + entries.capacity() * sizeof(Entry) + freeEntries.capacity() * sizeof(int)
+      + packedBlocking->getMemoryUsage();
+  for (auto& entry : entries)
+    ret += entry.visibility.getMemoryUsage();
+  return ret;
+}
+
+// Tiles found visible by the computation running on this thread, bit x + sightRange of row y + sightRange.
+// They are packed into runs once the computation is finished.
+static thread_local array<uint64_t, FieldOfView::sightRange * 2 + 1> visibleRows;
+
 void FieldOfView::Visibility::setVisible(Rectangle bounds, int x, int y) {
-  if (Vec2(px + x, py + y).inRectangle(bounds) &&
-      !visible[x + sightRange][y + sightRange] && x * x + y * y <= sightRange * sightRange) {
-    visible[x + sightRange][y + sightRange] = 1;
-    visibleTiles.push_back(Vec2(px + x, py + y));
+  if (Vec2(px + x, py + y).inRectangle(bounds) && x * x + y * y <= sightRange * sightRange)
+    visibleRows[y + sightRange] |= uint64_t(1) << (x + sightRange);
+}
+
+namespace {
+// Each quadrant maps tile i in row r of the shadowcasting to an offset from the origin. Its rows are read
+// from rows or columns of the blocking table, and reversed if i runs against the table.
+struct Quadrant0 {
+  static Vec2 transform(int i, int r) { return Vec2(i, r); }
+  static constexpr bool column = false;
+  static constexpr bool reversed = false;
+};
+
+struct Quadrant1 {
+  static Vec2 transform(int i, int r) { return Vec2(r, -i); }
+  static constexpr bool column = true;
+  static constexpr bool reversed = true;
+};
+
+struct Quadrant2 {
+  static Vec2 transform(int i, int r) { return Vec2(-i, -r); }
+  static constexpr bool column = false;
+  static constexpr bool reversed = true;
+};
+
+struct Quadrant3 {
+  static Vec2 transform(int i, int r) { return Vec2(-r, i); }
+  static constexpr bool column = true;
+  static constexpr bool reversed = false;
+};
+}
+
+static uint64_t reverseBits(uint64_t v) {
+  v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+  v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+  v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+  v = ((v >> 8) & 0x00FF00FF00FF00FFull) | ((v & 0x00FF00FF00FF00FFull) << 8);
+  v = ((v >> 16) & 0x0000FFFF0000FFFFull) | ((v & 0x0000FFFF0000FFFFull) << 16);
+  return (v >> 32) | (v << 32);
+}
+
+// Bits from..to inclusive, empty if from > to.
+static uint64_t getRangeMask(int from, int to) {
+  return ((uint64_t(2) << to) - 1) & ~((uint64_t(1) << from) - 1);
+}
+
+// Bit i + sightRange of row r is set if tile i of the row is within the sight radius.
+static const array<uint64_t, FieldOfView::sightRange + 1>& getCircleMasks() {
+  static auto ret = [] {
+    const int range = FieldOfView::sightRange;
+    array<uint64_t, range + 1> ret {};
+    for (int r : Range(range + 1))
+      for (int i : Range(-range, range + 1))
+        if (i * i + r * r <= range * range)
+          ret[r] |= uint64_t(1) << (i + range);
+    return ret;
+  }();
+  return ret;
+}
+
+template <class Quadrant>
+void FieldOfView::Visibility::setVisible(Rectangle bounds, int row, int left, int right) {
+  uint64_t bits = getRangeMask(left + sightRange, right + sightRange) & getCircleMasks()[row];
+  while (bits) {
+    int i = __builtin_ctzll(bits) - sightRange;
+    bits &= bits - 1;
+    Vec2 v = Quadrant::transform(i, row);
+    setVisible(bounds, v.x, v.y);
+  }
+}
+
+// Same as the recursive version below, but reads whole rows of blocking tiles at once and jumps
+// between runs of blocking tiles instead of visiting every tile.
+template <class Quadrant>
+void FieldOfView::Visibility::calculate(Rectangle bounds, const Rows& rows, int h, int x1, int y1, int x2, int y2) {
+  const int range = 2 * sightRange;
+  if (y2 * x1 >= y1 * x2 || h > range)
+    return;
+  int leftx = x1, lefty = y1;
+  int left_v = (int)floor((double)x1/y1*(h)),
+      right_v = (int)ceil((double)x2/y2*(h)),
+      left_b = (int)floor((double)x1/y1*(h-1));
+  if (left_v % 2)
+    ++left_v;
+  if (right_v % 2)
+    --right_v;
+  if (left_b % 2)
+    ++left_b;
+  const uint64_t row = rows[h / 2];
+  if (left_b >= -range && left_b <= range && ((row >> (left_b / 2 + sightRange)) & 1)) {
+    leftx = left_b + 1;
+    lefty = h + (left_b >= 0 ? -1 : 1);
   }
+  int left = max(left_v, -range) / 2;
+  int right = min(right_v, range) / 2;
+  if (left <= right) {
+    int next = left;
+    uint64_t blocking = row & getRangeMask(left + sightRange, right + sightRange);
+    while (blocking) {
+      int start = __builtin_ctzll(blocking);
+      int end = start + __builtin_ctzll(~(blocking >> start)) - 1;
+      blocking &= ~getRangeMask(start, end);
+      int runStart = start - sightRange;
+      int runEnd = end - sightRange;
+      if (runStart > left) {
+        setVisible<Quadrant>(bounds, h / 2, next, runStart);
+        next = runStart + 1;
+        calculate<Quadrant>(bounds, rows, h + 2, leftx, lefty, runStart * 2 - 1, h + (runStart <= 0 ? -1 : 1));
+      }
+      leftx = runEnd * 2 + 1;
+      lefty = h + (runEnd >= 0 ? -1 : 1);
+    }
+    setVisible<Quadrant>(bounds, h / 2, next, right);
+  }
+  calculate<Quadrant>(bounds, rows, h + 2, leftx, lefty, x2, y2);
 }
 
-FieldOfView::Visibility::Visibility(Rectangle bounds, const Table<bool>& blocking, int x, int y) : px(x), py(y) {
+template <class Quadrant>
+void FieldOfView::Visibility::computeQuadrant(Rectangle bounds, const PackedBlocking& blocking) {
+  Rows rows;
+  for (int r : Range(1, sightRange + 1)) {
+    Vec2 start = Vec2(px, py) + Quadrant::transform(Quadrant::reversed ? sightRange : -sightRange, r);
+    uint64_t bits = Quadrant::column ? blocking.getColumn(start.x, start.y) : blocking.getRow(start.y, start.x);
+    rows[r] = Quadrant::reversed ? reverseBits(bits) >> (63 - 2 * sightRange) : bits;
+  }
+  calculate<Quadrant>(bounds, rows, 2, -1, 1, 1, 1);
+}
+
+void FieldOfView::Visibility::compute(Rectangle bounds, const Table<bool>& blocking,
+    const PackedBlocking& packedBlocking, Kernel kernel, int x, int y) {
   PROFILE;
-  calculate(2 * sightRange, 2 * sightRange,2 * sightRange, 2,-1,1,1,1,
-      [&](int px, int py) { return blocking[Vec2(x + px, y + py)]; },
-      [&](int px, int py) { setVisible(bounds, px, py); });
-  calculate(2 * sightRange, 2 * sightRange,2 * sightRange, 2,-1,1,1,1,
-      [&](int px, int py) { return blocking[Vec2(x + py, y - px)]; },
-      [&](int px, int py) { setVisible(bounds, py, -px); });
-  calculate(2 * sightRange, 2 * sightRange,2 * sightRange,2,-1,1,1,1,
-      [&](int px, int py) { return blocking[Vec2(x - px, y - py)]; },
-      [&](int px, int py) { setVisible(bounds, -px, -py); });
-  calculate(2 * sightRange, 2 * sightRange,2 * sightRange,2,-1,1,1,1,
-      [&](int px, int py) { return blocking[Vec2(x - py, y + px)]; },
-      [&](int px, int py) { setVisible(bounds, -py, px); });
+  px = x;
+  py = y;
+  visibleRows.fill(0);
+  switch (kernel) {
+    case Kernel::RECURSIVE:
+      calculate(2 * sightRange, 2 * sightRange,2 * sightRange, 2,-1,1,1,1,
+          [&](int px, int py) { return blocking[Vec2(x + px, y + py)]; },
+          [&](int px, int py) { setVisible(bounds, px, py); });
+      calculate(2 * sightRange, 2 * sightRange,2 * sightRange, 2,-1,1,1,1,
+          [&](int px, int py) { return blocking[Vec2(x + py, y - px)]; },
+          [&](int px, int py) { setVisible(bounds, py, -px); });
+      calculate(2 * sightRange, 2 * sightRange,2 * sightRange,2,-1,1,1,1,
+          [&](int px, int py) { return blocking[Vec2(x - px, y - py)]; },
+          [&](int px, int py) { setVisible(bounds, -px, -py); });
+      calculate(2 * sightRange, 2 * sightRange,2 * sightRange,2,-1,1,1,1,
+          [&](int px, int py) { return blocking[Vec2(x - py, y + px)]; },
+          [&](int px, int py) { setVisible(bounds, -py, px); });
+      break;
+    case Kernel::BIT_PARALLEL:
+      computeQuadrant<Quadrant0>(bounds, packedBlocking);
+      computeQuadrant<Quadrant1>(bounds, packedBlocking);
+      computeQuadrant<Quadrant2>(bounds, packedBlocking);
+      computeQuadrant<Quadrant3>(bounds, packedBlocking);
+      break;
+  }
   setVisible(bounds, 0, 0);
-/*  ++numSamples;
-  totalIter += visibleTiles.size();
-  if (numSamples%100 == 0)
-    INFO << numSamples << " iterations " << totalIter / numSamples << " avg";*/
+  runs.clear();
+  for (int row : All(visibleRows)) {
+    rowStart[row] = runs.size();
+    uint64_t bits = visibleRows[row];
+    while (bits) {
+      int start = __builtin_ctzll(bits);
+      int end = start + __builtin_ctzll(~(bits >> start)) - 1;
+      bits &= ~getRangeMask(start, end);
+      runs.push_back(Run{(int8_t) (start - sightRange), (int8_t) (end - sightRange)});
+    }
+  }
+  rowStart[visibleRows.size()] = runs.size();
 }
 
-const vector<Vec2>& FieldOfView::Visibility::getVisibleTiles() const {
-  return visibleTiles;
+vector<Vec2> FieldOfView::Visibility::getVisibleTiles() const {
+  int numTiles = 0;
+  for (auto& run : runs)
+    numTiles += run.end - run.begin + 1;
+  vector<Vec2> ret;
+  ret.reserve(numTiles);
+  for (int row : Range(2 * sightRange + 1))
+    for (int i : Range(rowStart[row], rowStart[row + 1]))
+      for (int x : Range(runs[i].begin, runs[i].end + 1))
+        ret.push_back(Vec2(px + x, py + row - sightRange));
+  return ret;
 }
 
-const vector<Vec2>& FieldOfView::getVisibleTiles(Vec2 from) {
-  if (!visibility[from]) {
-    visibility[from].reset(new Visibility(level->getBounds(), blocking, from.x, from.y));
-  }
-  return visibility[from]->getVisibleTiles();
+size_t FieldOfView::Visibility::getMemoryUsage() const {
+  return runs.capacity() * sizeof(Run);
+}
+
+vector<Vec2> FieldOfView::getVisibleTiles(Vec2 from) {
+  return getVisibility(from).getVisibleTiles();
 }
 
 
@@ -139,9 +465,27 @@ void FieldOfView::Visibility::calculate(int left, int right, int up, int h, int
   calculate(left, right, up, h + 2, leftx, lefty, rightx, righty, isBlocking, setVisible);
 }
 
+// Returns if any tile from x1 to x2 in the row is visible.
+bool FieldOfView::Visibility::isAnyVisible(int y, int x1, int x2) const {
+  if (y < -sightRange || y > sightRange)
+    return false;
+  // The runs are sorted, so only the first one that doesn't end before x1 can overlap.
+  for (int i : Range(rowStart[y + sightRange], rowStart[y + sightRange + 1]))
+    if (runs[i].end >= x1)
+      return runs[i].begin <= x2;
+  return false;
+}
+
 bool FieldOfView::Visibility::checkVisible(int x, int y) const {
-  return x >= -sightRange && y >= -sightRange && x <= sightRange && y <= sightRange && 
-    visible[sightRange + x][sightRange + y] == 1;
+  return isAnyVisible(y, x, x);
+}
+
+// Shadowcasting also reads the tiles just outside of the visible area to find the edges of the shadows.
+bool FieldOfView::Visibility::dependsOn(int x, int y) const {
+  for (int dy : Range(-1, 2))
+    if (isAnyVisible(y + dy, x - 1, x + 1))
+      return true;
+  return false;
 }
 
 
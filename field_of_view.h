@@ -19,44 +19,133 @@
 
 class Square;
 class SquareArray;
+class JobPool;
 
+/** Caches the visibility from recently queried tiles. The cache is bounded and evicts the least recently
+    used entries, so that a big level with many light sources and creatures doesn't keep thousands of them.
+    Pinned tiles are never evicted, so the cache may grow beyond the bound if more of them are pinned.*/
 class FieldOfView {
   public:
+  /** RECURSIVE is the original shadowcasting, BIT_PARALLEL runs the same algorithm on rows of blocking
+      tiles packed into words. The default can be switched to RECURSIVE by building with SCALAR_FOV.*/
+  enum class Kernel { RECURSIVE, BIT_PARALLEL };
+#ifdef SCALAR_FOV
+  static constexpr Kernel defaultKernel = Kernel::RECURSIVE;
+#else
+  static constexpr Kernel defaultKernel = Kernel::BIT_PARALLEL;
+#endif
+
   FieldOfView(WLevel, VisionId);
+  /** Creates a field of view without a level, with given blocking tiles.*/
+  FieldOfView(const Table<bool>& blocking, int maxCached = maxCachedOrigins, Kernel = defaultKernel);
   bool canSee(Vec2 from, Vec2 to);
-  const vector<Vec2>& getVisibleTiles(Vec2 from);
+  /** Returns the visible tiles row by row.*/
+  vector<Vec2> getVisibleTiles(Vec2 from);
   void squareChanged(Vec2 pos);
+  void squareChanged(Vec2 pos, bool blocks);
+  /** Returns if changing the tile pos may change the visibility from the tile from.*/
+  bool dependsOn(Vec2 from, Vec2 pos);
+  void setPinned(Vec2, bool);
+  /** Computes the visibility from the given tiles that aren't cached yet on the threads of the pool, and
+      caches it. The results are the same as if they were queried one by one.*/
+  void prefetch(const vector<Vec2>& origins, JobPool&);
+
+  int getNumCached() const;
+  int getNumHits() const;
+  int getNumMisses() const;
+  /** Approximate number of bytes used by the cache and the blocking table.*/
+  size_t getMemoryUsage() const;
 
   SERIALIZATION_DECL(FieldOfView)
 
   static constexpr int sightRange = 30;
+  static constexpr int maxCachedOrigins = 2048;
 
   private:
 
+  /** Blocking tiles packed 64 per word, both by rows and by columns. Tiles outside of the table are blocking.*/
+  class PackedBlocking {
+    public:
+    PackedBlocking(const Table<bool>&);
+    void set(Vec2, bool);
+    /** Bit k of the result is tile (x + k, y).*/
+    uint64_t getRow(int y, int x) const;
+    /** Bit k of the result is tile (x, y + k).*/
+    uint64_t getColumn(int x, int y) const;
+    size_t getMemoryUsage() const;
+
+    private:
+    uint64_t getBits(const vector<uint64_t>&, int line, int numLines, int start) const;
+    Rectangle bounds;
+    int rowWords;
+    int columnWords;
+    vector<uint64_t> rows;
+    vector<uint64_t> columns;
+  };
 
   class Visibility {
     public:
 
     bool checkVisible(int x,int y) const;
-    const vector<Vec2>& getVisibleTiles() const;
+    /** Returns if changing the given tile may change the result.*/
+    bool dependsOn(int x, int y) const;
+    vector<Vec2> getVisibleTiles() const;
+    size_t getMemoryUsage() const;
 
-    Visibility(Rectangle bounds, const Table<bool>& blocking, int x, int y);
+    void compute(Rectangle bounds, const Table<bool>& blocking, const PackedBlocking&, Kernel, int x, int y);
 
     private:
-    array<bitset<sightRange * 2 + 1>, sightRange * 2 + 1> visible;
-    vector<Vec2> visibleTiles;
+    bool isAnyVisible(int y, int x1, int x2) const;
+    // Visible tiles stored as runs of consecutive tiles in every row, relative to the origin. Most rows
+    // only have a few runs, so this takes much less memory than a bitmap or a list of tiles.
+    struct Run {
+      int8_t begin;
+      int8_t end;
+    };
+    vector<Run> runs;
+    // Runs of row y are runs[rowStart[y + sightRange]] up to runs[rowStart[y + sightRange + 1]].
+    array<uint16_t, sightRange * 2 + 2> rowStart;
     void calculate(int,int,int,int, int, int, int, int,
         function<bool (int, int)> isBlocking,
         function<void (int, int)> setVisible);
     void setVisible(Rectangle bounds, int, int);
+    using Rows = array<uint64_t, sightRange + 1>;
+    template <class Quadrant>
+    void computeQuadrant(Rectangle bounds, const PackedBlocking&);
+    template <class Quadrant>
+    void calculate(Rectangle bounds, const Rows&, int h, int x1, int y1, int x2, int y2);
+    template <class Quadrant>
+    void setVisible(Rectangle bounds, int row, int left, int right);
 
     int px;
     int py;
   };
-  
+
+  struct Entry {
+    Visibility visibility;
+    Vec2 origin;
+    // Cleared by the eviction sweep and set again on every access.
+    bool referenced;
+  };
+
+  Visibility& getVisibility(Vec2 from);
+  int getFreeEntry();
+  void addEntry(Vec2 from, Visibility);
+
   WLevel SERIAL(level) = nullptr;
-  Table<unique_ptr<Visibility>> visibility;
+  // Index into entries for every tile, -1 if its visibility isn't cached.
+  Table<int> cacheIndex;
+  // Allocated on demand up to maxCached, and reused afterwards.
+  vector<Entry> entries;
+  vector<int> freeEntries;
+  unordered_set<Vec2, CustomHash<Vec2>> pinned;
+  int evictionIndex = 0;
+  int maxCached = maxCachedOrigins;
+  int numHits = 0;
+  int numMisses = 0;
+  Kernel kernel = defaultKernel;
   VisionId SERIAL(vision);
   Table<bool> SERIAL(blocking);
+  optional<PackedBlocking> packedBlocking;
 };
 
@@ -0,0 +1,183 @@
+#include "stdafx.h"
+#include "flow_field_cache.h"
+
+const float FlowFieldCache::infinity = 1000000000;
+
+// Maximum number of computed fields, each taking one float per tile of the level.
+constexpr int maxFields = 6;
+// Maximum number of targets whose requests are counted.
+constexpr int maxEntries = 32;
+constexpr int minRequests = 3;
+
+const FlowFieldCache::Field* FlowFieldCache::get(const MovementType& movement, Vec2 target,
+    function<Field()> compute) {
+  PROFILE;
+  optional<int> index;
+  for (int i : All(entries))
+    if (entries[i].target == target && entries[i].movement == movement) {
+      index = i;
+      break;
+    }
+  if (!index) {
+    if (entries.size() >= maxEntries)
+      entries.removeIndexPreserveOrder(0);
+    entries.push_back(Entry{movement, target, 0, none});
+    index = entries.size() - 1;
+  } else if (*index != entries.size() - 1) {
+    auto entry = entries.removeIndexPreserveOrder(*index);
+    entries.push_back(std::move(entry));
+    index = entries.size() - 1;
+  }
+  auto& entry = entries.back();
+  ++entry.count;
+  if (entry.field) {
+    ++numHits;
+    return &*entry.field;
+  }
+  if (entry.count < minRequests)
+    return nullptr;
+  ++numMisses;
+  if (getNumFields() >= maxFields)
+    for (auto& elem : entries)
+      if (elem.field) {
+        elem.field = none;
+        elem.count = 0;
+        break;
+      }
+  entry.field = compute();
+  return &*entry.field;
+}
+
+namespace {
+struct QueueElem {
+  Vec2 pos;
+  float value;
+};
+
+bool inline operator < (const QueueElem& e1, const QueueElem& e2) {
+  return e1.value > e2.value || (e1.value == e2.value && e1.pos < e2.pos);
+}
+}
+
+// Lowers the distances reachable from the queued tiles.
+static void relax(FlowFieldCache::Field& field, priority_queue<QueueElem, vector<QueueElem>>& q,
+    const FlowFieldCache::CostFun& getCost, const FlowFieldCache::DirectionsFun& directions) {
+  auto& distance = field.distance;
+  auto& cost = field.cost;
+  while (!q.empty()) {
+    auto elem = q.top();
+    q.pop();
+    Vec2 pos = elem.pos;
+    float posDist = distance[pos];
+    if (elem.value > posDist)
+      continue;
+    for (Vec2 dir : directions(pos)) {
+      Vec2 next = pos + dir;
+      if (next.inRectangle(distance.getBounds())) {
+        if (cost[next] < 0)
+          cost[next] = getCost(next);
+        float dist = posDist + cost[next];
+        if (dist < distance[next]) {
+          distance[next] = dist;
+          q.push({next, dist});
+        }
+      }
+    }
+  }
+}
+
+FlowFieldCache::Field FlowFieldCache::compute(Rectangle bounds, Vec2 target, const CostFun& getCost,
+    const DirectionsFun& directions) {
+  PROFILE;
+  Field ret{Table<float>(bounds, infinity), Table<float>(bounds, -1)};
+  priority_queue<QueueElem, vector<QueueElem>> q;
+  ret.distance[target] = 0;
+  q.push({target, 0});
+  relax(ret, q, getCost, directions);
+  return ret;
+}
+
+// Returns false if the field has to be computed again.
+static bool updateField(FlowFieldCache::Field& field, Vec2 target, Vec2 pos, const FlowFieldCache::CostFun& getCost,
+    const FlowFieldCache::DirectionsFun& directions) {
+  auto& distance = field.distance;
+  auto& cost = field.cost;
+  const float infinity = FlowFieldCache::infinity;
+  // No tile next to this one is reached, so its cost doesn't matter.
+  if (cost[pos] < 0)
+    return true;
+  float oldCost = cost[pos];
+  float newCost = getCost(pos);
+  if (newCost == oldCost)
+    return true;
+  cost[pos] = newCost;
+  if (pos == target)
+    return true;
+  // Directions are symmetric, so the neighbors the tile can be entered from are the ones it leads to.
+  auto getBestNeighbor = [&] {
+    float ret = infinity;
+    for (Vec2 dir : directions(pos)) {
+      Vec2 v = pos + dir;
+      if (v.inRectangle(distance.getBounds()))
+        ret = min(ret, distance[v]);
+    }
+    return ret;
+  };
+  if (newCost > oldCost) {
+    if (distance[pos] >= infinity)
+      return true;
+    // Tiles reached through this one would get further away, which can't be patched locally.
+    for (Vec2 dir : directions(pos)) {
+      Vec2 v = pos + dir;
+      if (v.inRectangle(distance.getBounds()) && v != target && cost[v] >= 0 && distance[v] < infinity &&
+          distance[v] == distance[pos] + cost[v])
+        return false;
+    }
+    distance[pos] = min(infinity, getBestNeighbor() + newCost);
+    return true;
+  }
+  float dist = getBestNeighbor() + newCost;
+  if (dist < distance[pos]) {
+    distance[pos] = dist;
+    priority_queue<QueueElem, vector<QueueElem>> q;
+    q.push({pos, dist});
+    relax(field, q, getCost, directions);
+  }
+  return true;
+}
+
+void FlowFieldCache::update(Vec2 pos, function<float(const MovementType&, Vec2)> getCost,
+    const DirectionsFun& directions) {
+  PROFILE;
+  for (auto& entry : entries)
+    if (auto& field = entry.field)
+      if (pos.inRectangle(field->distance.getBounds()) && !updateField(*field, entry.target, pos,
+          [&](Vec2 v) { return getCost(entry.movement, v); }, directions)) {
+        field = none;
+        entry.count = 0;
+      }
+}
+
+void FlowFieldCache::invalidate(const MovementType& movement) {
+  for (auto& entry : entries)
+    if (entry.movement == movement) {
+      entry.field = none;
+      entry.count = 0;
+    }
+}
+
+int FlowFieldCache::getNumFields() const {
+  int ret = 0;
+  for (auto& entry : entries)
+    if (entry.field)
+      ++ret;
+  return ret;
+}
+
+int FlowFieldCache::getNumHits() const {
+  return numHits;
+}
+
+int FlowFieldCache::getNumMisses() const {
+  return numMisses;
+}
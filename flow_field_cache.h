@@ -0,0 +1,50 @@
+#pragma once
+
+#include "util.h"
+#include "movement_type.h"
+
+/** Least-recently-used cache of distance fields towards popular targets, so that many creatures heading
+    to the same position share a single search. A field is only computed once its target was requested
+    a few times. When a tile changes, the fields are patched, or dropped if that can't be done locally.*/
+class FlowFieldCache {
+  public:
+  struct Field {
+    Table<float> distance;
+    // Entry costs that the distances were computed from. Negative for tiles whose cost was never needed,
+    // which are the ones that aren't next to any reached tile.
+    Table<float> cost;
+  };
+  using CostFun = function<float(Vec2)>;
+  using DirectionsFun = function<vector<Vec2>(Vec2)>;
+
+  /** Computes the distances towards the target with a Dijkstra search.*/
+  static Field compute(Rectangle bounds, Vec2 target, const CostFun&, const DirectionsFun&);
+
+  /** Returns the field towards the target, computing it with \paramname{compute} if the target
+      is requested often enough. Returns nullptr otherwise.*/
+  const Field* get(const MovementType&, Vec2 target, function<Field()> compute);
+
+  /** Updates the fields after the entry cost of the tile may have changed. Fields where the tile got cheaper
+      are patched, and the ones where it got more expensive are dropped if a shortest path leads through it.*/
+  void update(Vec2, function<float(const MovementType&, Vec2)> getCost, const DirectionsFun&);
+  void invalidate(const MovementType&);
+
+  int getNumFields() const;
+  int getNumHits() const;
+  int getNumMisses() const;
+
+  static const float infinity;
+
+  private:
+  struct Entry {
+    MovementType movement;
+    Vec2 target;
+    int count;
+    // Empty until the target is requested often enough.
+    optional<Field> field;
+  };
+  // Ordered from the least recently used.
+  vector<Entry> entries;
+  int numHits = 0;
+  int numMisses = 0;
+};
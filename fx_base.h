@@ -67,6 +67,7 @@ template <class T> struct Curve;
 struct DrawBuffers;
 struct DrawParticle;
 struct Particle;
+class ParticleArray;
 struct ParticleSystem;
 
 struct TextureDef;
@@ -20,6 +20,8 @@ template <class T> struct Curve {
 
   // Position is always within range: <0, 1>
   T sample(float position) const;
+  // True if sample returns the same value for every position
+  bool isConstant() const { return num_keys <= 1; }
 
   void print(int num_steps = 20) const;
 
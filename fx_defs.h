@@ -86,6 +86,8 @@ using PrepareEmissionFunc = float (*)(AnimationContext&, EmissionState&);
 using EmitParticleFunc = void (*)(AnimationContext&, EmissionState&, Particle&);
 
 void defaultAnimateParticle(AnimationContext&, Particle&);
+// Same as calling defaultAnimateParticle on every particle, but works on whole arrays
+void defaultAnimateParticles(AnimationContext&, ParticleArray&);
 float defaultPrepareEmission(AnimationContext&, EmissionState&);
 void defaultEmitParticle(AnimationContext&, EmissionState&, Particle&);
 bool defaultDrawParticle(DrawContext&, const Particle&, DrawParticle&);
@@ -597,7 +597,7 @@ static void addOldMagicMissileEffect(FXManager& mgr) {
 static FVec2 missileBasePos(AnimationContext& ctx, float offset = 0.3f) {
   auto& baseParts = ctx.ps.subSystems[0].particles;
   if (!baseParts.empty()) {
-    auto& pinst = baseParts[0];
+    auto pinst = baseParts[0];
     auto& pdef = ctx.psdef.subSystems[0].particle;
     float pos = clamp(pinst.particleTime(), 0.0f, 1.0f);
     float size = pdef.size.sample(pos) * pinst.size.y;
@@ -1229,8 +1229,8 @@ static void addBlindEffect(FXManager &mgr) {
 
     auto distFunc = [&](FVec2 pos) {
       float dist = fconstant::inf;
-      for (auto &p : ctx.ss.particles)
-        dist = min(dist, distanceSq(p.pos, pos));
+      for (auto &ppos : ctx.ss.particles.positions)
+        dist = min(dist, distanceSq(ppos, pos));
       return dist;
     };
 
@@ -1488,7 +1488,7 @@ static void addBuffEffect(FXManager& mgr) {
   ssdef.animateFunc = [](AnimationContext& ctx, Particle& pinst) {
     defaultAnimateParticle(ctx, pinst);
 
-    int idx = &pinst - ctx.ss.particles.data();
+    int idx = ctx.particleIndex;
     float pos = ctx.globalTime * 2.0f + double(idx) * fconstant::pi * 2.0f / numParticles;
 
     float width = 10.0f + 3.0f * ctx.ps.params.scalar[0];
@@ -5,6 +5,7 @@
 #include "fx_particle_system.h"
 #include "fx_rect.h"
 #include "clock.h"
+#include "job_pool.h"
 
 namespace fx {
 
@@ -21,6 +22,13 @@ FXManager::FXManager() {
 }
 FXManager::~FXManager() { s_instance = nullptr; }
 
+void FXManager::setNumThreads(int numThreads) {
+  if (numThreads > 1)
+    jobPool = unique<JobPool>(numThreads);
+  else
+    jobPool.reset();
+}
+
 const ParticleSystemDef& FXManager::operator[](FXName name) const {
   return systemDefs[name];
 }
@@ -77,22 +85,22 @@ void FXManager::simulate(ParticleSystem &ps, float timeDelta) {
     AnimationContext ctx(ssctx(ps, ssid), globalSimTime, ps.animTime, timeDelta);
     ctx.rand.init(ss.randomSeed);
 
-    for (auto &pinst : ss.particles)
-      ssdef.animateFunc(ctx, pinst);
+    if (ssdef.animateFunc == defaultAnimateParticle)
+      defaultAnimateParticles(ctx, ss.particles);
+    else
+      for (int n = 0; n < ss.particles.size(); n++) {
+        auto pinst = ss.particles[n];
+        ctx.particleIndex = n;
+        ssdef.animateFunc(ctx, pinst);
+        ss.particles.set(n, pinst);
+      }
 
     ss.randomSeed = ctx.randomSeed();
   }
 
   // Removing dead particles
   for (auto &ssinst : ps.subSystems)
-    for (int n = 0; n < (int)ssinst.particles.size(); n++) {
-      auto &pinst = ssinst.particles[n];
-      if (pinst.life > pinst.maxLife) {
-        pinst = ssinst.particles.back();
-        ssinst.particles.pop_back();
-        n--;
-      }
-    }
+    ssinst.particles.removeDead();
 
   // Emitting new particles
   for (int ssid = 0; ssid < (int)psdef.subSystems.size(); ssid++) {
@@ -121,10 +129,11 @@ void FXManager::simulate(ParticleSystem &ps, float timeDelta) {
         min(ssdef.maxActiveParticles - (int)ss.particles.size(), ssdef.maxTotalParticles - ss.totalParticles);
     numParticles = min(numParticles, maxParticles);
 
+    ss.particles.reserve(ss.particles.size() + max(numParticles, 0));
     for (int n = 0; n < numParticles; n++) {
       Particle newInst;
       ssdef.emitFunc(ctx, em, newInst);
-      ss.particles.emplace_back(newInst);
+      ss.particles.push_back(newInst);
       ss.totalParticles++;
     }
 
@@ -163,9 +172,16 @@ void FXManager::simulate(ParticleSystem &ps, float timeDelta) {
 
 void FXManager::simulate(float delta) {
   PROFILE;
-  for (auto& inst : systems)
-    if (!inst.isDead)
-      simulate(inst, delta);
+  // Systems don't depend on each other, so they can be simulated in any order.
+  if (jobPool)
+    jobPool->run((int)systems.size(), [&](int n, int) {
+      if (!systems[n].isDead)
+        simulate(systems[n], delta);
+    });
+  else
+    for (auto& inst : systems)
+      if (!inst.isDead)
+        simulate(inst, delta);
   globalSimTime += delta;
 }
 
@@ -256,19 +272,55 @@ void FXManager::genQuads(vector<DrawParticle>& out, int id, int ssid) {
   DrawContext ctx{ssctx(ps, ssid), vinv(FVec2(tdef.tiles))};
 
   if (ctx.ssdef.multiDrawFunc)
-    for (auto& pinst : ss.particles) {
-      ctx.ssdef.multiDrawFunc(ctx, pinst, out, ps.color);
+    for (int n = 0; n < ss.particles.size(); n++) {
+      ctx.ssdef.multiDrawFunc(ctx, ss.particles[n], out, ps.color);
     }
   else
-    for (auto& pinst : ss.particles) {
+    for (int n = 0; n < ss.particles.size(); n++) {
       DrawParticle dparticle;
-      if (ctx.ssdef.drawFunc(ctx, pinst, dparticle)) {
+      if (ctx.ssdef.drawFunc(ctx, ss.particles[n], dparticle)) {
         dparticle.color = dparticle.color.blend(ps.color);
         out.push_back(std::move(dparticle));
       }
     }
 }
 
+void FXManager::genQuads(vector<DrawParticle>& out, vector<int>& quadCounts, const SubSystemFilter& filter) {
+  PROFILE;
+  quadCounts.assign(systems.size(), 0);
+  auto genSystemQuads = [&](vector<DrawParticle>& quads, int n) {
+    int first = (int)quads.size();
+    if (!systems[n].isDead)
+      for (int ssid = 0; ssid < (int)systems[n].subSystems.size(); ssid++)
+        if (filter(systems[n], ssid))
+          genQuads(quads, n, ssid);
+    quadCounts[n] = (int)quads.size() - first;
+  };
+  if (!jobPool) {
+    for (int n = 0; n < (int)systems.size(); n++)
+      genSystemQuads(out, n);
+    return;
+  }
+  threadQuads.resize(jobPool->getNumThreads());
+  for (auto& quads : threadQuads)
+    quads.clear();
+  systemQuadsOffsets.resize(systems.size());
+  jobPool->run((int)systems.size(), [&](int n, int thread) {
+    systemQuadsOffsets[n] = {thread, (int)threadQuads[thread].size()};
+    genSystemQuads(threadQuads[thread], n);
+  });
+  // Merging in the order of systems, so that the result doesn't depend on how the jobs were scheduled
+  int total = (int)out.size();
+  for (int count : quadCounts)
+    total += count;
+  out.reserve(total);
+  for (int n = 0; n < (int)systems.size(); n++) {
+    auto& source = threadQuads[systemQuadsOffsets[n].first];
+    auto begin = source.begin() + systemQuadsOffsets[n].second;
+    out.insert(out.end(), begin, begin + quadCounts[n]);
+  }
+}
+
 bool FXManager::valid(ParticleSystemId id) const {
   return id >= 0 && id < (int)systems.size() && systems[id].spawnTime == id.getSpawnTime();
 }
@@ -7,6 +7,8 @@
 #include "fx_name.h"
 #include "fx_texture_name.h"
 
+class JobPool;
+
 namespace fx {
 
 class FXManager {
@@ -50,6 +52,15 @@ public:
   auto& getSystems() { return systems; }
   void genQuads(vector<DrawParticle>&, int id, int ssid);
 
+  // Generates quads of all live subsystems accepted by the filter, ordered by system and subsystem.
+  // quadCounts receives the number of quads generated for every system.
+  using SubSystemFilter = function<bool(const ParticleSystem&, int ssid)>;
+  void genQuads(vector<DrawParticle>&, vector<int>& quadCounts, const SubSystemFilter&);
+
+  // With more than one thread, particle systems are simulated and turned into quads in parallel.
+  // The results are the same as with a single thread.
+  void setNumThreads(int);
+
   using Snapshot = vector<ParticleSystem::SubSystem>;
   struct SnapshotGroup {
     SnapshotKey key;
@@ -77,6 +88,10 @@ public:
   EnumMap<FXName, vector<SnapshotGroup>> snapshotGroups;
   EnumMap<TextureName, TextureDef> textureDefs;
 
+  unique_ptr<JobPool> jobPool;
+  vector<vector<DrawParticle>> threadQuads;
+  vector<pair<int, int>> systemQuadsOffsets;
+
   // TODO: add simple statistics: num particles, instances, etc.
   vector<ParticleSystem> systems;
   unique_ptr<RandomGen> randomGen;
@@ -38,6 +38,81 @@ bool DrawParticle::isReasonable() const {
   return true;
 }
 
+template <class Func> void ParticleArray::forEachArray(Func func) {
+  func(positions);
+  func(movements);
+  func(sizes);
+  func(lives);
+  func(maxLives);
+  func(rotations);
+  func(rotSpeeds);
+  func(temps);
+  func(texTiles);
+  func(randomSeeds);
+}
+
+Particle ParticleArray::operator[](int n) const {
+  Particle out;
+  out.pos = positions[n];
+  out.movement = movements[n];
+  out.size = sizes[n];
+  out.life = lives[n];
+  out.maxLife = maxLives[n];
+  out.rot = rotations[n];
+  out.rotSpeed = rotSpeeds[n];
+  out.temp = temps[n];
+  out.texTile = texTiles[n];
+  out.randomSeed = randomSeeds[n];
+  return out;
+}
+
+void ParticleArray::set(int n, const Particle& pinst) {
+  positions[n] = pinst.pos;
+  movements[n] = pinst.movement;
+  sizes[n] = pinst.size;
+  lives[n] = pinst.life;
+  maxLives[n] = pinst.maxLife;
+  rotations[n] = pinst.rot;
+  rotSpeeds[n] = pinst.rotSpeed;
+  temps[n] = pinst.temp;
+  texTiles[n] = pinst.texTile;
+  randomSeeds[n] = pinst.randomSeed;
+}
+
+void ParticleArray::push_back(const Particle& pinst) {
+  positions.push_back(pinst.pos);
+  movements.push_back(pinst.movement);
+  sizes.push_back(pinst.size);
+  lives.push_back(pinst.life);
+  maxLives.push_back(pinst.maxLife);
+  rotations.push_back(pinst.rot);
+  rotSpeeds.push_back(pinst.rotSpeed);
+  temps.push_back(pinst.temp);
+  texTiles.push_back(pinst.texTile);
+  randomSeeds.push_back(pinst.randomSeed);
+}
+
+void ParticleArray::reserve(int count) {
+  forEachArray([count](auto& array) { array.reserve(count); });
+}
+
+void ParticleArray::clear() {
+  forEachArray([](auto& array) { array.clear(); });
+}
+
+void ParticleArray::removeDead() {
+  // Every dead particle is replaced by the last one. Effects such as the orbiting buff particles are keyed on the
+  // particle index, so this keeps the order in which particles always were removed.
+  int num = size();
+  for (int n = 0; n < num; n++)
+    if (lives[n] > maxLives[n]) {
+      --num;
+      forEachArray([=](auto& array) { array[n] = array[num]; });
+      --n;
+    }
+  forEachArray([num](auto& array) { array.resize(num); });
+}
+
 ParticleSystem::SubSystem::SubSystem() {
   for (auto& animVar : animationVars)
     animVar = 0.0f;
@@ -98,6 +173,43 @@ void defaultAnimateParticle(AnimationContext &ctx, Particle &pinst) {
   pinst.life += ctx.timeDelta;
 }
 
+void defaultAnimateParticles(AnimationContext& ctx, ParticleArray& particles) {
+  const auto& slowdownCurve = ctx.pdef.slowdown;
+  int num = particles.size();
+  float timeDelta = ctx.timeDelta;
+  FVec2* __restrict positions = particles.positions.data();
+  FVec2* __restrict movements = particles.movements.data();
+  float* __restrict lives = particles.lives.data();
+  float* __restrict maxLives = particles.maxLives.data();
+  float* __restrict rotations = particles.rotations.data();
+  float* __restrict rotSpeeds = particles.rotSpeeds.data();
+
+  for (int n = 0; n < num; n++) {
+    positions[n] += movements[n] * timeDelta;
+    rotations[n] += rotSpeeds[n] * timeDelta;
+  }
+  if (slowdownCurve.isConstant()) {
+    float slowdown = 1.0f / (1.0f + slowdownCurve.sample(0.0f));
+    if (slowdown < 1.0f) {
+      float factor = pow(slowdown, timeDelta);
+      for (int n = 0; n < num; n++) {
+        movements[n] *= factor;
+        rotSpeeds[n] *= factor;
+      }
+    }
+  } else
+    for (int n = 0; n < num; n++) {
+      float slowdown = 1.0f / (1.0f + slowdownCurve.sample(lives[n] / maxLives[n]));
+      if (slowdown < 1.0f) {
+        float factor = pow(slowdown, timeDelta);
+        movements[n] *= factor;
+        rotSpeeds[n] *= factor;
+      }
+    }
+  for (int n = 0; n < num; n++)
+    lives[n] += timeDelta;
+}
+
 float defaultPrepareEmission(AnimationContext &ctx, EmissionState &em) {
   auto &pdef = ctx.pdef;
   auto &edef = ctx.edef;
@@ -81,6 +81,34 @@ struct Particle {
   uint randomSeed;
 };
 
+// Particles of a single subsystem, stored as separate arrays for every attribute, so that the common
+// animation and removal passes work on contiguous data. Custom functions operate on single Particles.
+class ParticleArray {
+  public:
+  int size() const { return (int)lives.size(); }
+  bool empty() const { return lives.empty(); }
+
+  Particle operator[](int) const;
+  Particle front() const { return (*this)[0]; }
+  void set(int, const Particle&);
+  void push_back(const Particle&);
+  void reserve(int);
+  void clear();
+
+  // Removes all particles which outlived their maxLife, moving the last particle into the place of each one
+  void removeDead();
+
+  vector<FVec2> positions, movements, sizes;
+  vector<float> lives, maxLives;
+  vector<float> rotations, rotSpeeds;
+  vector<float> temps;
+  vector<SVec2> texTiles;
+  vector<uint> randomSeeds;
+
+  private:
+  template <class Func> void forEachArray(Func);
+};
+
 struct DrawParticle {
   bool isReasonable() const;
 
@@ -97,7 +125,7 @@ struct ParticleSystem {
   struct SubSystem {
     SubSystem();
 
-    vector<Particle> particles;
+    ParticleArray particles;
     float animationVars[maxAnimVars];
     float emissionFract = 0.0f;
     uint randomSeed = 123;
@@ -159,6 +187,8 @@ struct AnimationContext : public SubSystemContext {
   const double globalTime;
   const float animTime;
   const float timeDelta, invTimeDelta;
+  // Index of the animated particle within its subsystem
+  int particleIndex = 0;
 };
 
 struct DrawContext : public SubSystemContext {
@@ -177,21 +177,15 @@ void FXRenderer::prepareOrdered() {
   systemDraws.resize(systems.size());
   orderedParticles.clear();
 
+  mgr.genQuads(orderedParticles, quadCounts, [](const ParticleSystem& system, int) { return system.orderedDraw; });
+  int first = 0;
   for (int n = 0; n < systems.size(); n++) {
-    auto& system = systems[n];
-    if (system.isDead || !system.orderedDraw)
-      continue;
-
-    auto& def = mgr[system.defId];
-    int first = (int)orderedParticles.size();
-    for (int ssid = 0; ssid < system.subSystems.size(); ssid++)
-      mgr.genQuads(orderedParticles, n, ssid);
-    int count = (int)orderedParticles.size() - first;
-
+    int count = quadCounts[n];
     if (count > 0) {
       auto rect = boundingBox(&orderedParticles[first], count);
       systemDraws[n] = {rect, IVec2(), first, count};
     }
+    first += count;
   }
 
   if (useFramebuffer) {
@@ -397,19 +391,9 @@ void FXRenderer::drawUnordered(Layer layer) {
   tempParticles.clear();
   drawBuffers->clear();
 
-  auto& systems = mgr.getSystems();
-  for (int n = 0; n < systems.size(); n++) {
-    if (systems[n].isDead)
-      continue;
-    auto& system = systems[n];
-    auto& ssdef = mgr[system.defId];
-    if (system.orderedDraw)
-      continue;
-
-    for (int ssid = 0; ssid < system.subSystems.size(); ssid++)
-      if (ssdef[ssid].layer == layer)
-        mgr.genQuads(tempParticles, n, ssid);
-  }
+  mgr.genQuads(tempParticles, quadCounts, [&](const ParticleSystem& system, int ssid) {
+    return !system.orderedDraw && mgr[system.defId][ssid].layer == layer;
+  });
 
   drawBuffers->add(tempParticles.data(), tempParticles.size());
   if (drawBuffers->empty())
@@ -62,6 +62,7 @@ public:
   struct SystemDrawInfo;
   vector<SystemDrawInfo> systemDraws;
   vector<DrawParticle> orderedParticles, tempParticles;
+  vector<int> quadCounts;
   vector<FRect> tempRects;
 
   void applyTexScale();
@@ -71,7 +71,6 @@ Game::Game(Table<PModel>&& m, Vec2 basePos, const CampaignSetup& c, ContentFacto
         control->updateAggression(c.enemyAggressionLevel);
         addCollective(col);
       }
-      m->updateSunlightMovement();
       for (auto c : m->getAllCreatures())
         c->setGlobalTime(getGlobalTime());
     }
@@ -371,7 +370,6 @@ void Game::tick(GlobalTime time) {
   if (previous != sunlightInfo.getState())
     for (Vec2 v : models.getBounds())
       if (WModel m = models[v].get()) {
-        m->updateSunlightMovement();
         if (playerControl)
           playerControl->onSunlightVisibilityChanged();
       }
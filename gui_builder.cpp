@@ -508,9 +508,13 @@ SGuiElem GuiBuilder::drawRightBandInfo(GameInfo& info) {
               return "LAT " + toString(fpsCounter.getMaxLatency()) + "ms / " + toString(upsCounter.getMaxLatency()) + "ms";
             case CounterMode::SMOD:
               return "SMOD " + toString(modifiedSquares) + "/" + toString(totalSquares);
+            case CounterMode::TILES: {
+              auto& stats = mapGui->getTileCacheStats();
+              return "TILES " + toString(stats.rebuilt) + "/" + toString(stats.rebuilt + stats.reused);
+            }
           }
         }, Color::WHITE),
-        gui.button([=]() { counterMode = (CounterMode) ( ((int) counterMode + 1) % 3); })), 120);
+        gui.button([=]() { counterMode = (CounterMode) ( ((int) counterMode + 1) % 4); })), 120);
     main = gui.margin(gui.leftMargin(10, bottomLine.buildHorizontalList()),
         std::move(main), 18, gui.BOTTOM);
     rightBandInfoCache = gui.margin(std::move(butGui), std::move(main), 55, gui.TOP);
@@ -236,7 +236,7 @@ class GuiBuilder {
   const char* getCurrentGameSpeedName() const;
 
   FpsCounter fpsCounter, upsCounter;
-  enum class CounterMode { FPS, LAT, SMOD };
+  enum class CounterMode { FPS, LAT, SMOD, TILES };
   CounterMode counterMode = CounterMode::FPS;
 
   SGuiElem getButtonLine(CollectiveInfo::Button, int num, CollectiveTab, const optional<TutorialInfo>&);
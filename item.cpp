@@ -84,13 +84,61 @@ ItemPredicate Item::isRangedWeaponPredicate() {
  return [](const Item* it) { return it->canEquip() && it->getEquipmentSlot() == EquipmentSlot::RANGED_WEAPON;};
 }
 
+using StackKey = std::tuple<const string&, const string&, const optional<string>&, bool, const EnumMap<AttrType, int>&,
+    int, int>;
+
+// Everything that getNameAndModifiers() prints.
+static StackKey getStackKey(const ItemAttributes& attr, const Fire& fire) {
+  static const string noPrefix;
+  return StackKey(*attr.name, attr.prefixes.empty() ? noPrefix : attr.prefixes.back(), attr.artifactName,
+      fire.isBurning(), attr.modifiers, int(attr.damageReduction * 100), attr.displayUses ? attr.uses : -1);
+}
+
+bool Item::canStackWith(const Item* other) const {
+  return getStackKey(*attributes, *fire) == getStackKey(*other->attributes, *other->fire);
+}
+
+size_t Item::getStackHash() const {
+  if (!stackHash) {
+    auto key = getStackKey(*attributes, *fire);
+    stackHash = combineHash(std::get<0>(key), std::get<1>(key), std::get<2>(key), std::get<3>(key), std::get<4>(key),
+        std::get<5>(key), std::get<6>(key));
+  }
+  return *stackHash;
+}
+
 vector<vector<Item*>> Item::stackItems(vector<Item*> items, function<string(const Item*)> suffix) {
-  map<string, vector<Item*>> stacks = groupBy<Item*, string>(items, [suffix](const Item* item) {
-        return item->getNameAndModifiers() + suffix(item);
-      });
+  PROFILE;
+  struct Stack {
+    string suffix;
+    vector<Item*> items;
+  };
+  vector<Stack> stacks;
+  unordered_map<size_t, vector<int>> stacksByHash;
+  for (auto item : items) {
+    string itemSuffix = suffix ? suffix(item) : string();
+    auto& candidates = stacksByHash[combineHash(item->getStackHash(), itemSuffix)];
+    bool found = false;
+    for (int index : candidates)
+      if (stacks[index].suffix == itemSuffix && stacks[index].items[0]->canStackWith(item)) {
+        stacks[index].items.push_back(item);
+        found = true;
+        break;
+      }
+    if (!found) {
+      candidates.push_back(stacks.size());
+      stacks.push_back(Stack{std::move(itemSuffix), {item}});
+    }
+  }
+  // Names are only built once per stack, to keep the alphabetical order.
+  vector<pair<string, int>> order;
+  for (int index : All(stacks))
+    order.push_back(make_pair(stacks[index].items[0]->getNameAndModifiers() + stacks[index].suffix, index));
+  std::stable_sort(order.begin(), order.end(),
+      [](const pair<string, int>& a, const pair<string, int>& b) { return a.first < b.first; });
   vector<vector<Item*>> ret;
-  for (auto& elem : stacks)
-    ret.push_back(elem.second);
+  for (auto& elem : order)
+    ret.push_back(std::move(stacks[elem.second].items));
   return ret;
 }
 
@@ -119,6 +167,7 @@ void Item::fireDamage(Position position) {
   string noBurningName = getTheName();
   fire->set();
   if (!burning && fire->isBurning()) {
+    stackHash = none;
     position.globalMessage(noBurningName + " catches fire");
     modViewObject().setModifier(ViewObject::Modifier::BURNING);
   }
@@ -139,6 +188,7 @@ void Item::tick(Position position) {
     modViewObject().setModifier(ViewObject::Modifier::BURNING);
     fire->tick();
     if (!fire->isBurning()) {
+      stackHash = none;
       position.globalMessage(getTheName() + " burns out");
       discarded = true;
     }
@@ -154,6 +204,7 @@ void Item::tick(Position position) {
 void Item::applyPrefix(const ItemPrefix& prefix) {
   modViewObject().setModifier(ViewObject::Modifier::AURA);
   ::applyPrefix(prefix, *attributes);
+  stackHash = none;
 }
 
 void Item::setTimeout(GlobalTime t) {
@@ -284,6 +335,7 @@ void Item::applySpecial(Creature* c) {
     c->getGame()->getStatistics().add(StatId::SCROLL_READ);
   if (attributes->effect)
     attributes->effect->apply(c->getPosition(), c);
+  stackHash = none;
   if (attributes->uses > -1 && --attributes->uses == 0) {
     discarded = true;
     if (attributes->usedUpMsg)
@@ -333,6 +385,7 @@ string Item::getNoSeeApplyMsg() const {
 
 void Item::setName(const string& n) {
   attributes->name = n;
+  stackHash = none;
 }
 
 Creature* Item::getShopkeeper(const Creature* owner) const {
@@ -420,6 +473,7 @@ const optional<string>& Item::getArtifactName() const {
 
 void Item::setArtifactName(const string& s) {
   attributes->artifactName = s;
+  stackHash = none;
 }
 
 string Item::getSuffix() const {
@@ -515,6 +569,7 @@ EquipmentSlot Item::getEquipmentSlot() const {
 
 void Item::addModifier(AttrType type, int value) {
   attributes->modifiers[type] += value;
+  stackHash = none;
 }
 
 int Item::getModifier(AttrType type) const {
@@ -113,8 +113,8 @@ class Item : public Renderable, public UniqueEntity<Item>, public OwnedObject<It
   static ItemPredicate namePredicate(const string& name);
   static ItemPredicate isRangedWeaponPredicate();
 
-  static vector<vector<Item*>> stackItems(vector<Item*>,
-      function<string(const Item*)> addSuffix = [](const Item*) { return ""; });
+  /** Groups items that have the same name and modifiers, and the same suffix if given. Stacks are sorted by name.*/
+  static vector<vector<Item*>> stackItems(vector<Item*>, function<string(const Item*)> addSuffix = nullptr);
 
   virtual optional<CorpseInfo> getCorpseInfo() const;
 
@@ -137,4 +137,8 @@ class Item : public Renderable, public UniqueEntity<Item>, public OwnedObject<It
   ItemClass SERIAL(classCache);
   string getSuffix() const;
   optional<GlobalTime> SERIAL(timeout);
+  bool canStackWith(const Item*) const;
+  size_t getStackHash() const;
+  // Must be reset whenever anything that is part of the item's name or modifiers changes.
+  mutable optional<size_t> stackHash;
 };
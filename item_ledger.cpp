@@ -0,0 +1,79 @@
+#include "stdafx.h"
+#include "item_ledger.h"
+
+void ItemLedger::setAreas(Position pos, bool territory, EnumSet<StorageId> storage) {
+  auto it = squares.find(pos);
+  if (it != squares.end()) {
+    add(pos, it->second, -1);
+    if (!territory && storage.isEmpty()) {
+      squares.erase(it);
+      squaresWithItems.erase(pos);
+      return;
+    }
+  } else {
+    if (!territory && storage.isEmpty())
+      return;
+    it = squares.insert(make_pair(pos, SquareInfo())).first;
+    recount(pos, it->second);
+  }
+  it->second.territory = territory;
+  it->second.storage = storage;
+  add(pos, it->second, 1);
+}
+
+void ItemLedger::onItemsChanged(Position pos) {
+  auto it = squares.find(pos);
+  if (it != squares.end()) {
+    add(pos, it->second, -1);
+    recount(pos, it->second);
+    add(pos, it->second, 1);
+  }
+}
+
+int ItemLedger::getTerritoryCount(ItemIndex index) const {
+  track(index);
+  return territoryCounts[index];
+}
+
+int ItemLedger::getStorageCount(StorageId storage, ItemIndex index) const {
+  track(index);
+  return storageCounts[storage][index];
+}
+
+void ItemLedger::track(ItemIndex index) const {
+  if (tracked.contains(index))
+    return;
+  tracked.insert(index);
+  for (auto& elem : squares) {
+    int& count = elem.second.counts[index];
+    count = elem.second.total > 0 ? elem.first.getItems(index).size() : 0;
+    if (elem.second.territory)
+      territoryCounts[index] += count;
+    for (auto storage : elem.second.storage)
+      storageCounts[storage][index] += count;
+  }
+}
+
+const PositionSet& ItemLedger::getSquaresWithItems() const {
+  return squaresWithItems;
+}
+
+void ItemLedger::add(Position pos, const SquareInfo& info, int sign) {
+  for (auto index : tracked) {
+    int count = sign * info.counts[index];
+    if (info.territory)
+      territoryCounts[index] += count;
+    for (auto storage : info.storage)
+      storageCounts[storage][index] += count;
+  }
+  if (sign > 0 && info.total > 0)
+    squaresWithItems.insert(pos);
+  else
+    squaresWithItems.erase(pos);
+}
+
+void ItemLedger::recount(Position pos, SquareInfo& info) {
+  info.total = pos.getItems().size();
+  for (auto index : tracked)
+    info.counts[index] = info.total > 0 ? pos.getItems(index).size() : 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "util.h"
+#include "position.h"
+#include "item_index.h"
+#include "storage_id.h"
+
+/** Counts the items lying in a collective's territory and storage. A square is recounted whenever items are added
+    to or removed from it, and joins or leaves the counts when it enters or leaves the territory or a storage, so
+    that the totals can be read without scanning any squares. Only the indexes that were ever queried are counted.*/
+class ItemLedger {
+  public:
+  /** Sets the areas that the square belongs to. Squares outside of all areas are forgotten.*/
+  void setAreas(Position, bool territory, EnumSet<StorageId> storage);
+  /** Must be called whenever items are added to or removed from the square.*/
+  void onItemsChanged(Position);
+
+  int getTerritoryCount(ItemIndex) const;
+  int getStorageCount(StorageId, ItemIndex) const;
+  /** Squares of any of the areas that hold some items.*/
+  const PositionSet& getSquaresWithItems() const;
+
+  private:
+  struct SquareInfo {
+    bool territory = false;
+    EnumSet<StorageId> storage;
+    EnumMap<ItemIndex, int> counts;
+    int total = 0;
+  };
+  void add(Position, const SquareInfo&, int sign);
+  void recount(Position, SquareInfo&);
+  void track(ItemIndex) const;
+  // Counting an index starts with its first query, which is why the counts are mutable.
+  mutable unordered_map<Position, SquareInfo, CustomHash<Position>> squares;
+  mutable EnumSet<ItemIndex> tracked;
+  mutable EnumMap<ItemIndex, int> territoryCounts;
+  mutable EnumMap<StorageId, EnumMap<ItemIndex, int>> storageCounts;
+  PositionSet squaresWithItems;
+};
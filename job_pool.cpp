@@ -0,0 +1,61 @@
+#include "stdafx.h"
+#include "job_pool.h"
+
+JobPool::JobPool(int numThreads) {
+  for (int n = 1; n < numThreads; n++)
+    threads.push_back(makeThread([this, n] { workerLoop(n); }));
+}
+
+JobPool::~JobPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+  }
+  startCond.notify_all();
+  for (auto& t : threads)
+    t.join();
+}
+
+int JobPool::getNumThreads() const {
+  return (int)threads.size() + 1;
+}
+
+void JobPool::run(int numJobs, const function<void(int, int)>& func) {
+  std::lock_guard<std::mutex> runLock(runMutex);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    batchFunc = &func;
+    batchSize = numJobs;
+    nextJob = 0;
+    numBusy = (int)threads.size();
+    ++batchId;
+  }
+  startCond.notify_all();
+  work(0);
+  std::unique_lock<std::mutex> lock(mutex);
+  finishCond.wait(lock, [this] { return numBusy == 0; });
+}
+
+void JobPool::work(int thread) {
+  for (int job = nextJob++; job < batchSize; job = nextJob++)
+    (*batchFunc)(job, thread);
+}
+
+void JobPool::workerLoop(int thread) {
+  int lastBatch = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      startCond.wait(lock, [&] { return done || batchId != lastBatch; });
+      if (done)
+        return;
+      lastBatch = batchId;
+    }
+    work(thread);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      --numBusy;
+    }
+    finishCond.notify_one();
+  }
+}
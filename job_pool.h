@@ -0,0 +1,31 @@
+#pragma once
+
+#include "util.h"
+
+// Worker threads, which process batches of jobs together with the calling thread.
+class JobPool {
+  public:
+  JobPool(int numThreads);
+  ~JobPool();
+
+  int getNumThreads() const;
+
+  // Calls func(job, thread) for every job in [0, numJobs) and returns when all of them are finished.
+  // Batches run from different threads are processed one after another.
+  void run(int numJobs, const function<void(int, int)>& func);
+
+  private:
+  void work(int thread);
+  void workerLoop(int thread);
+
+  vector<thread> threads;
+  std::mutex runMutex;
+  std::mutex mutex;
+  std::condition_variable startCond, finishCond;
+  const function<void(int, int)>* batchFunc = nullptr;
+  int batchSize = 0;
+  atomic<int> nextJob{0};
+  int numBusy = 0;
+  int batchId = 0;
+  bool done = false;
+};
@@ -47,7 +47,14 @@ void Level::serialize(Archive& ar, const unsigned int version) {
   ar(squares, landingSquares, tickingSquares, creatures, model, fieldOfView);
   ar(sunlight, bucketMap, lightAmount, unavailable);
   ar(levelId, noDiagonalPassing, lightCapAmount, creatureIds, memoryUpdates);
-  ar(furniture, tickingFurniture, covered, roofSupport, portals, furnitureEffects);
+  ar(furniture, tickingFurniture, covered, roofSupport, portals, furnitureEffects, lightSources, lightSourceUpdates);
+  if (Archive::is_loading::value) {
+    for (Vec2 v : lightSources.getBounds())
+      if (lightSources[v] != 0)
+        getFieldOfView(VisionId::NORMAL).setPinned(v, true);
+    for (Vec2 v : lightSourceUpdates)
+      needsLightSourceUpdate[v] = true;
+  }
   if (Archive::is_loading::value) // some code requires these Sectors to be always initialized
     getSectors({MovementTrait::WALK});
 }  
@@ -64,7 +71,7 @@ Level::Level(Private, SquareArray s, FurnitureArray f, WModel m, Table<double> s
       sunlight(sun), roofSupport(squares->getBounds()),
       bucketMap(squares->getBounds().width(), squares->getBounds().height(),
       FieldOfView::sightRange), lightAmount(squares->getBounds(), 0), lightCapAmount(squares->getBounds(), 1),
-      levelId(id), portals(squares->getBounds()) {
+      lightSources(squares->getBounds(), 0), levelId(id), portals(squares->getBounds()) {
 }
 
 PLevel Level::create(SquareArray s, FurnitureArray f, WModel m,
@@ -138,32 +145,59 @@ void Level::removeLightSource(Vec2 pos, double radius) {
   addLightSource(pos, radius, -1);
 }
 
+// Light added by a source at each offset, or a negative value if it's out of the source's radius.
+const Table<double>& Level::getLightFalloff(double radius) {
+  auto it = lightFalloff.find(radius);
+  if (it == lightFalloff.end()) {
+    Table<double> falloff(Rectangle::centered(FieldOfView::sightRange), -1);
+    for (Vec2 v : falloff.getBounds()) {
+      double dist = v.lengthD();
+      if (dist <= radius)
+        falloff[v] = min(1.0, 1 - (dist) / radius);
+    }
+    it = lightFalloff.insert(make_pair(radius, std::move(falloff))).first;
+  }
+  return it->second;
+}
+
 void Level::addLightSource(Vec2 pos, double radius, int numLight) {
   PROFILE;
-  if (radius > 0) {
+  // A pending source will be added back with its current light anyway.
+  if (radius > 0 && !needsLightSourceUpdate[pos]) {
+    auto& falloff = getLightFalloff(radius);
     for (Vec2 v : getVisibleTilesNoDarkness(pos, VisionId::NORMAL)) {
-      double dist = (v - pos).lengthD();
-      if (dist <= radius) {
-        lightAmount[v] += min(1.0, 1 - (dist) / radius) * numLight;
+      double value = falloff[v - pos];
+      if (value >= 0) {
+        lightAmount[v] += value * numLight;
         setNeedsRenderUpdate(v, true);
       }
     }
+    updateLightSourceCount(pos, numLight);
   }
 }
 
 void Level::addDarknessSource(Vec2 pos, double radius, int numDarkness) {
-  if (radius > 0) {
+  if (radius > 0 && !needsLightSourceUpdate[pos]) {
+    auto& falloff = getLightFalloff(radius);
     for (Vec2 v : getVisibleTilesNoDarkness(pos, VisionId::NORMAL)) {
-      double dist = (v - pos).lengthD();
-      if (dist <= radius) {
-        lightCapAmount[v] -= min(1.0, 1 - (dist) / radius) * numDarkness;
+      double value = falloff[v - pos];
+      if (value >= 0) {
+        lightCapAmount[v] -= value * numDarkness;
         setNeedsRenderUpdate(v, true);
       }
 //      updateConnectivity(v);
     }
+    updateLightSourceCount(pos, numDarkness);
   }
 }
 
+void Level::updateLightSourceCount(Vec2 pos, int diff) {
+  bool wasSource = lightSources[pos] != 0;
+  lightSources[pos] += diff;
+  if (wasSource != (lightSources[pos] != 0))
+    getFieldOfView(VisionId::NORMAL).setPinned(pos, !wasSource);
+}
+
 void Level::updateCreatureLight(Vec2 pos, int diff) {
   auto square = squares->getReadonly(pos);
   CHECK(square) << pos << " " << getBounds();
@@ -177,18 +211,33 @@ void Level::updateCreatureLight(Vec2 pos, int diff) {
 
 void Level::updateVisibility(Vec2 changedSquare) {
   auto allVisible = getVisibleTilesNoDarkness(changedSquare, VisionId::NORMAL);
-  for (Vec2 pos : allVisible) {
-    addLightSource(pos, Position(pos, this).getLightEmission(), -1);
-    updateCreatureLight(pos, -1);
-  }
+  auto& fieldOfView = getFieldOfView(VisionId::NORMAL);
+  for (Vec2 pos : Rectangle::centered(changedSquare, FieldOfView::sightRange).intersection(getBounds()))
+    if (lightSources[pos] != 0 && !needsLightSourceUpdate[pos] && fieldOfView.dependsOn(pos, changedSquare)) {
+      addLightSource(pos, Position(pos, this).getLightEmission(), -1);
+      updateCreatureLight(pos, -1);
+      needsLightSourceUpdate[pos] = true;
+      lightSourceUpdates.push_back(pos);
+    }
   for (VisionId vision : ENUM_ALL(VisionId))
     getFieldOfView(vision).squareChanged(changedSquare);
-  for (Vec2 pos : allVisible) {
+  for (Vec2 pos : allVisible)
+    getModel()->addEvent(EventInfo::VisibilityChanged{Position(pos, this)});
+}
+
+// The sources are added back once per tick, so that digging many tiles in a turn updates each of them only once.
+void Level::updateLightSources() {
+  if (lightSourceUpdates.empty())
+    return;
+  PROFILE;
+  auto sources = std::move(lightSourceUpdates);
+  lightSourceUpdates.clear();
+  for (Vec2 pos : sources)
+    needsLightSourceUpdate[pos] = false;
+  for (Vec2 pos : sources) {
     addLightSource(pos, Position(pos, this).getLightEmission(), 1);
     updateCreatureLight(pos, 1);
   }
-  for (Vec2 pos : allVisible)
-    getModel()->addEvent(EventInfo::VisibilityChanged{Position(pos, this)});
 }
 
 vector<Creature*> Level::getPlayers() const {
@@ -408,6 +457,18 @@ bool Level::canSee(Vec2 from, Vec2 to, const Vision& vision) const {
   return isWithinVision(from, to, vision) && getFieldOfView(vision.getId()).canSee(from, to);
 }
 
+vector<int> Level::getVisible(Vec2 from, const vector<Creature*>& creatures, const Vision& vision) const {
+  PROFILE;
+  vector<int> ret;
+  auto& fieldOfView = getFieldOfView(vision.getId());
+  for (int i : All(creatures)) {
+    Vec2 to = creatures[i]->getPosition().getCoord();
+    if (isWithinVision(from, to, vision) && fieldOfView.canSee(from, to))
+      ret.push_back(i);
+  }
+  return ret;
+}
+
 void Level::moveCreature(Creature* creature, Vec2 direction) {
   Vec2 position = creature->getPosition().getCoord();
   unplaceCreature(creature, position);
@@ -459,7 +520,7 @@ void Level::swapCreatures(Creature* c1, Creature* c2) {
   placeCreature(c2, pos1);
 }
 
-const vector<Vec2>& Level::getVisibleTilesNoDarkness(Vec2 pos, VisionId vision) const {
+vector<Vec2> Level::getVisibleTilesNoDarkness(Vec2 pos, VisionId vision) const {
   PROFILE;
   return getFieldOfView(vision).getVisibleTiles(pos);
 }
@@ -469,6 +530,16 @@ vector<Vec2> Level::getVisibleTiles(Vec2 pos, const Vision& vision) const {
       [&](Vec2 v) { return isWithinVision(pos, v, vision); });
 }
 
+void Level::prefetchFieldsOfView(const vector<Creature*>& creatures, JobPool& jobPool) const {
+  PROFILE;
+  EnumMap<VisionId, vector<Vec2>> origins;
+  for (auto c : creatures)
+    origins[c->getVision().getId()].push_back(c->getPosition().getCoord());
+  for (auto vision : ENUM_ALL(VisionId))
+    if (!origins[vision].empty())
+      getFieldOfView(vision).prefetch(origins[vision], jobPool);
+}
+
 WConstSquare Level::getSafeSquare(Vec2 pos) const {
   CHECK(inBounds(pos)) << pos << " " << getBounds();
   return squares->getReadonly(pos);
@@ -496,6 +567,7 @@ void Level::addTickingFurniture(Vec2 pos) {
 
 void Level::tick() {
   PROFILE_BLOCK("Level::tick");
+  updateLightSources();
   for (Vec2 pos : tickingSquares)
     squares->getWritable(pos)->tick(Position(pos, this));
   for (Vec2 pos : tickingFurniture)
@@ -539,14 +611,41 @@ Sectors& Level::getSectors(const MovementType& movement) const {
   }
 }
 
+ClusterGraph& Level::getClusterGraph(const MovementType& movement) const {
+  if (auto res = getReferenceMaybe(clusterGraphs, movement))
+    return *res;
+  else {
+    clusterGraphs.insert(make_pair(movement, ClusterGraph(getBounds())));
+    return clusterGraphs.at(movement);
+  }
+}
+
+FlowFieldCache& Level::getFlowFieldCache() const {
+  return flowFields;
+}
+
 bool Level::isChokePoint(Vec2 pos, const MovementType& movement) const {
   return getSectors(movement).isChokePoint(pos);
 }
 
-void Level::updateSunlightMovement() {
-  for (auto movement : getKeys(sectors))
-    if (movement.isSunlightVulnerable())
-      sectors.erase(movement);
+// Only movement that avoids sunlight depends on whether a tile is covered, so the other sectors don't need updating.
+void Level::updateRoofConnectivity(const vector<Vec2>& positions) {
+  PROFILE;
+  if (positions.empty())
+    return;
+  for (auto& elem : sectors)
+    if (elem.first.isSunlightVulnerable()) {
+      auto graph = getReferenceMaybe(clusterGraphs, elem.first);
+      bool changed = false;
+      for (Vec2 v : positions)
+        if (Position(v, this).canNavigateCalc(elem.first) ? elem.second.add(v) : elem.second.remove(v)) {
+          changed = true;
+          if (graph)
+            graph->invalidate(v);
+        }
+      if (changed)
+        flowFields.invalidate(elem.first);
+    }
 }
 
 int Level::getNumGeneratedSquares() const {
@@ -20,6 +20,8 @@
 #include "unique_entity.h"
 #include "movement_type.h"
 #include "sectors.h"
+#include "cluster_graph.h"
+#include "flow_field_cache.h"
 #include "stair_key.h"
 #include "entity_set.h"
 #include "vision_id.h"
@@ -35,6 +37,7 @@ class Sectors;
 class Tribe;
 class Attack;
 class PlayerMessage;
+class JobPool;
 class CreatureBucketMap;
 class Position;
 class Game;
@@ -135,9 +138,17 @@ class Level : public OwnedObject<Level> {
   /** Returns if it's possible to see the given square.*/
   bool canSee(Vec2 from, Vec2 to, const Vision&) const;
 
+  /** Same as canSee for the positions of all the creatures, which must be on this level.
+      Returns the indexes of the creatures that can be seen, in increasing order.*/
+  vector<int> getVisible(Vec2 from, const vector<Creature*>&, const Vision&) const;
+
   /** Returns all tiles visible by a creature.*/
   vector<Vec2> getVisibleTiles(Vec2 pos, const Vision&) const;
 
+  /** Computes the fields of view of the creatures, which must be on this level, on the threads of the pool,
+      so that their next queries don't have to.*/
+  void prefetchFieldsOfView(const vector<Creature*>&, JobPool&) const;
+
   /** Returns the player creature.*/
   vector<Creature*> getPlayers() const;
 
@@ -147,7 +158,8 @@ class Level : public OwnedObject<Level> {
   void addLightSource(Vec2, double radius);
   void removeLightSource(Vec2, double radius);
 
-  /** Returns the amount of light in the square, capped within (0, 1).*/
+  /** Returns the amount of light in the square, capped within (0, 1). Light sources next to squares that
+      changed since the last tick are left out until the next tick.*/
   double getLight(Vec2) const;
 
   /** Returns whether the square is in direct sunlight.*/
@@ -155,8 +167,6 @@ class Level : public OwnedObject<Level> {
 
   bool isChokePoint(Vec2, const MovementType&) const;
 
-  void updateSunlightMovement();
-
   int getNumGeneratedSquares() const;
   int getNumTotalSquares() const;
   bool isUnavailable(Vec2) const;
@@ -170,6 +180,8 @@ class Level : public OwnedObject<Level> {
   void setFurniture(Vec2, PFurniture);
 
   Sectors& getSectors(const MovementType&) const;
+  ClusterGraph& getClusterGraph(const MovementType&) const;
+  FlowFieldCache& getFlowFieldCache() const;
   struct EffectSet {
     vector<LastingEffect> SERIAL(friendly);
     vector<LastingEffect> SERIAL(hostile);
@@ -181,6 +193,7 @@ class Level : public OwnedObject<Level> {
 
   private:
   friend class Position;
+  void updateRoofConnectivity(const vector<Vec2>&);
   WConstSquare getSafeSquare(Vec2) const;
   WSquare modSafeSquare(Vec2);
   HeapAllocated<SquareArray> SERIAL(squares);
@@ -204,9 +217,18 @@ class Level : public OwnedObject<Level> {
   HeapAllocated<CreatureBucketMap> SERIAL(bucketMap);
   Table<double> SERIAL(lightAmount);
   Table<double> SERIAL(lightCapAmount);
+  // Number of light and darkness sources added at every tile. Their fields of view are pinned in the cache and
+  // refreshed before a changed square can alter them, so that removing a source subtracts the tiles it added.
+  Table<int> SERIAL(lightSources);
+  // Light sources whose contribution was taken out by updateVisibility, to be added back in the next tick.
+  vector<Vec2> SERIAL(lightSourceUpdates);
+  Table<bool> needsLightSourceUpdate = Table<bool>(getMaxBounds(), false);
+  unordered_map<double, Table<double>> lightFalloff;
   EnumMap<TribeId::KeyType, unique_ptr<EffectsTable>> SERIAL(furnitureEffects);
   mutable unordered_map<MovementType, Sectors, CustomHash<MovementType>> sectors;
   Sectors& getSectorsDontCreate(const MovementType&) const;
+  mutable unordered_map<MovementType, ClusterGraph, CustomHash<MovementType>> clusterGraphs;
+  mutable FlowFieldCache flowFields;
 
   friend class LevelBuilder;
   struct Private {};
@@ -220,8 +242,11 @@ class Level : public OwnedObject<Level> {
   private:
   void addLightSource(Vec2 pos, double radius, int numLight);
   void addDarknessSource(Vec2 pos, double radius, int numLight);
+  void updateLightSourceCount(Vec2 pos, int diff);
+  const Table<double>& getLightFalloff(double radius);
+  void updateLightSources();
   FieldOfView& getFieldOfView(VisionId vision) const;
-  const vector<Vec2>& getVisibleTilesNoDarkness(Vec2 pos, VisionId vision) const;
+  vector<Vec2> getVisibleTilesNoDarkness(Vec2 pos, VisionId vision) const;
   bool isWithinVision(Vec2 from, Vec2 to, const Vision&) const;
   LevelId SERIAL(levelId) = 0;
   bool SERIAL(noDiagonalPassing) = false;
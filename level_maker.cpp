@@ -414,9 +414,8 @@ class Connector : public LevelMaker {
     Table<bool> connected(area, false);
     while (1) {
       Dijkstra dijkstra(area, {p1}, 10000, dijkstraFun);
-      for (Vec2 v : area)
-        if (dijkstra.isReachable(v))
-          connected[v] = true;
+      for (auto& elem : dijkstra.getAllReachable())
+        connected[elem.first] = true;
       bool found = false;
       for (Vec2 v : area)
         if (connectPred.apply(builder, v) && !connected[v]) {
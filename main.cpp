@@ -37,9 +37,11 @@
 #include "clock.h"
 #include "skill.h"
 #include "parse_game.h"
+#include "gzstream.h"
 #include "version.h"
 #include "vision.h"
 #include "model_builder.h"
+#include "model.h"
 #include "sound_library.h"
 #include "audio_device.h"
 #include "sokoban_input.h"
@@ -198,7 +200,9 @@ static po::parser getCommandLineFlags() {
   flags["help"].description("Print help");
   flags["steam"].description("Run with Steam");
   flags["no_minidump"].description("Don't write minidumps when crashed.");
+  flags["rebuild_content_cache"].description("Parse the game data even if the content cache is up to date.");
   flags["single_thread"].description("Do operations like loading, saving and level generation without starting an extra thread.");
+  flags["move_threads"].type(po::i32).description("Number of threads computing the creatures' fields of view ahead of their moves");
   flags["user_dir"].type(po::string).description("Directory for options and save files");
   flags["data_dir"].type(po::string).description("Directory containing the game data");
   flags["restore_settings"].description("Restore settings to default values.");
@@ -299,6 +303,9 @@ static int keeperMain(po::parser& commandLineFlags) {
 #else
       commandLineFlags["single_thread"].was_set();
 #endif
+  bool rebuildContentCache = commandLineFlags["rebuild_content_cache"].was_set();
+  if (commandLineFlags["move_threads"].was_set())
+    Model::setNumMoveThreads(commandLineFlags["move_threads"].get().i32);
   FatalLog.addOutput(DebugOutput::crash());
   FatalLog.addOutput(DebugOutput::toStream(std::cerr));
   UserErrorLog.addOutput(DebugOutput::exitProgram());
@@ -382,7 +389,7 @@ static int keeperMain(po::parser& commandLineFlags) {
   jukebox.setCurrentVolume(options.getIntValue(OptionId::MUSIC));
   if (commandLineFlags["verify_mod"].was_set()) {
     MainLoop loop(nullptr, nullptr, nullptr, freeDataPath, userPath, &options, &jukebox, nullptr, nullptr,
-        useSingleThread, 0);
+        useSingleThread, rebuildContentCache, 0);
     if (auto err = loop.verifyMod(commandLineFlags["verify_mod"].get().string)) {
       std::cout << *err << std::endl;
       return -1;
@@ -404,7 +411,7 @@ static int keeperMain(po::parser& commandLineFlags) {
   Highscores highscores(userPath.file("highscores.dat"), fileSharing, &options);
   if (commandLineFlags["worldgen_test"].was_set()) {
     MainLoop loop(nullptr, &highscores, &fileSharing, freeDataPath, userPath, &options, &jukebox, &sokobanInput, nullptr,
-        useSingleThread, 0);
+        useSingleThread, rebuildContentCache, 0);
     vector<string> types;
     if (commandLineFlags["worldgen_maps"].was_set())
       types = split(commandLineFlags["worldgen_maps"].get().string, {','});
@@ -413,20 +420,23 @@ static int keeperMain(po::parser& commandLineFlags) {
   }
   auto battleTest = [&] (View* view, TileSet* tileSet) {
     MainLoop loop(view, &highscores, &fileSharing, freeDataPath, userPath, &options, &jukebox, &sokobanInput, tileSet,
-        useSingleThread, 0);
+        useSingleThread, rebuildContentCache, 0);
     auto level = commandLineFlags["battle_level"].get().string;
     auto info = commandLineFlags["battle_info"].get().string;
     auto numRounds = commandLineFlags["battle_rounds"].get().i32;
+    bool headless = !commandLineFlags["battle_view"].was_set();
     try {
       if (commandLineFlags["endless_enemy"].was_set()) {
         auto enemy = commandLineFlags["endless_enemy"].get().string;
         optional<int> chosenEnemy;
         if (enemy != "all")
           chosenEnemy = fromString<int>(enemy);
-        loop.endlessTest(numRounds, FilePath::fromFullPath(level), FilePath::fromFullPath(info), Random, chosenEnemy);
+        loop.endlessTest(numRounds, FilePath::fromFullPath(level), FilePath::fromFullPath(info), headless, Random,
+            chosenEnemy);
       } else {
         auto enemyId = commandLineFlags["battle_enemy"].get().string;
-        loop.battleTest(numRounds, FilePath::fromFullPath(level), FilePath::fromFullPath(info), enemyId, Random);
+        loop.battleTest(numRounds, FilePath::fromFullPath(level), FilePath::fromFullPath(info), enemyId, headless,
+            Random);
       }
     } catch (GameExitException) {}
   };
@@ -479,6 +489,8 @@ static int keeperMain(po::parser& commandLineFlags) {
     if (particlesPath.exists()) {
       INFO << "FX: initialization";
       fxManager = unique<fx::FXManager>();
+      if (!useSingleThread)
+        fxManager->setNumThreads(min<int>(4, thread::hardware_concurrency()));
       fxRenderer = unique<fx::FXRenderer>(particlesPath, *fxManager);
       fxRenderer->loadTextures();
       fxViewManager = unique<FXViewManager>(fxManager.get(), fxRenderer.get());
@@ -490,7 +502,7 @@ static int keeperMain(po::parser& commandLineFlags) {
     return 0;
   }
   MainLoop loop(view.get(), &highscores, &fileSharing, freeDataPath, userPath, &options, &jukebox, &sokobanInput, &tileSet,
-      useSingleThread, appConfig.get<int>("save_version"));
+      useSingleThread, rebuildContentCache, appConfig.get<int>("save_version"));
   try {
     if (audioError)
       view->presentText("Failed to initialize audio. The game will be started without sound.", *audioError);
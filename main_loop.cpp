@@ -41,6 +41,7 @@
 #include "scroll_position.h"
 #include "miniunz.h"
 #include "external_enemies_type.h"
+#include "dummy_view.h"
 
 #ifdef USE_STEAMWORKS
 #include "steam_ugc.h"
@@ -48,9 +49,14 @@
 #endif
 
 MainLoop::MainLoop(View* v, Highscores* h, FileSharing* fSharing, const DirectoryPath& freePath,
-    const DirectoryPath& uPath, Options* o, Jukebox* j, SokobanInput* soko, TileSet* tileSet, bool singleThread, int sv)
+    const DirectoryPath& uPath, Options* o, Jukebox* j, SokobanInput* soko, TileSet* tileSet, bool singleThread, bool rebuildCache,
+    int sv)
       : view(v), dataFreePath(freePath), userPath(uPath), options(o), jukebox(j), highscores(h), fileSharing(fSharing),
-        useSingleThread(singleThread), sokobanInput(soko), tileSet(tileSet), saveVersion(sv) {
+        useSingleThread(singleThread), rebuildContentCache(rebuildCache), sokobanInput(soko), tileSet(tileSet), saveVersion(sv) {
+}
+
+MainLoop::~MainLoop() {
+  waitForAutosave();
 }
 
 vector<SaveFileInfo> MainLoop::getSaveFiles(const DirectoryPath& path, const string& suffix) {
@@ -118,13 +124,57 @@ static string stripFilename(string s) {
   return s;
 }
 
-void MainLoop::saveGame(PGame& game, const FilePath& path) {
-  CompressedOutput out(path.getPath());
+void MainLoop::saveGame(PGame& game, ostream& stream) {
+  OutputArchive archive(stream);
   string name = game->getGameDisplayName();
   SavedGameInfo savedInfo = game->getSavedGameInfo();
   savedInfo.spriteMods = tileSet->getSpriteMods();
-  out.getArchive() << saveVersion << name << savedInfo;
-  out.getArchive() << game;
+  archive << saveVersion << name << savedInfo;
+  archive << game;
+}
+
+void MainLoop::saveGame(PGame& game, const FilePath& path) {
+  CompressedOutputStream stream(path.getPath());
+  saveGame(game, stream);
+}
+
+static bool writeCompressed(const string& path, std::streambuf* data) {
+  CompressedOutputStream stream(path.c_str());
+  return !!(stream << data).flush();
+}
+
+void MainLoop::autosave(PGame& game) {
+  if (useSingleThread) {
+    saveUI(game, GameSaveType::AUTOSAVE, SplashType::AUTOSAVING);
+    return;
+  }
+  auto path = getSavePath(game, GameSaveType::AUTOSAVE);
+  // Only serializing the game into memory blocks the game loop. Compression and writing happen on a background
+  // thread into a temporary file, which replaces the previous autosave once it's complete.
+  auto snapshot = make_shared<ostringstream>();
+  doWithSplash(SplashType::AUTOSAVING, "Autosaving", game->getSaveProgressCount(),
+      [&] (ProgressMeter& meter) {
+      Square::progressMeter = &meter;
+      MEASURE(saveGame(game, *snapshot), "autosave snapshot time")});
+  Square::progressMeter = nullptr;
+  // A previous autosave that is still being written must finish first, so that the files are replaced in order.
+  waitForAutosave();
+  // The thread doesn't log, because the log isn't thread safe. A failure is reported by the game loop.
+  autosaveThread = makeThread([this, snapshot, path] {
+    string tmpPath = path.getPath() + ".tmp"_s;
+    if (writeCompressed(tmpPath, snapshot->rdbuf())) {
+      remove(path.getPath());
+      rename(tmpPath.c_str(), path.getPath());
+    } else {
+      remove(tmpPath.c_str());
+      autosaveFailed = true;
+    }
+  });
+}
+
+void MainLoop::waitForAutosave() {
+  if (autosaveThread.joinable())
+    autosaveThread.join();
 }
 
 struct RetiredModelInfo {
@@ -173,6 +223,7 @@ FilePath MainLoop::getSavePath(const PGame& game, GameSaveType gameType) {
 }
 
 void MainLoop::saveUI(PGame& game, GameSaveType type, SplashType splashType) {
+  waitForAutosave();
   auto path = getSavePath(game, type);
   if (type == GameSaveType::RETIRED_SITE) {
     int saveTime = game->getMainModel()->getSaveProgressCount();
@@ -193,6 +244,8 @@ void MainLoop::saveUI(PGame& game, GameSaveType type, SplashType splashType) {
 }
 
 void MainLoop::eraseSaveFile(const PGame& game, GameSaveType type) {
+  if (type == GameSaveType::AUTOSAVE)
+    waitForAutosave();
   remove(getSavePath(game, type).getPath());
 }
 
@@ -237,6 +290,7 @@ enum class MainLoop::ExitCondition {
 };
 
 void MainLoop::bugReportSave(PGame& game, FilePath path) {
+  waitForAutosave();
   int saveTime = game->getSaveProgressCount();
   doWithSplash(SplashType::AUTOSAVING, "Saving game...", saveTime,
       [&] (ProgressMeter& meter) {
@@ -250,6 +304,7 @@ MainLoop::ExitCondition MainLoop::playGame(PGame game, bool withMusic, bool noAu
   if (!splashScreen)
     registerModPlaytime(true);
   OnExit on_exit([&]() {
+    waitForAutosave();
     if (!splashScreen)
       registerModPlaytime(false);
   });
@@ -318,11 +373,13 @@ MainLoop::ExitCondition MainLoop::playGame(PGame game, bool withMusic, bool noAu
     }
     if (lastAutoSave < gameTime - getAutosaveFreq() && !noAutoSave) {
       if (options->getBoolValue(OptionId::AUTOSAVE)) {
-        saveUI(game, GameSaveType::AUTOSAVE, SplashType::AUTOSAVING);
+        autosave(game);
         eraseAllSavesExcept(game, GameSaveType::AUTOSAVE);
       }
       lastAutoSave = gameTime;
     }
+    if (autosaveFailed.exchange(false))
+      view->presentText("", "Failed to write the autosave. Please check that there is enough free disk space.");
     view->refreshView();
   }
 }
@@ -610,11 +667,116 @@ void MainLoop::considerFreeVersionText(bool tilesPresent) {
         "More information on the website.");
 }
 
+static string serializeContent(ContentFactory& factory) {
+  ostringstream stream;
+  {
+    OutputArchive archive(stream);
+    archive << factory;
+  }
+  return stream.str();
+}
+
+static ContentFactory deserializeContent(const string& data) {
+  istringstream stream(data);
+  InputArchive archive(stream);
+  ContentFactory ret;
+  archive >> ret;
+  return ret;
+}
+
+// Increase when the layout of the content cache file changes.
+static const int contentCacheVersion = 1;
+
+static void addToHash(uint64_t& hash, const string& data) {
+  // FNV-1a, including the terminating zero so that consecutive strings can't be confused.
+  for (int i = 0; i <= data.size(); ++i) {
+    hash ^= (unsigned char) data.c_str()[i];
+    hash *= 1099511628211ull;
+  }
+}
+
+static uint64_t getContentHash(const string& modName, int saveVersion, const vector<DirectoryPath>& inputDirs) {
+  uint64_t hash = 14695981039346656037ull;
+  addToHash(hash, toString(contentCacheVersion) + " " + toString(saveVersion) + " " + modName);
+  for (auto& dir : inputDirs) {
+    auto files = dir.getFiles();
+    sort(files.begin(), files.end(), [](const FilePath& f1, const FilePath& f2) {
+        return strcmp(f1.getFileName(), f2.getFileName()) < 0; });
+    for (auto& file : files) {
+      ifstream input(file.getPath(), std::ios::binary);
+      stringstream contents;
+      contents << input.rdbuf();
+      addToHash(hash, file.getFileName());
+      addToHash(hash, contents.str());
+    }
+  }
+  return hash;
+}
+
+static optional<ContentFactory> loadContentCache(const FilePath& path, uint64_t hash) {
+  try {
+    ifstream input(path.getPath(), std::ios::binary);
+    if (!input)
+      return none;
+    InputArchive archive(input);
+    uint64_t cachedHash = 0;
+    archive >> cachedHash;
+    if (cachedHash != hash)
+      return none;
+    ContentFactory ret;
+    archive >> ret;
+    return std::move(ret);
+  } catch (std::exception& ex) {
+    INFO << "Failed to load content cache " << path << ": " << ex.what();
+    return none;
+  }
+}
+
+// The cache is written to a temporary file first, so that a failed write never leaves a truncated cache behind.
+static void saveContentCache(const FilePath& path, uint64_t hash, ContentFactory& factory) {
+  string tmpPath = path.getPath() + ".tmp"_s;
+  bool success = false;
+  try {
+    ofstream output(tmpPath, std::ios::binary);
+    if (output) {
+      {
+        OutputArchive archive(output);
+        archive << hash << factory;
+      }
+      success = !!output.flush();
+    }
+  } catch (std::exception& ex) {
+    INFO << "Failed to save content cache " << path << ": " << ex.what();
+  }
+  if (success) {
+    remove(path.getPath());
+    rename(tmpPath.c_str(), path.getPath());
+  } else {
+    INFO << "Failed to write content cache to " << tmpPath;
+    remove(tmpPath.c_str());
+  }
+}
+
 ContentFactory MainLoop::createContentFactory(bool vanillaOnly) const {
   ContentFactory ret;
-  auto tryConfig = [this, &ret](const string& modName) {
+  auto tryConfig = [this, &ret](const string& modName) -> optional<string> {
+    auto startTime = Clock::getRealMillis();
     GameConfig config(dataFreePath.subdirectory(gameConfigSubdir), modName);
-    return ret.readData(NameGenerator(dataFreePath.subdirectory("names")), &config);
+    auto namesPath = dataFreePath.subdirectory("names");
+    // The parsed content is cached in binary form, keyed by the contents of all files it's read from.
+    auto cachePath = userPath.file("content_cache_" + stripFilename(modName) + ".dat");
+    auto hash = getContentHash(modName, saveVersion, {config.getPath(), namesPath});
+    if (!rebuildContentCache)
+      if (auto cached = loadContentCache(cachePath, hash)) {
+        ret = std::move(*cached);
+        INFO << "Loaded \"" << modName << "\" content from cache in " << Clock::getRealMillis() - startTime;
+        return none;
+      }
+    if (auto err = ret.readData(NameGenerator(namesPath), &config))
+      return err;
+    INFO << "Parsed \"" << modName << "\" content in " << Clock::getRealMillis() - startTime;
+    saveContentCache(cachePath, hash, ret);
+    return none;
   };
   if (vanillaOnly) {
 #ifdef RELEASE
@@ -636,6 +798,7 @@ ContentFactory MainLoop::createContentFactory(bool vanillaOnly) const {
         USER_FATAL << "Error loading vanilla game data: " << *err;
     }
   }
+  freezeContentIds();
   return ret;
 }
 
@@ -758,7 +921,7 @@ static CreatureList readAlly(ifstream& input) {
 }
 
 void MainLoop::battleTest(int numTries, const FilePath& levelPath, const FilePath& battleInfoPath, string enemy,
-    RandomGen& random) {
+    bool headless, RandomGen& random) {
   ifstream input(battleInfoPath.getPath());
   CreatureList enemies;
   for (auto& elem : split(enemy, {','})) {
@@ -771,14 +934,15 @@ void MainLoop::battleTest(int numTries, const FilePath& levelPath, const FilePat
   int cnt = 0;
   input >> cnt;
   auto contentFactory = createContentFactory(false);
+  auto content = serializeContent(contentFactory);
   for (int i : Range(cnt)) {
     auto allies = readAlly(input);
-    std::cout << allies.getSummary(&contentFactory.getCreatures()) << ": ";
-    battleTest(numTries, levelPath, allies, enemies, random);
+    battleTest(numTries, levelPath, allies, enemies, content, allies.getSummary(&contentFactory.getCreatures()),
+        headless, random);
   }
 }
 
-void MainLoop::endlessTest(int numTries, const FilePath& levelPath, const FilePath& battleInfoPath,
+void MainLoop::endlessTest(int numTries, const FilePath& levelPath, const FilePath& battleInfoPath, bool headless,
     RandomGen& random, optional<int> numEnemy) {
   ifstream input(battleInfoPath.getPath());
   int cnt = 0;
@@ -787,6 +951,7 @@ void MainLoop::endlessTest(int numTries, const FilePath& levelPath, const FilePa
   for (int i : Range(cnt))
     allies.push_back(readAlly(input));
   auto contentFactory = createContentFactory(false);
+  auto content = serializeContent(contentFactory);
   ExternalEnemies enemies(random, &contentFactory.getCreatures(), EnemyFactory(random, contentFactory.getCreatures().getNameGenerator(),
       contentFactory.enemies, contentFactory.externalEnemies)
       .getExternalEnemies(), ExternalEnemiesType::FROM_START);
@@ -795,12 +960,14 @@ void MainLoop::endlessTest(int numTries, const FilePath& levelPath, const FilePa
       std::cerr << "Turn " << turn << ": " << wave->enemy.name << "\n";
       int totalWins = 0;
       for (auto& allyInfo : allies) {
-        std::cerr << allyInfo.getSummary(&contentFactory.getCreatures()) << ": ";
-        int numWins = battleTest(numTries, levelPath, allyInfo, wave->enemy.creatures, random);
+        auto label = "Turn " + toString(turn) + ": " + wave->enemy.name + ": " +
+            allyInfo.getSummary(&contentFactory.getCreatures());
+        int numWins = battleTest(numTries, levelPath, allyInfo, wave->enemy.creatures, content, label, headless,
+            random);
         totalWins += numWins;
       }
       std::cerr << totalWins << " wins\n";
-      std::cout << "Turn " << turn << ": " << wave->enemy.name << ": " << totalWins << "\n";
+      std::cout << "wave\t" << turn << "\t" << wave->enemy.name << "\t" << totalWins << std::endl;
     }
 }
 
@@ -823,65 +990,142 @@ optional<string> MainLoop::verifyMod(const string& path) {
   return "Failed to load any mod"_s;
 }
 
-int MainLoop::battleTest(int numTries, const FilePath& levelPath, CreatureList ally, CreatureList enemies,
-    RandomGen& random) {
+struct MainLoop::BattleResult {
+  ExitCondition result;
+  int turns;
+  milliseconds wallTime;
+};
+
+MainLoop::BattleResult MainLoop::playBattle(const FilePath& levelPath, const CreatureList& ally,
+    const CreatureList& enemies, const string& content, int seed, bool headless) {
+  auto startTime = Clock::getRealMillis();
+  RandomGen random;
+  random.init(seed);
+  RandomGen::ThreadOverride randomOverride(random);
+  auto contentFactory = deserializeContent(content);
   ProgressMeter meter(1);
-  int numAllies = 0;
-  int numEnemies = 0;
-  int numUnknown = 0;
+  EnemyFactory enemyFactory(random, contentFactory.getCreatures().getNameGenerator(), contentFactory.enemies,
+      contentFactory.externalEnemies);
+  auto model = ModelBuilder(&meter, random, options, sokobanInput,
+      &contentFactory, std::move(enemyFactory)).battleModel(levelPath, ally, enemies);
+  Clock clock;
+  DummyView dummyView(&clock);
+  auto game = Game::splashScreen(std::move(model), CampaignBuilder::getEmptyCampaign(), std::move(contentFactory));
   auto allyTribe = TribeId::getDarkKeeper();
-  std::cout.flush();
-  for (int i : Range(numTries)) {
-    std::cout << "Creating level" << std::endl;
-    auto contentFactory = createContentFactory(false);
-    EnemyFactory enemyFactory(Random, contentFactory.getCreatures().getNameGenerator(), contentFactory.enemies,
-        contentFactory.externalEnemies);
-    auto model = ModelBuilder(&meter, Random, options, sokobanInput,
-        &contentFactory, std::move(enemyFactory)).battleModel(levelPath, ally, enemies);
-    auto game = Game::splashScreen(std::move(model), CampaignBuilder::getEmptyCampaign(), std::move(contentFactory));
-    std::cout << "Done" << std::endl;
-    auto exitCondition = [&](WGame game) -> optional<ExitCondition> {
-      unordered_set<TribeId, CustomHash<TribeId>> tribes;
-      for (auto& m : game->getAllModels())
-        for (auto c : m->getAllCreatures())
-          tribes.insert(c->getTribeId());
-      if (tribes.size() == 1) {
-        if (*tribes.begin() == allyTribe)
-          return ExitCondition::ALLIES_WON;
-        else
-          return ExitCondition::ENEMIES_WON;
-      }
-      if (game->getGlobalTime().getVisibleInt() > 200)
-        return ExitCondition::TIMEOUT;
-      if (tribes.empty())
-        return ExitCondition::UNKNOWN;
+  int turns = 0;
+  auto exitCondition = [&](WGame game) -> optional<ExitCondition> {
+    turns = game->getGlobalTime().getVisibleInt();
+    unordered_set<TribeId, CustomHash<TribeId>> tribes;
+    for (auto& m : game->getAllModels())
+      for (auto c : m->getAllCreatures())
+        tribes.insert(c->getTribeId());
+    if (tribes.size() == 1) {
+      if (*tribes.begin() == allyTribe)
+        return ExitCondition::ALLIES_WON;
       else
-        return none;
-    };
-    auto result = playGame(std::move(game), false, true, false, exitCondition, milliseconds{3});
-    switch (result) {
-      case ExitCondition::ALLIES_WON:
-        ++numAllies;
-        std::cerr << "a";
-        break;
-      case ExitCondition::ENEMIES_WON:
-        ++numEnemies;
-        std::cerr << "e";
-        break;
-      case ExitCondition::TIMEOUT:
-        ++numUnknown;
-        std::cerr << "t";
+        return ExitCondition::ENEMIES_WON;
+    }
+    if (turns > 200)
+      return ExitCondition::TIMEOUT;
+    if (tribes.empty())
+      return ExitCondition::UNKNOWN;
+    else
+      return none;
+  };
+  ExitCondition result;
+  if (headless) {
+    // Same as playGame, but without waiting for the frame time. The shared collaborators aren't thread safe and
+    // nothing needs them without a player, so the game gets a view of its own and no others.
+    game->initialize(nullptr, nullptr, &dummyView, nullptr);
+    while (1) {
+      if (game->update(1)) {
+        result = ExitCondition::UNKNOWN;
         break;
-      case ExitCondition::UNKNOWN:
-        ++numUnknown;
-        std::cerr << "u";
+      }
+      if (auto c = exitCondition(game.get())) {
+        result = *c;
         break;
+      }
     }
-    std::cerr.flush();
+  } else
+    result = playGame(std::move(game), false, true, false, exitCondition, milliseconds{3});
+  return BattleResult{result, turns, Clock::getRealMillis() - startTime};
+}
+
+// Prints a "battle" record for every battle: label, index, seed, result, number of turns and wall time in ms,
+// followed by a "summary" record: label, number of battles, allies' wins, enemies' wins, timeouts, unknown results
+// and total wall time in ms.
+int MainLoop::battleTest(int numTries, const FilePath& levelPath, CreatureList ally, CreatureList enemies,
+    const string& content, const string& label, bool headless, RandomGen& random) {
+  // Seeds are drawn up front, so that the results don't depend on the order in which the battles finish.
+  vector<int> seeds;
+  for (int i : Range(numTries))
+    seeds.push_back(random.get(1 << 30));
+  vector<optional<BattleResult>> results(numTries);
+  auto getResultName = [](ExitCondition result) {
+    switch (result) {
+      case ExitCondition::ALLIES_WON: return "allies";
+      case ExitCondition::ENEMIES_WON: return "enemies";
+      case ExitCondition::TIMEOUT: return "timeout";
+      case ExitCondition::UNKNOWN: return "unknown";
+    }
+  };
+  auto startTime = Clock::getRealMillis();
+  std::cerr << label << ": ";
+  std::mutex outputMutex;
+  atomic<int> nextBattle(0);
+  // Exceptions can't leave a worker thread, so they are passed to the calling thread and stop the remaining battles.
+  vector<std::exception_ptr> errors(numTries);
+  auto worker = [&] {
+    for (int index = nextBattle++; index < numTries; index = nextBattle++) {
+      BattleResult result;
+      try {
+        result = playBattle(levelPath, ally, enemies, content, seeds[index], headless);
+      } catch (...) {
+        errors[index] = std::current_exception();
+        nextBattle = numTries;
+        return;
+      }
+      std::lock_guard<std::mutex> lock(outputMutex);
+      std::cerr << getResultName(result.result)[0];
+      std::cerr.flush();
+      results[index] = result;
+    }
+  };
+  // Battles shown in the view are played one by one. The info log isn't thread safe either.
+  if (!headless || useSingleThread || InfoLog.isEnabled())
+    worker();
+  else {
+    vector<thread> threads;
+    int numThreads = min<int>(numTries, max<int>(1, thread::hardware_concurrency()));
+    for (int i : Range(numThreads))
+      threads.push_back(makeThread(worker));
+    for (auto& t : threads)
+      t.join();
+  }
+  for (auto& error : errors)
+    if (error)
+      std::rethrow_exception(error);
+  int numAllies = 0;
+  int numEnemies = 0;
+  int numTimeouts = 0;
+  int numUnknown = 0;
+  for (int i : Range(numTries)) {
+    auto& result = *results[i];
+    switch (result.result) {
+      case ExitCondition::ALLIES_WON: ++numAllies; break;
+      case ExitCondition::ENEMIES_WON: ++numEnemies; break;
+      case ExitCondition::TIMEOUT: ++numTimeouts; break;
+      case ExitCondition::UNKNOWN: ++numUnknown; break;
+    }
+    std::cout << "battle\t" << label << "\t" << i << "\t" << seeds[i] << "\t" << getResultName(result.result) << "\t"
+        << result.turns << "\t" << result.wallTime.count() << "\n";
   }
+  std::cout << "summary\t" << label << "\t" << numTries << "\t" << numAllies << "\t" << numEnemies << "\t"
+      << numTimeouts << "\t" << numUnknown << "\t" << (Clock::getRealMillis() - startTime).count() << std::endl;
   std::cerr << " " << numAllies << ":" << numEnemies;
-  if (numUnknown > 0)
-    std::cerr << " (" << numUnknown << ") unknown";
+  if (numTimeouts + numUnknown > 0)
+    std::cerr << " (" << numTimeouts + numUnknown << ") unknown";
   std::cerr << "\n";
   return numAllies;
 }
@@ -910,34 +1154,72 @@ ModelTable MainLoop::prepareCampaignModels(CampaignSetup& setup, const AvatarInf
       if (retired->fileInfo.download)
         downloadGame(retired->fileInfo.filename);
     }
-  optional<string> failedToLoad;
-  int numSites = setup.campaign.getNumNonEmpty();
-  vector<ContentFactory> factories;
-  doWithSplash(SplashType::BIG, "Generating map...", numSites,
+  vector<Vec2> sitePositions;
+  for (Vec2 v : sites.getBounds())
+    if (!sites[v].isEmpty())
+      sitePositions.push_back(v);
+  // Every site gets its own random seed and share of names, so that the campaign depends only on the seed and not
+  // on the order in which the worker threads generate the sites.
+  auto nameGenerator = contentFactory->getCreatures().getNameGenerator();
+  vector<int> seeds;
+  vector<NameGenerator> nameShares;
+  for (int i : All(sitePositions)) {
+    seeds.push_back(random.get(1 << 30));
+    nameShares.push_back(nameGenerator->getShare(i, sitePositions.size()));
+  }
+  vector<optional<ContentFactory>> retiredFactories(sitePositions.size());
+  vector<optional<string>> failedToLoad(sitePositions.size());
+  auto generateSite = [&] (int index) {
+    Vec2 v = sitePositions[index];
+    RandomGen siteRandom;
+    siteRandom.init(seeds[index]);
+    RandomGen::ThreadOverride randomOverride(siteRandom);
+    NameGenerator::ThreadOverride nameOverride(nameShares[index]);
+    EnemyFactory enemyFactory(siteRandom, nameGenerator, contentFactory->enemies, contentFactory->externalEnemies);
+    ModelBuilder modelBuilder(nullptr, siteRandom, options, sokobanInput, contentFactory, std::move(enemyFactory));
+    if (sites[v].getKeeper()) {
+      models[v] = getBaseModel(modelBuilder, setup, avatarInfo);
+    } else if (auto villain = sites[v].getVillain())
+      models[v] = modelBuilder.campaignSiteModel(villain->enemyId, villain->type, avatarInfo.tribeAlignment);
+    else if (auto retired = sites[v].getRetired()) {
+      if (auto info = loadFromFile<RetiredModelInfo>(userPath.file(retired->fileInfo.filename), !useSingleThread)) {
+        models[v] = std::move(info->model);
+        retiredFactories[index] = std::move(info->factory);
+      } else
+        failedToLoad[index] = retired->fileInfo.filename;
+    }
+  };
+  doWithSplash(SplashType::BIG, "Generating map...", sitePositions.size(),
       [&] (ProgressMeter& meter) {
-        EnemyFactory enemyFactory(Random, contentFactory->getCreatures().getNameGenerator(), contentFactory->enemies,
-            contentFactory->externalEnemies);
-        ModelBuilder modelBuilder(nullptr, random, options, sokobanInput, contentFactory, std::move(enemyFactory));
-        for (Vec2 v : sites.getBounds()) {
-          if (!sites[v].isEmpty())
+        atomic<int> nextSite(0);
+        auto worker = [&] {
+          for (int index = nextSite++; index < sitePositions.size(); index = nextSite++) {
+            generateSite(index);
             meter.addProgress();
-          if (sites[v].getKeeper()) {
-            models[v] = getBaseModel(modelBuilder, setup, avatarInfo);
-          } else if (auto villain = sites[v].getVillain())
-            models[v] = modelBuilder.campaignSiteModel(villain->enemyId, villain->type, avatarInfo.tribeAlignment);
-          else if (auto retired = sites[v].getRetired()) {
-            if (auto info = loadFromFile<RetiredModelInfo>(userPath.file(retired->fileInfo.filename), !useSingleThread)) {
-              models[v] = std::move(info->model);
-              factories.push_back(std::move(info->factory));
-            } else {
-              failedToLoad = retired->fileInfo.filename;
-              setup.campaign.clearSite(v);
-            }
           }
+        };
+        // The rate limited logging used during level generation isn't thread safe.
+        if (useSingleThread || InfoLog.isEnabled())
+          worker();
+        else {
+          vector<thread> threads;
+          int numThreads = min<int>(sitePositions.size(), max<int>(1, thread::hardware_concurrency()));
+          for (int i : Range(numThreads))
+            threads.push_back(makeThread(worker));
+          for (auto& t : threads)
+            t.join();
         }
       });
-  if (failedToLoad)
-    view->presentText("Sorry", "Error reading " + *failedToLoad + ". Leaving blank site.");
+  nameGenerator->skipUsedBy(nameShares);
+  vector<ContentFactory> factories;
+  for (int i : All(sitePositions)) {
+    if (retiredFactories[i])
+      factories.push_back(std::move(*retiredFactories[i]));
+    if (failedToLoad[i]) {
+      view->presentText("Sorry", "Error reading " + *failedToLoad[i] + ". Leaving blank site.");
+      setup.campaign.clearSite(sitePositions[i]);
+    }
+  }
   return ModelTable{std::move(models), std::move(factories)};
 }
 
@@ -33,13 +33,17 @@ class TilePaths;
 class MainLoop {
   public:
   MainLoop(View*, Highscores*, FileSharing*, const DirectoryPath& dataFreePath, const DirectoryPath& userPath,
-      Options*, Jukebox*, SokobanInput*, TileSet*, bool useSingleThread, int saveVersion);
+      Options*, Jukebox*, SokobanInput*, TileSet*, bool useSingleThread, bool rebuildContentCache, int saveVersion);
+  ~MainLoop();
 
   void start(bool tilesPresent);
   void modelGenTest(int numTries, const vector<std::string>& types, RandomGen&, Options*);
-  void battleTest(int numTries, const FilePath& levelPath, const FilePath& battleInfoPath, string enemyId, RandomGen&);
-  int battleTest(int numTries, const FilePath& levelPath, CreatureList ally, CreatureList enemyId, RandomGen&);
-  void endlessTest(int numTries, const FilePath& levelPath, const FilePath& battleInfoPath, RandomGen&, optional<int> numEnemy);
+  // Without a view the battles are played in parallel, as fast as possible. Results are printed to the standard
+  // output as tab separated records.
+  void battleTest(int numTries, const FilePath& levelPath, const FilePath& battleInfoPath, string enemyId,
+      bool headless, RandomGen&);
+  void endlessTest(int numTries, const FilePath& levelPath, const FilePath& battleInfoPath, bool headless,
+      RandomGen&, optional<int> numEnemy);
   optional<string> verifyMod(const string& path);
   void launchQuickGame(optional<int> maxTurns);
 
@@ -64,6 +68,11 @@ class MainLoop {
 
   PGame prepareCampaign(RandomGen&);
   enum class ExitCondition;
+  int battleTest(int numTries, const FilePath& levelPath, CreatureList ally, CreatureList enemies,
+      const string& content, const string& label, bool headless, RandomGen&);
+  struct BattleResult;
+  BattleResult playBattle(const FilePath& levelPath, const CreatureList& ally, const CreatureList& enemies,
+      const string& content, int seed, bool headless);
   ExitCondition playGame(PGame, bool withMusic, bool noAutoSave, bool splashScreen,
       function<optional<ExitCondition> (WGame)> = nullptr, milliseconds stepTimeMilli = milliseconds{3}, optional<int> maxTurns = none);
   void splashScreen();
@@ -92,6 +101,8 @@ class MainLoop {
   Highscores* highscores = nullptr;
   FileSharing* fileSharing = nullptr;
   bool useSingleThread;
+  // Parse the game data even if the content cache is up to date.
+  bool rebuildContentCache;
   SokobanInput* sokobanInput;
   TileSet* tileSet;
   PModel getBaseModel(ModelBuilder&, CampaignSetup&, const AvatarInfo&);
@@ -102,6 +113,13 @@ class MainLoop {
   void bugReportSave(PGame&, FilePath);
   int saveVersion;
   void saveGame(PGame&, const FilePath&);
+  void saveGame(PGame&, ostream&);
+  void autosave(PGame&);
+  void waitForAutosave();
+  // Compresses and writes the last autosave snapshot while the game continues.
+  thread autosaveThread;
+  // Set by autosaveThread if writing failed, so that the game loop can tell the player.
+  atomic<bool> autosaveFailed{false};
   void saveMainModel(PGame&, const FilePath&);
   ContentFactory createContentFactory(bool vanillaOnly) const;
   TilePaths getTilePathsForAllMods() const;
@@ -45,7 +45,7 @@ MapGui::MapGui(Callbacks call, SyncQueue<UserInput>& inputQueue, Clock* c, Optio
     unique_ptr<fx::FXRenderer> fxRenderer, unique_ptr<FXViewManager> fxViewManager)
     : objects(Level::getMaxBounds()), callbacks(call), inputQueue(inputQueue),
     clock(c), options(o), fogOfWar(Level::getMaxBounds(), false), extraBorderPos(Level::getMaxBounds(), {}),
-    lastSquareUpdate(Level::getMaxBounds()), connectionMap(Level::getMaxBounds()), guiFactory(f),
+    connectionMap(Level::getMaxBounds()), guiFactory(f),
     fxRenderer(std::move(fxRenderer)), fxViewManager(std::move(fxViewManager)) {
   clearCenter();
 }
@@ -1216,6 +1216,10 @@ void MapGui::render(Renderer& renderer) {
   processScrolling(currentTimeReal);
 }
 
+const MapGui::TileCacheStats& MapGui::getTileCacheStats() const {
+  return tileCacheStats;
+}
+
 bool MapGui::onClick(GuiElem::ClickButton b, Vec2 v) {
   switch (b) {
     case LEFT:
@@ -1227,7 +1231,7 @@ bool MapGui::onClick(GuiElem::ClickButton b, Vec2 v) {
   }
 }
 
-void MapGui::updateObject(Vec2 pos, CreatureView* view, Renderer& renderer, milliseconds currentTime) {
+void MapGui::updateObject(Vec2 pos, CreatureView* view, Renderer& renderer) {
   auto level = view->getCreatureViewLevel();
   objects[pos].emplace();
   auto& index = *objects[pos];
@@ -1235,7 +1239,6 @@ void MapGui::updateObject(Vec2 pos, CreatureView* view, Renderer& renderer, mill
   level->setNeedsRenderUpdate(pos, false);
   if (index.hasObject(ViewLayer::FLOOR) || index.hasObject(ViewLayer::FLOOR_BACKGROUND))
     index.setGradient(GradientType::NIGHT, 1.0 - level->getLight(pos));
-  lastSquareUpdate[pos] = currentTime;
   connectionMap[pos].clear();
   shadowed.erase(pos + Vec2(0, 1));
   if (index.hasObject(ViewLayer::FLOOR)) {
@@ -1270,6 +1273,9 @@ double MapGui::getDistanceToEdgeRatio(Vec2 pos) {
   return ret;
 }
 
+const int sunlightSteps = 50;
+const int refreshPeriod = 60;
+
 void MapGui::updateObjects(CreatureView* view, Renderer& renderer, MapLayout* mapLayout, bool smoothMovement, bool ui,
     const optional<TutorialInfo>& tutorial) {
   if (tutorial) {
@@ -1283,19 +1289,36 @@ void MapGui::updateObjects(CreatureView* view, Renderer& renderer, MapLayout* ma
   levelBounds = level->getBounds();
   mouseUI = ui;
   layout = mapLayout;
-  auto currentTimeReal = clock->getRealMillis();
   // hacky way to detect that we're switching between real-time and turn-based and not between
   // team members in turn-based mode.
   bool newView = (view->getCenterType() != previousView);
-  if (newView || level != previousLevel)
-    for (Vec2 pos : level->getBounds())
+  tileCacheStats = TileCacheStats{};
+  // Cached tiles are only rebuilt when the level marks them as changed, so a new view, viewer or level has to
+  // invalidate all of them, including the ones outside of the level bounds.
+  // The night gradient of every tile depends on the amount of sunlight. It's quantized, so that tiles aren't
+  // rebuilt on every frame during dawn and dusk.
+  int sunlight = int(level->getGame()->getSunlightInfo().getLightAmount() * sunlightSteps);
+  if (newView || level != previousLevel || view != previousCreatureView)
+    for (Vec2 pos : Level::getMaxBounds())
       level->setNeedsRenderUpdate(pos, true);
-  else
+  else {
+    if (sunlight != previousSunlight)
+      for (Vec2 pos : Level::getMaxBounds())
+        level->setNeedsRenderUpdate(pos, true);
+    // Some changes don't mark any tiles, such as the viewer going blind, toggling the map or changes of the
+    // forbidden zones. As a backstop, every frame also rebuilds every refreshPeriod-th row of tiles, so that
+    // the whole view is refreshed about once a second.
+    refreshPhase = (refreshPhase + 1) % refreshPeriod;
     for (Vec2 pos : mapLayout->getAllTiles(getBounds(), Level::getMaxBounds(), getScreenPos()))
-      if (level->needsRenderUpdate(pos) ||
-          !lastSquareUpdate[pos] || *lastSquareUpdate[pos] < currentTimeReal - milliseconds{1000})
-        updateObject(pos, view, renderer, currentTimeReal);
+      if (!objects[pos] || level->needsRenderUpdate(pos) || pos.y % refreshPeriod == refreshPhase) {
+        updateObject(pos, view, renderer);
+        ++tileCacheStats.rebuilt;
+      } else
+        ++tileCacheStats.reused;
+  }
+  previousSunlight = sunlight;
   previousView = view->getCenterType();
+  previousCreatureView = view;
   if (previousLevel != level) {
     screenMovement = none;
     clearCenter();
@@ -89,13 +89,19 @@ class MapGui : public GuiElem {
   };
   const HighlightedInfo& getLastHighlighted();
   bool isCreatureHighlighted(UniqueEntity<Creature>::Id);
+  struct TileCacheStats {
+    int rebuilt = 0;
+    int reused = 0;
+  };
+  // Number of visible tiles rebuilt and reused from the cache during the last updateObjects call.
+  const TileCacheStats& getTileCacheStats() const;
   bool fxesAvailable() const;
 
   private:
   bool onLeftClick(Vec2);
   bool onRightClick(Vec2);
   bool onMiddleClick(Vec2);
-  void updateObject(Vec2, CreatureView*, Renderer&, milliseconds currentTime);
+  void updateObject(Vec2, CreatureView*, Renderer&);
   void drawObjectAbs(Renderer&, Vec2 pos, const ViewObject&, Vec2 size, Vec2 movement, Vec2 tilePos,
       milliseconds currentTimeReal, const ViewIndex&);
   void drawCreatureHighlights(Renderer&, const ViewObject&, const ViewIndex&, Vec2 pos, Vec2 sz,
@@ -153,7 +159,10 @@ class MapGui : public GuiElem {
   } mouseOffset, center;
   WConstLevel previousLevel = nullptr;
   optional<CreatureViewCenterType> previousView;
-  Table<optional<milliseconds>> lastSquareUpdate;
+  const CreatureView* previousCreatureView = nullptr;
+  int previousSunlight = -1;
+  int refreshPhase = 0;
+  TileCacheStats tileCacheStats;
   optional<Coords> softCenter;
   Vec2 lastMousePos;
   optional<Vec2> lastMouseMove;
@@ -55,6 +55,7 @@
 #include "unknown_locations.h"
 #include "avatar_info.h"
 #include "collective_config.h"
+#include "job_pool.h"
 
 template <class Archive> 
 void Model::serialize(Archive& ar, const unsigned int version) {
@@ -100,9 +101,9 @@ vector<WCollective> Model::getCollectives() const {
   return getWeakPointers(collectives);
 }
 
-void Model::updateSunlightMovement() {
-  for (PLevel& l : levels)
-    l->updateSunlightMovement();
+void Model::onItemsChanged(Position pos) {
+  for (auto& collective : collectives)
+    collective->onItemsChanged(pos);
 }
 
 void Model::checkCreatureConsistency() {
@@ -117,6 +118,28 @@ void Model::checkCreatureConsistency() {
   }
 }
 
+static int numMoveThreads = 1;
+
+void Model::setNumMoveThreads(int num) {
+  numMoveThreads = num;
+}
+
+void Model::prefetchFieldsOfView(LocalTime time) {
+  if (numMoveThreads <= 1 || lastPrefetch == time)
+    return;
+  lastPrefetch = time;
+  // Every model has its own pool, so that games updated on different threads, like headless battles played in
+  // parallel, don't wait for each other.
+  if (!moveJobPool || moveJobPool->getNumThreads() != numMoveThreads)
+    moveJobPool = unique<JobPool>(numMoveThreads);
+  auto creatures = timeQueue->getCreaturesMovingUntil(time);
+  // Computing the results only reads the squares, and squares changed by earlier moves drop the affected results,
+  // so the moves see the same fields of view as without the prefetch.
+  for (auto& level : levels)
+    level->prefetchFieldsOfView(creatures.filter([&](Creature* c) { return c->getLevel() == level.get(); }),
+        *moveJobPool);
+}
+
 bool Model::update(double totalTime) {
   currentTime = totalTime;
   if (Creature* creature = timeQueue->getNextCreature(totalTime)) {
@@ -132,8 +155,9 @@ bool Model::update(double totalTime) {
     }
     CHECK(creature->getLevel() != nullptr) << "Creature misplaced before moving: " << creature->getName().bare() <<
         ". Any idea why this happened?";
+    prefetchFieldsOfView(timeQueue->getTime(creature));
     if (!creature->isDead()) {
-      INFO << "Turn " << totalTime << " " << creature->getName().bare() << " moving now";
+      INFO_LIMITED(50) << "Turn " << totalTime << " " << creature->getName().bare() << " moving now";
       creature->makeMove();
     }
     CHECK(creature->getLevel() != nullptr) << "Creature misplaced after moving: " << creature->getName().bare() <<
@@ -36,6 +36,7 @@ class Options;
 class AvatarInfo;
 class GameConfig;
 class ContentFactory;
+class JobPool;
 
 /**
   * Main class that holds all game logic.
@@ -48,6 +49,11 @@ class Model : public OwnedObject<Model> {
     Returns the total logical time elapsed.*/
   bool update(double totalTime);
 
+  /** If more than one, the fields of view of all creatures moving in the same turn are computed ahead of their
+      moves on that many threads. The moves are still made one by one, so the game plays out the same.
+      Every model starts its own threads.*/
+  static void setNumMoveThreads(int);
+
   /** Returns the level that the stairs lead to. */
   WLevel getLinkedLevel(WLevel from, StairKey) const;
 
@@ -71,6 +77,8 @@ class Model : public OwnedObject<Model> {
   WGame getGame() const;
   void tick(LocalTime);
   vector<WCollective> getCollectives() const;
+  /** Keeps the item counts of the collectives up to date.*/
+  void onItemsChanged(Position);
   vector<Creature*> getAllCreatures() const;
   const vector<PCreature>& getDeadCreatures() const;
   vector<WLevel> getLevels() const;
@@ -86,7 +94,6 @@ class Model : public OwnedObject<Model> {
   int getSaveProgressCount() const;
 
   void killCreature(Creature* victim);
-  void updateSunlightMovement();
 
   PCreature extractCreature(Creature*);
   void transferCreature(PCreature, Vec2 travelDir);
@@ -115,6 +122,7 @@ class Model : public OwnedObject<Model> {
   friend class ModelBuilder;
 
   PCreature makePlayer(int handicap);
+  void prefetchFieldsOfView(LocalTime);
 
   vector<PLevel> SERIAL(levels);
   vector<WLevel> SERIAL(mainLevels);
@@ -129,6 +137,8 @@ class Model : public OwnedObject<Model> {
   optional<StairKey> getStairsBetween(WConstLevel from, WConstLevel to) const;
   map<pair<LevelId, LevelId>, StairKey> SERIAL(stairNavigation);
   bool serializationLocked = false;
+  optional<LocalTime> lastPrefetch;
+  unique_ptr<JobPool> moveJobPool;
   template <typename>
   friend class EventListener;
   OwnerPointer<EventGenerator> SERIAL(eventGenerator);
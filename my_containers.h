@@ -108,6 +108,10 @@ class vector {
     ++modCounter;
   }
 
+  int capacity() const {
+    return (int) impl.capacity();
+  }
+
   auto data() {
     return impl.data();
   }
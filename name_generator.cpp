@@ -85,8 +85,21 @@ NameGenerator::NameGenerator(const DirectoryPath& namesPath) {
 }
 
 
+static thread_local NameGenerator* nameGeneratorOverride = nullptr;
+
+NameGenerator::ThreadOverride::ThreadOverride(NameGenerator& generator) : previous(nameGeneratorOverride) {
+  nameGeneratorOverride = &generator;
+}
+
+NameGenerator::ThreadOverride::~ThreadOverride() {
+  nameGeneratorOverride = previous;
+}
+
 string NameGenerator::getNext(NameGeneratorId id) {
+  if (nameGeneratorOverride && nameGeneratorOverride != this)
+    return nameGeneratorOverride->getNext(id);
   CHECK(!names[id].empty());
+  ++numUsed[id];
   string ret = names[id].front();
   names[id].pop_front();
   names[id].push_back(ret);
@@ -96,3 +109,46 @@ string NameGenerator::getNext(NameGeneratorId id) {
 vector<string> NameGenerator::getAll(NameGeneratorId id) {
   return vector<string>(names[id].begin(), names[id].end());
 }
+
+NameGenerator NameGenerator::getShare(int index, int numShares) const {
+  NameGenerator ret;
+  for (auto id : ENUM_ALL(NameGeneratorId)) {
+    auto& all = names[id];
+    if (all.size() < numShares) {
+      // Not enough names to go around, so some will repeat.
+      for (int i : All(all))
+        ret.names[id].push_back(all[(i + index) % all.size()]);
+    } else
+      for (int i = index; i < all.size(); i += numShares)
+        ret.names[id].push_back(all[i]);
+  }
+  return ret;
+}
+
+void NameGenerator::skipUsedBy(const vector<NameGenerator>& shares) {
+  for (auto id : ENUM_ALL(NameGeneratorId)) {
+    // A share moves every name it hands out to its back, so its last numUsed names are the used ones.
+    unordered_map<string, int> used;
+    for (auto& share : shares) {
+      auto& shareNames = share.names[id];
+      for (int i : Range(max<int>(0, shareNames.size() - share.numUsed[id]), shareNames.size()))
+        ++used[shareNames[i]];
+    }
+    if (used.empty())
+      continue;
+    // Moves the used names to the back, as if they were handed out by this generator.
+    deque<string> unused;
+    deque<string> moved;
+    for (auto& name : names[id]) {
+      auto it = used.find(name);
+      if (it != used.end() && it->second > 0) {
+        --it->second;
+        moved.push_back(name);
+      } else
+        unused.push_back(name);
+    }
+    for (auto& name : moved)
+      unused.push_back(name);
+    names[id] = std::move(unused);
+  }
+}
@@ -46,8 +46,25 @@ class NameGenerator {
   NameGenerator(const NameGenerator&) = delete;
   NameGenerator(NameGenerator&&) = default;
 
+  /** Returns a generator with every numShares-th name, starting from the index-th one, so that different shares
+      hand out different names. Used to generate names in parallel, but deterministically.*/
+  NameGenerator getShare(int index, int numShares) const;
+  /** Moves the names handed out by the given shares to the back, so that they aren't repeated soon.*/
+  void skipUsedBy(const vector<NameGenerator>& shares);
+
+  /** While alive, makes all NameGenerators hand out names from the given one on the current thread.*/
+  class ThreadOverride {
+    public:
+    ThreadOverride(NameGenerator&);
+    ~ThreadOverride();
+
+    private:
+    NameGenerator* previous;
+  };
+
   SERIALIZATION_DECL(NameGenerator)
 
   private:
   EnumMap<NameGeneratorId, deque<string>> SERIAL(names);
+  EnumMap<NameGeneratorId, int> numUsed;
 };
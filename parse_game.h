@@ -2,11 +2,11 @@
 
 #include "util.h"
 #include "saved_game_info.h"
-#include "gzstream.h"
+#include "compressed_stream.h"
 #include "file_path.h"
 
-typedef StreamCombiner<ogzstream, OutputArchive> CompressedOutput;
-typedef StreamCombiner<igzstream, InputArchive> CompressedInput;
+typedef StreamCombiner<CompressedOutputStream, OutputArchive> CompressedOutput;
+typedef StreamCombiner<CompressedInputStream, InputArchive> CompressedInput;
 
 template <typename InputType>
 optional<pair<string, int>> getNameAndVersionUsing(const FilePath& filename) {
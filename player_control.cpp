@@ -1853,6 +1853,11 @@ void PlayerControl::clearChosenInfo() {
 void PlayerControl::setChosenLibrary(bool state) {
   if (state)
     clearChosenInfo();
+  if (state != chosenLibrary)
+    for (auto pos : collective->getTerritory().getAll())
+      if (auto furniture = pos.getFurniture(FurnitureLayer::MIDDLE))
+        if (furniture->getUsageType() == FurnitureUsageType::STUDY)
+          pos.setNeedsRenderUpdate(true);
   chosenLibrary = state;
 }
 
@@ -1870,6 +1875,14 @@ void PlayerControl::setChosenWorkshop(optional<WorkshopType> type) {
   refreshHighlights();
 }
 
+void PlayerControl::setDraggedCreature(optional<UniqueEntity<Creature>::Id> id) {
+  // Refresh the drop highlights of all activity furniture.
+  for (auto task : ENUM_ALL(MinionActivity))
+    for (auto& pos : collective->getMinionActivities().getAllPositions(collective, nullptr, task))
+      pos.first.setNeedsRenderUpdate(true);
+  draggedCreature = id;
+}
+
 void PlayerControl::minionDragAndDrop(const CreatureDropInfo& info) {
   PROFILE;
   Position pos(info.pos, getCurrentLevel());
@@ -1927,14 +1940,11 @@ void PlayerControl::processInput(View* view, UserInput input) {
       }
       break;
     case UserInputId::CREATURE_DRAG:
-      draggedCreature = input.get<Creature::Id>();
-      for (auto task : ENUM_ALL(MinionActivity))
-        for (auto& pos : collective->getMinionActivities().getAllPositions(collective, nullptr, task))
-          pos.first.setNeedsRenderUpdate(true);
+      setDraggedCreature(input.get<Creature::Id>());
       break;
     case UserInputId::CREATURE_DRAG_DROP:
       minionDragAndDrop(input.get<CreatureDropInfo>());
-      draggedCreature = none;
+      setDraggedCreature(none);
       break;
     case UserInputId::TEAM_DRAG_DROP: {
       auto& info = input.get<TeamDropInfo>();
@@ -2461,11 +2471,13 @@ void PlayerControl::handleSelection(Vec2 pos, const BuildInfo& building, bool re
       auto& zones = collective->getZones();
       if (zones.isZone(position, zone) && selection != SELECT) {
         zones.eraseZone(position, zone);
+        collective->updateItemLedger(position);
         selection = DESELECT;
       } else if (selection != DESELECT && !zones.isZone(position, zone) &&
           collective->getKnownTiles().isKnown(position) &&
           zones.canSet(position, zone, collective)) {
         zones.setZone(position, zone);
+        collective->updateItemLedger(position);
         selection = SELECT;
       }
     },
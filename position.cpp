@@ -534,12 +534,10 @@ void Position::dropItems(vector<PItem> v) {
 constexpr int buildingSupportRadius = 5;
 
 void Position::updateBuildingSupport() const {
-  if (isValid()) {
-    if (isBuildingSupport())
-      level->roofSupport->add(coord);
-    else
-      level->roofSupport->remove(coord);
-  }
+  if (isValid())
+    level->updateRoofConnectivity(isBuildingSupport()
+        ? level->roofSupport->add(coord)
+        : level->roofSupport->remove(coord));
 }
 
 void Position::addFurniture(PFurniture f) const {
@@ -923,6 +921,9 @@ void Position::updateConnectivity() const {
         elem.second.add(coord);
       else
         elem.second.remove(coord);
+    for (auto& elem : level->clusterGraphs)
+      elem.second.invalidate(coord);
+    LevelShortestPath::updateFlowFields(*this);
   }
   if (couldEnter != movementEventPredicate())
     if (auto game = getGame())
@@ -1008,12 +1009,15 @@ optional<DestroyAction> Position::getBestDestroyAction(const MovementType& movem
 
 double Position::getNavigationCost(const MovementType& movement, const Sectors& onltMovementSectors) const {
   PROFILE;
-  if (onltMovementSectors.contains(coord)) {
-    if (level->getSafeSquare(coord)->getCreature()) {
-      return 5.0;
-    } else
-      return 1.0;
-  }
+  if (onltMovementSectors.contains(coord) && level->getSafeSquare(coord)->getCreature())
+    return 5.0;
+  return getNavigationCostIgnoringCreatures(movement, onltMovementSectors);
+}
+
+double Position::getNavigationCostIgnoringCreatures(const MovementType& movement,
+    const Sectors& onlyMovementSectors) const {
+  if (onlyMovementSectors.contains(coord))
+    return 1.0;
   if (auto destroyAction = getBestDestroyAction(movement))
     return 1.0 + *getFurniture(FurnitureLayer::MIDDLE)->getStrength(*destroyAction) / 10;
   if (movement.canBuildBridge() && canConstruct(FurnitureType("BRIDGE")) &&
@@ -1067,7 +1071,7 @@ bool Position::isVisibleBy(const Creature* c) const {
 void Position::clearItemIndex(ItemIndex index) const {
   PROFILE;
   if (isValid())
-    modSquare()->clearItemIndex(index);
+    modSquare()->clearItemIndex(*this, index);
 }
 
 bool Position::isChokePoint(const MovementType& movement) const {
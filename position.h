@@ -117,6 +117,7 @@ class Position {
   bool canNavigateToOrNeighbor(Position, const MovementType&) const;
   bool canNavigateTo(Position, const MovementType&) const;
   double getNavigationCost(const MovementType&, const Sectors& onltMovementSectors) const;
+  double getNavigationCostIgnoringCreatures(const MovementType&, const Sectors& onlyMovementSectors) const;
   optional<DestroyAction> getBestDestroyAction(const MovementType&) const;
   vector<Position> getVisibleTiles(const Vision&);
   void updateConnectivity() const;
@@ -10,18 +10,22 @@ SERIALIZATION_CONSTRUCTOR_IMPL(RoofSupport)
 
 constexpr int maxRoofSize = 10;
 
-void RoofSupport::add(Vec2 pos) {
+vector<Vec2> RoofSupport::add(Vec2 pos) {
+  vector<Vec2> ret;
   if (!isWall(pos)) {
-    modify(pos, 1);
+    modify(pos, 1, ret);
     wall[pos] = true;
   }
+  return ret;
 }
 
-void RoofSupport::remove(Vec2 pos) {
+vector<Vec2> RoofSupport::remove(Vec2 pos) {
+  vector<Vec2> ret;
   if (isWall(pos)) {
-    modify(pos, -1);
+    modify(pos, -1, ret);
     wall[pos] = false;
   }
+  return ret;
 }
 
 bool RoofSupport::isRoof(Vec2 pos) const {
@@ -32,14 +36,17 @@ bool RoofSupport::isWall(Vec2 pos) const {
   return pos.inRectangle(wall.getBounds()) && wall[pos];
 }
 
-void RoofSupport::modify(Vec2 pos, int value) {
+void RoofSupport::modify(Vec2 pos, int value, vector<Vec2>& changed) {
   //std::cout << "Pos " << pos << " " << value << std::endl;
   for (int x : Range(pos.x - maxRoofSize, pos.x + maxRoofSize + 1).intersection(wall.getBounds().getXRange()))
     if (x != pos.x && wall[Vec2(x, pos.y)])
       for (int y : Range(pos.y - maxRoofSize, pos.y + maxRoofSize + 1).intersection(wall.getBounds().getYRange()))
         if (y != pos.y && wall[Vec2(pos.x, y)] && wall[Vec2(x, y)]) {
           //std::cout << "Rect " << " " << pos << "" << Vec2(x, y) << std::endl;
-          for (Vec2 v : Rectangle(min(pos.x, x), min(pos.y, y), max(pos.x, x) + 1, max(pos.y, y) + 1))
+          for (Vec2 v : Rectangle(min(pos.x, x), min(pos.y, y), max(pos.x, x) + 1, max(pos.y, y) + 1)) {
             numRectangles[v] += value;
+            if (numRectangles[v] == max(0, value))
+              changed.push_back(v);
+          }
         }
 }
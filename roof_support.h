@@ -5,8 +5,9 @@
 class RoofSupport {
   public:
   RoofSupport(Rectangle bounds);
-  void add(Vec2);
-  void remove(Vec2);
+  /** Both return the tiles that gained or lost their roof.*/
+  vector<Vec2> add(Vec2);
+  vector<Vec2> remove(Vec2);
   bool isRoof(Vec2) const;
 
   SERIALIZATION_DECL(RoofSupport)
@@ -15,5 +16,5 @@ class RoofSupport {
   Table<int> SERIAL(numRectangles);
   Table<int> SERIAL(wall);
   bool isWall(Vec2) const;
-  void modify(Vec2, int);
+  void modify(Vec2, int, vector<Vec2>& changed);
 };
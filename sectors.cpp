@@ -54,12 +54,23 @@ bool Sectors::add(Vec2 pos) {
 void Sectors::setSector(Vec2 pos, SectorId sector) {
   CHECK(sectors[pos] != sector);
   if (contains(pos))
-    --sizes[sectors[pos]];
+    decreaseSize(sectors[pos]);
   sectors[pos] = sector;
   ++sizes[sector];
 }
 
+void Sectors::decreaseSize(SectorId sector) {
+  if (--sizes[sector] == 0)
+    freeSectors.push_back(sector);
+}
+
 Sectors::SectorId Sectors::getNewSector() {
+  while (!freeSectors.empty()) {
+    auto ret = freeSectors.back();
+    freeSectors.pop_back();
+    if (sizes[ret] == 0)
+      return ret;
+  }
   sizes.push_back(0);
   CHECK(sizes.size() < std::numeric_limits<SectorId>::max());
   return sizes.size() - 1;
@@ -88,7 +99,7 @@ void Sectors::join(Vec2 pos1, SectorId sector) {
   }
 }
 
-static DirtyTable<int> bfsTable(Level::getMaxBounds(), -1);
+static thread_local DirtyTable<int> bfsTable(Level::getMaxBounds(), -1);
 
 vector<Vec2> Sectors::getDisjoint(Vec2 pos) const {
   vector<queue<Vec2>> queues;
@@ -173,13 +184,42 @@ const Sectors::ExtraConnections Sectors::getExtraConnections() const {
   return extraConnections;
 }
 
+// Checks if the tiles around pos are connected to each other without going through pos, in which case
+// removing pos can't split its sector.
+bool Sectors::neighborsConnected(Vec2 pos) const {
+  if (extraConnections[pos])
+    return false;
+  array<Vec2, 8> neighbors;
+  int numNeighbors = 0;
+  for (Vec2 v : pos.neighbors8())
+    if (v.inRectangle(bounds) && contains(v))
+      neighbors[numNeighbors++] = v;
+  if (numNeighbors <= 1)
+    return true;
+  int reached = 1;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i : Range(numNeighbors))
+      if (reached & (1 << i))
+        for (int j : Range(numNeighbors))
+          if (!(reached & (1 << j)) && neighbors[i].dist8(neighbors[j]) == 1) {
+            reached |= 1 << j;
+            changed = true;
+          }
+  }
+  return reached == (1 << numNeighbors) - 1;
+}
+
 bool Sectors::remove(Vec2 pos) {
   if (!contains(pos))
     return false;
-  --sizes[sectors[pos]];
+  bool needsSplit = !neighborsConnected(pos);
+  decreaseSize(sectors[pos]);
   sectors[pos] = -1;
-  for (Vec2 v : getDisjoint(pos))
-    join(v, getNewSector());
+  if (needsSplit)
+    for (Vec2 v : getDisjoint(pos))
+      join(v, getNewSector());
   return true;
 }
 
@@ -34,15 +34,19 @@ class Sectors {
   const ExtraConnections getExtraConnections() const;
 
   private:
-  using SectorId = short;
+  using SectorId = int;
   vector<Vec2> getNeighbors(Vec2) const;
   void setSector(Vec2, SectorId);
+  void decreaseSize(SectorId);
   SectorId getNewSector();
   void join(Vec2, SectorId);
   vector<Vec2> getDisjoint(Vec2) const;
+  bool neighborsConnected(Vec2) const;
   Rectangle bounds;
   Table<SectorId> sectors;
   vector<int> sizes;
+  // Ids of sectors that became empty, to be reused before allocating new ones.
+  vector<SectorId> freeSectors;
   ExtraConnections extraConnections;
 };
 
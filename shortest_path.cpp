@@ -21,40 +21,27 @@
 #include "lasting_effect.h"
 #include "furniture.h"
 #include "furniture_usage.h"
+#include "flow_field_cache.h"
 
 SERIALIZE_DEF(ShortestPath, path, target, bounds, reversed)
 SERIALIZATION_CONSTRUCTOR_IMPL(ShortestPath)
 
 const double ShortestPath::infinity = 1000000000;
 const double LevelShortestPath::infinity = 1000000000;
+const double DistanceTable::infinity = 1000000000;
 
 const int revShortestLimit = 15;
 
-class DistanceTable {
-  public:
-  DistanceTable(Rectangle bounds) : ddist(bounds), dirty(bounds, 0) {}
-
-  double getDistance(Vec2 v) const {
-    return dirty[v] < counter ? ShortestPath::infinity : ddist[v];
-  }
-
-  void setDistance(Vec2 v, double d) {
-    ddist[v] = d;
-    dirty[v] = counter;
-  }
+DistanceTable::DistanceTable(Rectangle bounds) : ddist(bounds), dirty(bounds, 0) {
+}
 
-  void clear() {
-    ++counter;
-  }
+static thread_local DistanceTable distanceTable(Level::getMaxBounds());
 
-  private:
-  Table<double> ddist;
-  Table<int> dirty;
-  int counter = 1;
-};
+static double getTableDistance(Vec2 v) {
+  return distanceTable.getDistance(v);
+}
 
-static DistanceTable distanceTable(Level::getMaxBounds());
-static DirtyTable<double> navigationCostCache(Level::getMaxBounds(), 0);
+static thread_local DirtyTable<double> navigationCostCache(Level::getMaxBounds(), 0);
 
 template <typename Fun>
 static auto getCached(Fun fun) {
@@ -71,6 +58,18 @@ static auto getCached(Fun fun) {
 
 const int margin = 15;
 
+// Size of the area around a blocked part of a path that is searched for a detour.
+const int repairMargin = 5;
+
+// Number of steps ahead of the creature that are checked for blocked tiles when a path is reused.
+const int repairLookahead = 8;
+
+// Number of times a path is reused before it's searched again, so that creatures eventually notice shortcuts.
+const int replanInterval = 20;
+
+// Long paths are planned on the ClusterGraph and only refined this many clusters ahead.
+const int clusterRefinementRange = 3;
+
 ShortestPath::ShortestPath(Rectangle a, function<double(Vec2)> entryFun, function<double(Vec2)> lengthFun,
     function<vector<Vec2>(Vec2)> directions, Vec2 to, Vec2 from, double mult) : ShortestPath(TemplateConstr{},
     std::move(a), std::move(entryFun), std::move(lengthFun), std::move(directions), to, from, mult) {}
@@ -97,6 +96,12 @@ ShortestPath::ShortestPath(Rectangle area, function<double (Vec2)> entryFun, fun
 {
 }
 
+ShortestPath::ShortestPath(FromDistances, Rectangle area, function<double(Vec2)> distanceFun,
+    function<vector<Vec2>(Vec2)> directions, Vec2 target, Vec2 from) : target(target), bounds(area), reversed(false) {
+  PROFILE;
+  constructPath(from, distanceFun, directions);
+}
+
 struct QueueElem {
   Vec2 pos;
   double value;
@@ -127,9 +132,9 @@ void ShortestPath::init(EntryFun entryFun, LengthFun lengthFun, DirectionsFun di
     double posDist = distanceTable.getDistance(pos);
    // INFO << "Popping " << pos << " " << distance[pos]  << " " << (from ? (*from - pos).length4() : 0);
     if (from == pos || (limit && distanceTable.getDistance(pos) >= *limit)) {
-      INFO << "Shortest path from " << (from ? *from : Vec2(-1, -1)) << " to " << target << " " << numPopped
+      INFO_LIMITED(50) << "Shortest path from " << (from ? *from : Vec2(-1, -1)) << " to " << target << " " << numPopped
         << " visited distance " << distanceTable.getDistance(pos);
-      constructPath(pos, directions);
+      constructPath(pos, getTableDistance, directions);
       return;
     }
     q.pop();
@@ -153,7 +158,7 @@ void ShortestPath::init(EntryFun entryFun, LengthFun lengthFun, DirectionsFun di
       }
     }
   }
-  INFO << "Shortest path exhausted, " << numPopped << " visited";
+  INFO_LIMITED(50) << "Shortest path exhausted, " << numPopped << " visited";
 }
 
 void ShortestPath::reverse(function<double(Vec2)> entryFun, function<double(Vec2)> lengthFun, function<vector<Vec2>(Vec2)> directions,
@@ -174,8 +179,8 @@ void ShortestPath::reverse(function<double(Vec2)> entryFun, function<double(Vec2
     ++numPopped;
     Vec2 pos = q.top().pos;
     if (from == pos) {
-      INFO << "Rev shortest path from " << " from " << target << " " << numPopped << " visited";
-      constructPath(pos, directions, true);
+      INFO_LIMITED(50) << "Rev shortest path from " << " from " << target << " " << numPopped << " visited";
+      constructPath(pos, getTableDistance, directions, true);
       return;
     }
     q.pop();
@@ -188,28 +193,30 @@ void ShortestPath::reverse(function<double(Vec2)> entryFun, function<double(Vec2
         }
       }
   }
-  INFO << "Rev shortest path from " << " from " << target << " " << numPopped << " visited";
+  INFO_LIMITED(50) << "Rev shortest path from " << " from " << target << " " << numPopped << " visited";
 }
 
-void ShortestPath::constructPath(Vec2 pos, function<vector<Vec2>(Vec2)> directions, bool reversed) {
+template <typename DistanceFun>
+void ShortestPath::constructPath(Vec2 pos, DistanceFun getDistance, function<vector<Vec2>(Vec2)> directions,
+    bool reversed) {
   vector<Vec2> ret;
   auto origPos = pos;
   while (pos != target) {
     Vec2 next;
-    double lowest = distanceTable.getDistance(pos);
+    double lowest = getDistance(pos);
     CHECK(lowest < infinity);
     for (Vec2 dir : directions(pos)) {
       double dist;
-      if ((pos + dir).inRectangle(bounds) && (dist = distanceTable.getDistance(pos + dir)) < lowest) {
+      if ((pos + dir).inRectangle(bounds) && (dist = getDistance(pos + dir)) < lowest) {
         lowest = dist;
         next = pos + dir;
       }
     }
-    if (lowest >= distanceTable.getDistance(pos)) {
+    if (lowest >= getDistance(pos)) {
       if (reversed)
         break;
       else
-        FATAL << "can't track path " << lowest << " " << distanceTable.getDistance(pos) << " " << origPos
+        FATAL << "can't track path " << lowest << " " << getDistance(pos) << " " << origPos
             << " " << target << " " << pos << " " << next;
     }
     ret.push_back(pos);
@@ -220,6 +227,39 @@ void ShortestPath::constructPath(Vec2 pos, function<vector<Vec2>(Vec2)> directio
   path = ret.reverse();
 }
 
+bool ShortestPath::repair(Vec2 pos, function<bool(Vec2)> isBlocked, function<double(Vec2)> entryFun,
+    function<vector<Vec2>(Vec2)> directions) {
+  PROFILE;
+  if (reversed || !isReachable(pos))
+    return false;
+  int start = pos == path.back() ? path.size() - 1 : path.size() - 2;
+  optional<int> blocked;
+  for (int i = start - 1; i >= max(0, start - repairLookahead); --i)
+    if (isBlocked(path[i])) {
+      blocked = i;
+      break;
+    }
+  if (!blocked)
+    return true;
+  int rejoin = *blocked;
+  while (rejoin > 0 && isBlocked(path[rejoin]))
+    --rejoin;
+  if (isBlocked(path[rejoin]))
+    return false;
+  Vec2 detourStart = path[*blocked + 1];
+  auto area = Rectangle::boundingBox(getSubsequence(path, rejoin, *blocked + 2 - rejoin))
+      .minusMargin(-repairMargin).intersection(bounds);
+  ShortestPath detour(TemplateConstr{}, area, entryFun, [detourStart](Vec2 v) { return detourStart.dist8(v); },
+      directions, path[rejoin], detourStart);
+  if (!detour.isReachable(detourStart))
+    return false;
+  vector<Vec2> newPath = getSubsequence(path, 0, rejoin);
+  newPath.append(detour.path);
+  newPath.append(getSubsequence(path, *blocked + 2, path.size() - *blocked - 2));
+  path = std::move(newPath);
+  return true;
+}
+
 bool ShortestPath::isReversed() const {
   return reversed;
 }
@@ -253,16 +293,13 @@ Vec2 ShortestPath::getTarget() const {
   return target;
 }
 
-ShortestPath LevelShortestPath::makeShortestPath(const Creature* creature, Position to, double mult, vector<Vec2>* visited) {
-  PROFILE;
+static auto getEntryFun(const Creature* creature, vector<Vec2>* visited) {
   auto from = creature->getPosition();
   WLevel level = from.getLevel();
-  Rectangle bounds = level->getBounds();
-  CHECK(to.isSameLevel(from));
   auto movementType = creature->getMovementType();
   auto& sectors = level->getSectors(movementType);
   auto& movementSectors = level->getSectors(copyOf(movementType).setCanBuildBridge(false).setDestroyActions({}));
-  auto entryFun = [=, &sectors, &movementSectors, fromCoord = from.getCoord()](Vec2 v) {
+  return [=, &sectors, &movementSectors, fromCoord = from.getCoord()](Vec2 v) {
     PROFILE_BLOCK("entry fun");
     if (visited)
       visited->push_back(v);
@@ -272,7 +309,10 @@ ShortestPath LevelShortestPath::makeShortestPath(const Creature* creature, Posit
       return ShortestPath::infinity;
     return Position(v, level, Position::IsValid{}).getNavigationCost(movementType, movementSectors);
   };
-  auto directionsFun = [=] (Vec2 v) {
+}
+
+static auto getDirectionsFun(WLevel level) {
+  return [=] (Vec2 v) {
     Position pos(v, level);
     vector<Vec2> ret = Vec2::directions8();
     if (auto f = pos.getFurniture(FurnitureLayer::MIDDLE))
@@ -283,9 +323,60 @@ ShortestPath LevelShortestPath::makeShortestPath(const Creature* creature, Posit
               ret.push_back(otherPos->getCoord() - v);
     return ret;
   };
+}
+
+// Shared between creatures, so the penalty for tiles occupied by creatures is skipped.
+static auto getSharedEntryFun(WLevel level, const MovementType& movementType) {
+  auto& sectors = level->getSectors(movementType);
+  auto& movementSectors = level->getSectors(copyOf(movementType).setCanBuildBridge(false).setDestroyActions({}));
+  return [&sectors, &movementSectors, level, movementType](Vec2 v) -> float {
+    if (!sectors.contains(v))
+      return FlowFieldCache::infinity;
+    return Position(v, level, Position::IsValid{}).getNavigationCostIgnoringCreatures(movementType,
+        movementSectors);
+  };
+}
+
+void LevelShortestPath::updateFlowFields(Position pos) {
+  WLevel level = pos.getLevel();
+  level->getFlowFieldCache().update(pos.getCoord(),
+      [level](const MovementType& movement, Vec2 v) { return getSharedEntryFun(level, movement)(v); },
+      getDirectionsFun(level));
+}
+
+ShortestPath LevelShortestPath::makeShortestPath(const Creature* creature, Position to, double mult, vector<Vec2>* visited) {
+  PROFILE;
+  auto from = creature->getPosition();
+  WLevel level = from.getLevel();
+  Rectangle bounds = level->getBounds();
+  CHECK(to.isSameLevel(from));
+  auto movementType = creature->getMovementType();
+  auto& sectors = level->getSectors(movementType);
+  auto& movementSectors = level->getSectors(copyOf(movementType).setCanBuildBridge(false).setDestroyActions({}));
+  auto entryFun = getEntryFun(creature, visited);
+  auto directionsFun = getDirectionsFun(level);
   CHECK(to.getCoord().inRectangle(level->getBounds()));
   CHECK(from.getCoord().inRectangle(level->getBounds()));
   if (mult == 0) {
+    if (!visited)
+      if (auto field = level->getFlowFieldCache().get(movementType, to.getCoord(), [&] {
+            return FlowFieldCache::compute(bounds, to.getCoord(), getSharedEntryFun(level, movementType),
+                directionsFun); }))
+        if (field->distance[from.getCoord()] < FlowFieldCache::infinity)
+          return ShortestPath(ShortestPath::FromDistances{}, bounds,
+              [field](Vec2 v) -> double { return field->distance[v]; }, directionsFun, to.getCoord(), from.getCoord());
+    auto isConnected = [&sectors, bounds, from = from.getCoord()] (Vec2 to) {
+      if (sectors.same(from, to))
+        return true;
+      for (Vec2 v : to.neighbors8())
+        if (v.inRectangle(bounds) && sectors.same(from, v))
+          return true;
+      return false;
+    };
+    if (!from.getDistanceToNearestPortal() && isConnected(to.getCoord()))
+      if (auto waypoint = level->getClusterGraph(movementType).getWaypoint(sectors, from.getCoord(), to.getCoord(),
+          clusterRefinementRange))
+        to = Position(*waypoint, level);
     auto dist1 = from.getDistanceToNearestPortal().value_or(10000);
     auto lengthFun = [level, from = from.getCoord(), dist1](Vec2 to) {
       PROFILE_BLOCK("length fun");
@@ -304,12 +395,33 @@ ShortestPath LevelShortestPath::makeShortestPath(const Creature* creature, Posit
   }
 }
 
-SERIALIZE_DEF(LevelShortestPath, path, level)
+SERIALIZE_DEF(LevelShortestPath, path, level, target, numRepairs)
 SERIALIZATION_CONSTRUCTOR_IMPL(LevelShortestPath);
 
 
 LevelShortestPath::LevelShortestPath(const Creature* creature, Position to, double mult, vector<Vec2>* visited)
-    : path(makeShortestPath(creature, to, mult, visited)), level(to.getLevel()) {
+    : path(makeShortestPath(creature, to, mult, visited)), level(to.getLevel()), target(to.getCoord()) {
+}
+
+bool LevelShortestPath::repair(const Creature* creature, optional<Position> blocked) {
+  auto pos = creature->getPosition();
+  if (pos.getLevel() != level)
+    return false;
+  if (!blocked && ++numRepairs >= replanInterval)
+    return false;
+  auto& sectors = level->getSectors(creature->getMovementType());
+  auto isBlocked = [&](Vec2 v) { return (blocked && blocked->getCoord() == v) || !sectors.contains(v); };
+  // Only needed if a detour has to be searched.
+  optional<decltype(getEntryFun(creature, nullptr))> entryFun;
+  return path.repair(pos.getCoord(), isBlocked,
+      [&](Vec2 v) {
+        if (isBlocked(v))
+          return ShortestPath::infinity;
+        if (!entryFun)
+          entryFun.emplace(getEntryFun(creature, nullptr));
+        return (*entryFun)(v);
+      },
+      getDirectionsFun(level));
 }
 
 WLevel LevelShortestPath::getLevel() const {
@@ -340,95 +452,104 @@ optional<Position> LevelShortestPath::getNextNextMove(Position pos) {
 }
 
 Position LevelShortestPath::getTarget() const {
-  return Position(path.getTarget(), level);
+  return Position(target, level);
 }
 
 bool LevelShortestPath::isReversed() const {
   return path.isReversed();
 }
 
+// Scratch tables shared by the searches below, so that a search doesn't allocate a table over its whole bounds.
+static thread_local DistanceTable dijkstraDistance(Level::getMaxBounds());
+static thread_local DirtyTable<bool> bfSearchVisited(Level::getMaxBounds(), false);
+
 Dijkstra::Dijkstra(Rectangle bounds, vector<Vec2> from, int maxDist, function<double(Vec2)> entryFun,
-      vector<Vec2> directions) {
-  distanceTable.clear();
-  auto comparator = [](Vec2 pos1, Vec2 pos2) {
-      double diff = distanceTable.getDistance(pos1) - distanceTable.getDistance(pos2);
-      if (diff > 0 || (diff == 0 && pos1 < pos2))
-        return 1;
-      else
-        return 0;};
-  priority_queue<Vec2, vector<Vec2>, decltype(comparator)> q(comparator) ;
+      vector<Vec2> directions) : bounds(bounds) {
+  unique_ptr<DistanceTable> ownTable;
+  if (!dijkstraDistance.getBounds().contains(bounds))
+    ownTable = unique<DistanceTable>(bounds);
+  auto& distance = ownTable ? *ownTable : dijkstraDistance;
+  distance.clear();
+  priority_queue<QueueElem, vector<QueueElem>> q;
   for (auto& v : from) {
-    distanceTable.setDistance(v, 0);
-    q.push(v);
+    distance.setDistance(v, 0);
+    q.push({v, 0});
   }
-  int numPopped = 0;
   while (!q.empty()) {
-    ++numPopped;
-    Vec2 pos = q.top();
-    double cdist = distanceTable.getDistance(pos);
+    auto elem = q.top();
+    Vec2 pos = elem.pos;
+    double cdist = distance.getDistance(pos);
     if (cdist > maxDist)
       return;
     q.pop();
-    CHECK(!reachable.count(pos));
-    reachable[pos] = cdist;
+    if (elem.value > cdist)
+      continue;
+    reachable.push_back(make_pair(pos, cdist));
     for (Vec2 dir : directions) {
       Vec2 next = pos + dir;
       if (next.inRectangle(bounds)) {
-        double ndist = distanceTable.getDistance(next);
+        double ndist = distance.getDistance(next);
         if (cdist < ndist) {
           double dist = cdist + entryFun(next);
           CHECK(dist > cdist) << "Entry fun non positive " << dist - cdist;
           if (dist < ndist && dist <= maxDist) {
-            distanceTable.setDistance(next, dist);
-            q.push(next);
+            distance.setDistance(next, dist);
+            q.push({next, dist});
           }
         }
       }
     }
   }
-
 }
 
 bool Dijkstra::isReachable(Vec2 pos) const {
-  return reachable.count(pos);
+  if (!pos.inRectangle(bounds))
+    return false;
+  if (distances.empty())
+    for (auto& elem : reachable)
+      distances[elem.first] = elem.second;
+  return distances.count(pos);
 }
 
 double Dijkstra::getDist(Vec2 v) const {
-  return reachable.at(v);
+  CHECK(isReachable(v));
+  return distances.at(v);
 }
 
-const map<Vec2, double>& Dijkstra::getAllReachable() const {
+const vector<pair<Vec2, double>>& Dijkstra::getAllReachable() const {
   return reachable;
 }
 
-BfSearch::BfSearch(Rectangle bounds, Vec2 from, function<bool(Vec2)> entryFun, vector<Vec2> directions) {
-  distanceTable.clear();
-  queue<Vec2> q;
-  distanceTable.setDistance(from, 0);
-  q.push(from);
-  int numPopped = 0;
-  while (!q.empty()) {
-    ++numPopped;
-    Vec2 pos = q.front();
-    q.pop();
-    CHECK(!reachable.count(pos));
-    reachable.insert(pos);
+BfSearch::BfSearch(Rectangle bounds, Vec2 from, function<bool(Vec2)> entryFun, vector<Vec2> directions)
+    : bounds(bounds) {
+  unique_ptr<DirtyTable<bool>> ownTable;
+  if (!bfSearchVisited.getBounds().contains(bounds))
+    ownTable = unique<DirtyTable<bool>>(bounds, false);
+  auto& visited = ownTable ? *ownTable : bfSearchVisited;
+  visited.clear();
+  visited.setValue(from, true);
+  reachable.push_back(from);
+  for (int i = 0; i < reachable.size(); ++i) {
+    Vec2 pos = reachable[i];
     for (Vec2 dir : directions) {
       Vec2 next = pos + dir;
-      if (next.inRectangle(bounds) && distanceTable.getDistance(next) == ShortestPath::infinity && entryFun(next)) {
-        distanceTable.setDistance(next, 0);
-        q.push(next);
+      if (next.inRectangle(bounds) && !visited.isDirty(next) && entryFun(next)) {
+        visited.setValue(next, true);
+        reachable.push_back(next);
       }
     }
   }
-
 }
 
 bool BfSearch::isReachable(Vec2 pos) const {
-  return reachable.count(pos);
+  if (!pos.inRectangle(bounds))
+    return false;
+  if (reachableSet.empty())
+    reachableSet = unordered_set<Vec2, CustomHash<Vec2>>(reachable.begin(), reachable.end());
+  return reachableSet.count(pos);
 }
 
-const set<Vec2>& BfSearch::getAllReachable() const {
+const vector<Vec2>& BfSearch::getAllReachable() const {
   return reachable;
 }
 
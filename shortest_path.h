@@ -23,6 +23,35 @@
 class Creature;
 class Level;
 
+class DistanceTable {
+  public:
+  DistanceTable(Rectangle bounds);
+
+  double getDistance(Vec2 v) const {
+    return dirty[v] < counter ? infinity : ddist[v];
+  }
+
+  void setDistance(Vec2 v, double d) {
+    ddist[v] = d;
+    dirty[v] = counter;
+  }
+
+  void clear() {
+    ++counter;
+  }
+
+  const Rectangle& getBounds() const {
+    return ddist.getBounds();
+  }
+
+  static const double infinity;
+
+  private:
+  Table<double> ddist;
+  Table<int> dirty;
+  int counter = 1;
+};
+
 class ShortestPath {
   public:
   ShortestPath(
@@ -47,6 +76,11 @@ class ShortestPath {
       Vec2 target,
       Vec2 from,
       double mult = 0);
+
+  /** Follows a precomputed field of distances to \paramname{target} instead of searching.*/
+  struct FromDistances {};
+  ShortestPath(FromDistances, Rectangle area, function<double(Vec2)> distanceFun,
+      function<vector<Vec2>(Vec2)> directions, Vec2 target, Vec2 from);
   bool isReachable(Vec2 pos) const;
   Vec2 getNextMove(Vec2 pos);
   optional<Vec2> getNextNextMove(Vec2 pos);
@@ -54,6 +88,12 @@ class ShortestPath {
   bool isReversed() const;
   const vector<Vec2>& getPath() const;
 
+  /** Replaces the first blocked part of the next few steps of the path with a detour found by a search limited
+      to its surroundings. \paramname{entryFun} is only called for the detour search. Returns false if no such
+      detour exists and the path needs to be recalculated.*/
+  bool repair(Vec2 pos, function<bool(Vec2)> isBlocked, function<double(Vec2)> entryFun,
+      function<vector<Vec2>(Vec2)> directions);
+
   static const double infinity;
 
   SERIALIZATION_DECL(ShortestPath)
@@ -63,7 +103,8 @@ class ShortestPath {
   void init(EntryFun entryFun, LengthFun lengthFun, DirectionsFun directions,
       Vec2 target, optional<Vec2> from, optional<int> limit = none);
   void reverse(function<double(Vec2)> entryFun, function<double(Vec2)> lengthFun, function<vector<Vec2>(Vec2)> directions, double mult, Vec2 from, int limit);
-  void constructPath(Vec2 start, function<vector<Vec2>(Vec2)> directions, bool reversed = false);
+  template <typename DistanceFun>
+  void constructPath(Vec2 start, DistanceFun, function<vector<Vec2>(Vec2)> directions, bool reversed = false);
   vector<Vec2> SERIAL(path);
   Vec2 SERIAL(target);
   Rectangle SERIAL(bounds);
@@ -81,6 +122,14 @@ class LevelShortestPath {
   WLevel getLevel() const;
   vector<Position> getPath() const;
 
+  /** Patches the path if tiles ahead of the creature, or \paramname{blocked}, can't be entered anymore.
+      Returns false if the path has to be recalculated, which is also requested every few calls without
+      \paramname{blocked}, so that paths don't miss new shortcuts.*/
+  bool repair(const Creature*, optional<Position> blocked = none);
+
+  /** Patches or drops the level's shared distance fields after the tile's navigation cost may have changed.*/
+  static void updateFlowFields(Position);
+
   static const double infinity;
 
   SERIALIZATION_DECL(LevelShortestPath)
@@ -89,6 +138,9 @@ class LevelShortestPath {
   static ShortestPath makeShortestPath(const Creature* creature, Position to, double mult, vector<Vec2>* visited);
   ShortestPath SERIAL(path);
   WLevel SERIAL(level) = nullptr;
+  // Differs from the target of path if only the first part of a long path was computed.
+  Vec2 SERIAL(target);
+  int SERIAL(numRepairs) = 0;
 };
 
 class Dijkstra {
@@ -97,19 +149,25 @@ class Dijkstra {
       vector<Vec2> directions = Vec2::directions8());
   bool isReachable(Vec2) const;
   double getDist(Vec2) const;
-  const map<Vec2, double>& getAllReachable() const;
+  const vector<pair<Vec2, double>>& getAllReachable() const;
 
   private:
-  map<Vec2, double> reachable;
+  Rectangle bounds;
+  vector<pair<Vec2, double>> reachable;
+  // Built from reachable on the first query.
+  mutable unordered_map<Vec2, double, CustomHash<Vec2>> distances;
 };
 
 class BfSearch {
   public:
   BfSearch(Rectangle bounds, Vec2 from, function<bool(Vec2)> entryFun, vector<Vec2> directions = Vec2::directions8());
   bool isReachable(Vec2) const;
-  const set<Vec2>& getAllReachable() const;
+  const vector<Vec2>& getAllReachable() const;
 
   private:
-  set<Vec2> reachable;
+  Rectangle bounds;
+  vector<Vec2> reachable;
+  // Built from reachable on the first query.
+  mutable unordered_set<Vec2, CustomHash<Vec2>> reachableSet;
 };
 
@@ -32,6 +32,8 @@ static int getTableNum(const FilePath& path) {
 }
 
 Table<char> SokobanInput::getNext() {
+  // Sites may be generated in parallel.
+  std::lock_guard<std::mutex> lock(mutex);
   ifstream input(levelsPath.getPath());
   CHECK(input) << "Failed to load sokoban data from " << levelsPath;
   vector<Table<char>> rest;
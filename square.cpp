@@ -30,6 +30,7 @@
 #include "view.h"
 #include "game_event.h"
 #include "fire.h"
+#include "model.h"
 
 template <class Archive> 
 void Square::serialize(Archive& ar, const unsigned int version) { 
@@ -84,7 +85,10 @@ void Square::tick(Position pos) {
   PROFILE_BLOCK("Square::tick");
   setDirty(pos);
   if (!inventory->isEmpty()) {
+    int numItems = inventory->size();
     inventory->tick(pos);
+    if (inventory->size() != numItems)
+      onItemsChanged(pos);
     if (!pos.canEnterEmpty(MovementType(MovementTrait::WALK).setForced()))
       for (auto neighbor : pos.neighbors8(Random))
         if (neighbor.canEnterEmpty({MovementTrait::WALK})) {
@@ -167,6 +171,7 @@ void Square::dropItems(Position pos, vector<PItem> items) {
   setDirty(pos);
   pos.getLevel()->addTickingSquare(pos.getCoord());
   dropItemsLevelGen(std::move(items));
+  onItemsChanged(pos);
 }
 
 Creature* Square::getCreature() const {
@@ -190,12 +195,16 @@ Item* Square::getTopItem() const {
 
 PItem Square::removeItem(Position pos, Item* it) {
   setDirty(pos);
-  return getInventory().removeItem(it);
+  auto ret = getInventory().removeItem(it);
+  onItemsChanged(pos);
+  return ret;
 }
 
 vector<PItem> Square::removeItems(Position pos, vector<Item*> it) {
   setDirty(pos);
-  return getInventory().removeItems(it);
+  auto ret = getInventory().removeItems(it);
+  onItemsChanged(pos);
+  return ret;
 }
 
 void Square::setDirty(Position pos) {
@@ -203,6 +212,11 @@ void Square::setDirty(Position pos) {
   lastViewer.reset();
 }
 
+void Square::onItemsChanged(Position pos) {
+  if (auto model = pos.getModel())
+    model->onItemsChanged(pos);
+}
+
 void Square::forbidMovementForTribe(Position pos, TribeId tribe) {
   CHECK(!forbiddenTribe || forbiddenTribe == tribe);
   forbiddenTribe = tribe;
@@ -233,6 +247,7 @@ const Inventory& Square::getInventory() const {
   return *inventory;
 }
 
-void Square::clearItemIndex(ItemIndex index) {
+void Square::clearItemIndex(Position pos, ItemIndex index) {
   inventory->clearIndex(index);
+  onItemsChanged(pos);
 }
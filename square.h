@@ -93,7 +93,7 @@ class Square : public OwnedObject<Square> {
   bool needsMemoryUpdate() const;
   void setMemoryUpdated();
 
-  void clearItemIndex(ItemIndex);
+  void clearItemIndex(Position, ItemIndex);
   void setDirty(Position);
 
   Inventory& getInventory();
@@ -104,6 +104,7 @@ class Square : public OwnedObject<Square> {
 
   private:
   Item* getTopItem() const;
+  void onItemsChanged(Position);
   HeapAllocated<Inventory> SERIAL(inventory);
   Creature* SERIAL(creature) = nullptr;
   optional<StairKey> SERIAL(landingLink);
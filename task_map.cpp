@@ -3,8 +3,16 @@
 #include "creature.h"
 #include "task.h"
 #include "creature_name.h"
+#include "level.h"
 
-SERIALIZE_DEF(TaskMap, tasks, positionMap, reversePositions, taskByCreature, creatureByTask, marked, completionCost, priorityTasks, delayedTasks, highlight, taskById, taskByActivity, activityByTask);
+template <class Archive>
+void TaskMap::serialize(Archive& ar, const unsigned int) {
+  ar(tasks, positionMap, reversePositions, taskByCreature, creatureByTask, marked, completionCost, priorityTasks, delayedTasks, highlight, taskById, taskByActivity, activityByTask);
+  if (Archive::is_loading::value)
+    rebuildIndex();
+}
+
+SERIALIZABLE(TaskMap);
 
 SERIALIZATION_CONSTRUCTOR_IMPL(TaskMap);
 
@@ -14,21 +22,14 @@ void TaskMap::clearFinishedTasks() {
       removeTask(t);
 }
 
+constexpr int bucketSize = 8;
+
+static Vec2 getBucket(Vec2 pos) {
+  return pos / bucketSize;
+}
+
 WTask TaskMap::getClosestTask(const Creature* c, MinionActivity activity, bool priorityOnly) const {
   PROFILE;
-  WTask closest = nullptr;
-  auto isBetter = [&](WTask task, optional<int> dist) {
-    PROFILE_BLOCK("isBetter");
-    if (!closest)
-      return true;
-    bool pTask = isPriorityTask(task);
-    bool pClosest = isPriorityTask(closest);
-    if (pTask && !pClosest)
-      return true;
-    if (!pTask && pClosest)
-      return false;
-    return dist.value_or(10000) < getPosition(closest)->dist8(c->getPosition()).value_or(10000);
-  };
   optional<StorageId> storageDropTask;
   for (auto& task : taskByActivity[activity])
     if (auto id = task->getStorageId(true))
@@ -36,8 +37,20 @@ WTask TaskMap::getClosestTask(const Creature* c, MinionActivity activity, bool p
         storageDropTask = *id;
         break;
       }
-  for (auto& task : taskByActivity[activity])
-    if (task->canPerform(c) && (!priorityOnly || isPriorityTask(task)) &&
+  if (!priorityTasks.empty())
+    if (auto task = getClosestTask(c, activity, storageDropTask, true))
+      return task;
+  if (priorityOnly)
+    return nullptr;
+  return getClosestTask(c, activity, storageDropTask, false);
+}
+
+WTask TaskMap::getClosestTask(const Creature* c, MinionActivity activity, optional<StorageId> storageDropTask,
+    bool priority) const {
+  WTask closest = nullptr;
+  int closestDist = 10000;
+  auto tryTask = [&](WTask task) {
+    if (isPriorityTask(task) == priority && task->canPerform(c) &&
         (!storageDropTask || storageDropTask == task->getStorageId(false)))
       if (auto pos = getPosition(task)) {
         PROFILE_BLOCK("Task check");
@@ -46,12 +59,48 @@ WTask TaskMap::getClosestTask(const Creature* c, MinionActivity activity, bool p
         auto delayed = delayedTasks.getMaybe(task);
         if (!task->isDone() &&
             (!owner || (task->canTransfer() && dist && pos->dist8(owner->getPosition()).value_or(10000) > *dist && *dist <= 6)) &&
-            isBetter(task, dist) &&
+            (!closest || dist.value_or(10000) < closestDist) &&
             c->canNavigateToOrNeighbor(*pos) &&
             (!delayed || *delayed < *c->getLocalTime())) {
           closest = task;
+          closestDist = dist.value_or(10000);
+        }
+      }
+  };
+  auto position = c->getPosition();
+  if (auto levelBuckets = getReferenceMaybe(taskBuckets[activity], position.getLevel())) {
+    // Visits rings of buckets around the creature until they are too far to contain a closer task.
+    auto& buckets = levelBuckets->buckets;
+    Vec2 center = getBucket(position.getCoord());
+    int numVisited = 0;
+    auto visit = [&](Vec2 bucket) {
+      if (bucket.inRectangle(buckets.getBounds()))
+        for (WTask task : buckets[bucket]) {
+          ++numVisited;
+          tryTask(task);
+        }
+    };
+    for (int radius = 0; numVisited < levelBuckets->numTasks; ++radius) {
+      if (closest && (radius - 1) * bucketSize + 1 > closestDist)
+        break;
+      if (radius == 0)
+        visit(center);
+      for (int i = -radius; i <= radius && radius > 0; ++i) {
+        visit(center + Vec2(i, -radius));
+        visit(center + Vec2(i, radius));
+        if (abs(i) < radius) {
+          visit(center + Vec2(-radius, i));
+          visit(center + Vec2(radius, i));
         }
       }
+    }
+  }
+  // Tasks on other levels are only chosen if there is nothing on the creature's level.
+  if (!closest)
+    for (WTask task : taskByActivity[activity])
+      if (auto pos = getPosition(task))
+        if (pos->getLevel() != position.getLevel())
+          tryTask(task);
   return closest;
 }
 
@@ -67,6 +116,7 @@ void TaskMap::setPriorityTasks(Position pos) {
 
 WTask TaskMap::addTaskCost(PTask task, Position position, CostInfo cost, MinionActivity activity) {
   completionCost.set(task.get(), cost);
+  paidTasks[cost.id].insert(task.get());
   return addTask(std::move(task), position, activity);
 }
 
@@ -77,6 +127,7 @@ CostInfo TaskMap::removeTask(WTask task) {
   if (auto c = completionCost.getMaybe(task)) {
     cost = *c;
     completionCost.erase(task);
+    paidTasks[cost.id].erase(task);
   }
   if (auto pos = getPosition(task)) {
     marked.erase(*pos);
@@ -88,6 +139,7 @@ CostInfo TaskMap::removeTask(WTask task) {
     creatureByTask.erase(task);
   }
   CHECK(taskByCreature.getSize() == creatureByTask.getSize());
+  removeFromIndex(task);
   if (auto pos = positionMap.getMaybe(task)) {
     CHECK(reversePositions.count(*pos)) << "Task position not found: " <<
         task->getDescription() << " " << pos->getCoord();
@@ -96,25 +148,73 @@ CostInfo TaskMap::removeTask(WTask task) {
   }
   if (auto activity = activityByTask.getMaybe(task)) {
     activityByTask.erase(task);
-    taskByActivity[*activity].removeElement(task);
+    auto& activityTasks = taskByActivity[*activity];
+    int index = activityIndex.getOrFail(task);
+    activityTasks.removeIndex(index);
+    if (index < activityTasks.size())
+      activityIndex.set(activityTasks[index], index);
+    activityIndex.erase(task);
+  }
+  if (auto index = taskIndex.getMaybe(task)) {
+    taskById.erase(task);
+    taskIndex.erase(task);
+    tasks.removeIndex(*index);
+    if (*index < tasks.size())
+      taskIndex.set(tasks[*index].get(), *index);
   }
-  for (int i : All(tasks))
-    if (tasks[i].get() == task) {
-      taskById.erase(task);
-      tasks.removeIndex(i);
-      break;
-    }
   return cost;
 }
 
 CostInfo TaskMap::removeTask(UniqueEntity<Task>::Id id) {
-  for (PTask& task : tasks)
-    if (task->getUniqueId() == id) {
-      return removeTask(task.get());
-    }
+  if (auto task = taskById.getMaybe(id))
+    return removeTask(*task);
   return CostInfo();
 }
 
+void TaskMap::addToIndex(WTask task) {
+  if (auto activity = activityByTask.getMaybe(task))
+    if (auto pos = getPosition(task)) {
+      auto level = pos->getLevel();
+      auto& levels = taskBuckets[*activity];
+      if (!levels.count(level)) {
+        // Levels may still be loading at this point, so their actual bounds can't be used.
+        auto bounds = Level::getMaxBounds();
+        levels.insert(make_pair(level, TaskBuckets{Table<vector<WTask>>(
+            (bounds.right() + bucketSize - 1) / bucketSize, (bounds.bottom() + bucketSize - 1) / bucketSize), 0}));
+      }
+      auto& buckets = levels.at(level);
+      buckets.buckets[getBucket(pos->getCoord())].push_back(task);
+      ++buckets.numTasks;
+    }
+}
+
+void TaskMap::removeFromIndex(WTask task) {
+  if (auto activity = activityByTask.getMaybe(task))
+    if (auto pos = getPosition(task)) {
+      auto& buckets = taskBuckets[*activity].at(pos->getLevel());
+      buckets.buckets[getBucket(pos->getCoord())].removeElement(task);
+      --buckets.numTasks;
+    }
+}
+
+void TaskMap::rebuildIndex() {
+  taskIndex.clear();
+  activityIndex.clear();
+  taskBuckets.clear();
+  paidTasks.clear();
+  for (auto& elem : completionCost)
+    paidTasks[elem.second.id].insert(elem.first);
+  for (int i : All(tasks))
+    taskIndex.set(tasks[i].get(), i);
+  for (auto activity : ENUM_ALL(MinionActivity)) {
+    auto& activityTasks = taskByActivity[activity];
+    for (int i : All(activityTasks)) {
+      activityIndex.set(activityTasks[i], i);
+      addToIndex(activityTasks[i]);
+    }
+  }
+}
+
 bool TaskMap::isPriorityTask(WConstTask t) const {
   PROFILE;
   return priorityTasks.contains(t);
@@ -181,6 +281,7 @@ WTask TaskMap::addTaskFor(PTask task, Creature* c) {
   if (auto pos = task->getPosition())
     setPosition(task.get(), *pos);
   taskById.set(task->getUniqueId(), task.get());
+  taskIndex.set(task.get(), tasks.size());
   tasks.push_back(std::move(task));
   return tasks.back().get();
 }
@@ -188,8 +289,11 @@ WTask TaskMap::addTaskFor(PTask task, Creature* c) {
 WTask TaskMap::addTask(PTask task, Position position, MinionActivity activity) {
   setPosition(task.get(), position);
   taskById.set(task.get(), task.get());
+  activityIndex.set(task.get(), taskByActivity[activity].size());
   taskByActivity[activity].push_back(task.get());
   activityByTask.set(task.get(), activity);
+  addToIndex(task.get());
+  taskIndex.set(task.get(), tasks.size());
   tasks.push_back(std::move(task));
   return tasks.back().get();
 }
@@ -246,6 +350,15 @@ const EntityMap<Task, CostInfo>& TaskMap::getCompletionCosts() const {
   return completionCost;
 }
 
+int TaskMap::getUnfinishedCost(CollectiveResourceId id) const {
+  int ret = 0;
+  // A task can become done without notice, so it has to be checked here.
+  for (auto task : paidTasks[id])
+    if (!taskById.getOrFail(task)->isDone())
+      ret += completionCost.getOrFail(task).value;
+  return ret;
+}
+
 WTask TaskMap::getTask(UniqueEntity<Task>::Id id) const {
   return taskById.getOrFail(id);
 }
@@ -8,9 +8,11 @@
 #include "minion_trait.h"
 #include "game_time.h"
 #include "minion_activity.h"
+#include "resource_id.h"
 
 class Task;
 class Creature;
+class Level;
 
 class TaskMap {
   public:
@@ -38,6 +40,8 @@ class TaskMap {
   void setPriorityTasks(Position);
   WTask getClosestTask(const Creature*, MinionActivity, bool priorityOnly) const;
   const EntityMap<Task, CostInfo>& getCompletionCosts() const;
+  /** Returns the total cost of the tasks paid with the resource that aren't done yet.*/
+  int getUnfinishedCost(CollectiveResourceId) const;
   WTask getTask(UniqueEntity<Task>::Id) const;
   void clearFinishedTasks();
 
@@ -57,5 +61,20 @@ class TaskMap {
   EntitySet<Task> SERIAL(priorityTasks);
   EnumMap<MinionActivity, vector<WTask>> SERIAL(taskByActivity);
   EntityMap<Task, MinionActivity> SERIAL(activityByTask);
+  // Indexes of tasks in tasks and taskByActivity, so that removing them doesn't need a search.
+  EntityMap<Task, int> taskIndex;
+  EntityMap<Task, int> activityIndex;
+  // Tasks with a completion cost, grouped by the resource.
+  EnumMap<CollectiveResourceId, EntitySet<Task>> paidTasks;
+  // Tasks of each activity grouped into square blocks of their levels, to look for the closest task first.
+  struct TaskBuckets {
+    Table<vector<WTask>> buckets;
+    int numTasks;
+  };
+  EnumMap<MinionActivity, unordered_map<Level*, TaskBuckets>> taskBuckets;
+  void addToIndex(WTask);
+  void removeFromIndex(WTask);
+  void rebuildIndex();
+  WTask getClosestTask(const Creature*, MinionActivity, optional<StorageId> storageDropTask, bool priority) const;
 };
 
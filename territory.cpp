@@ -16,6 +16,7 @@ void Territory::insert(Position pos) {
     allSquaresVec.push_back(pos);
     allSquares.insert(pos);
     clearCache();
+    pos.setNeedsRenderUpdate(true);
   }
 }
 
@@ -23,6 +24,7 @@ void Territory::remove(Position pos) {
   allSquaresVec.removeElement(pos);
   allSquares.erase(pos);
   clearCache();
+  pos.setNeedsRenderUpdate(true);
 }
 
 void Territory::setCentralPoint(Position pos) {
@@ -21,6 +21,15 @@
 #include "level_maker.h"
 #include "test.h"
 #include "sectors.h"
+#include "cluster_graph.h"
+#include "flow_field_cache.h"
+#include "field_of_view.h"
+#include "job_pool.h"
+#include "view_id.h"
+#include "dummy_view.h"
+#include "clock.h"
+#include "compressed_stream.h"
+#include "gzstream.h"
 #include "minion_equipment.h"
 #include "item_factory.h"
 #include "item_type.h"
@@ -44,6 +53,16 @@
 #include "name_generator.h"
 #include "lasting_effect.h"
 #include "test_struct.h"
+#include "task_map.h"
+#include "task.h"
+#include "entity_map.h"
+#include "entity_set.h"
+#include "time_queue.h"
+#include "controller.h"
+#include "fx_manager.h"
+#include "fx_defs.h"
+#include "creature_attributes.h"
+#include "item_ledger.h"
 
 class Test {
   public:
@@ -171,6 +190,82 @@ class Test {
     CHECK(res == expected);
   }
 
+  void testShortestPathRepair() {
+    Table<double> table(Rectangle(20, 10), 1);
+    auto entryFun = [&table](Vec2 pos) { return table[pos]; };
+    auto isBlocked = [&table](Vec2 pos) { return table[pos] >= ShortestPath::infinity; };
+    ShortestPath path(Rectangle(20, 10), entryFun, [] (Vec2 to) { return Vec2(0, 5).dist8(to); },
+        Vec2::directions8(), Vec2(19, 5), Vec2(0, 5));
+    CHECKEQ(path.getPath().size(), 20);
+    CHECK(path.repair(Vec2(0, 5), isBlocked, entryFun, [](Vec2) { return Vec2::directions8(); }));
+    CHECKEQ(path.getPath().size(), 20);
+    for (int y : Range(1, 10))
+      table[Vec2(10, y)] = ShortestPath::infinity;
+    vector<Vec2> res {Vec2(0, 5)};
+    while (res.back() != Vec2(19, 5)) {
+      CHECK(path.repair(res.back(), isBlocked, entryFun, [](Vec2) { return Vec2::directions8(); }));
+      res.push_back(path.getNextMove(res.back()));
+      CHECK(res.back().dist8(res[res.size() - 2]) == 1);
+      CHECK(table[res.back()] == 1);
+    }
+    CHECK(res.contains(Vec2(10, 0)));
+    ShortestPath path2(Rectangle(20, 10), entryFun, [] (Vec2 to) { return Vec2(0, 5).dist8(to); },
+        Vec2::directions8(), Vec2(19, 5), Vec2(0, 5));
+    for (int y : Range(0, 10))
+      table[Vec2(15, y)] = ShortestPath::infinity;
+    // Only the next few steps are checked, so the wall is noticed once the creature gets close.
+    CHECK(path2.repair(Vec2(0, 5), isBlocked, entryFun, [](Vec2) { return Vec2::directions8(); }));
+    Vec2 pos(0, 5);
+    while (path2.repair(pos, isBlocked, entryFun, [](Vec2) { return Vec2::directions8(); }))
+      pos = path2.getNextMove(pos);
+    CHECK(pos.x < 15);
+    for (int y : Range(0, 10))
+      table[Vec2(15, y)] = 1;
+    ShortestPath path3(Rectangle(20, 10), entryFun, [] (Vec2 to) { return Vec2(0, 5).dist8(to); },
+        Vec2::directions8(), Vec2(19, 5), Vec2(0, 5));
+    pos = Vec2(0, 5);
+    while (pos.x < 17)
+      pos = path3.getNextMove(pos);
+    CHECK(path3.repair(pos, isBlocked, entryFun, [](Vec2) { return Vec2::directions8(); }));
+    // The target itself is checked too, and there's no detour around it.
+    table[Vec2(19, 5)] = ShortestPath::infinity;
+    CHECK(!path3.repair(pos, isBlocked, entryFun, [](Vec2) { return Vec2::directions8(); }));
+  }
+
+  void testShortestPathOnThreads() {
+    Rectangle bounds(100, 100);
+    Table<double> table(bounds, 1);
+    for (Vec2 v : bounds)
+      if (Random.roll(4))
+        table[v] = ShortestPath::infinity;
+    vector<pair<Vec2, Vec2>> ends;
+    for (int i : Range(30)) {
+      Vec2 from(Random.get(100), Random.get(100));
+      Vec2 to(Random.get(100), Random.get(100));
+      table[from] = table[to] = 1;
+      ends.push_back({from, to});
+    }
+    auto getPaths = [&] {
+      vector<vector<Vec2>> ret;
+      for (auto& elem : ends) {
+        Vec2 from = elem.first;
+        ShortestPath path(bounds, [&table](Vec2 pos) { return table[pos]; },
+            [from] (Vec2 to) { return from.dist8(to); }, Vec2::directions8(), elem.second, from);
+        ret.push_back(path.getPath());
+      }
+      return ret;
+    };
+    auto expected = getPaths();
+    vector<vector<vector<Vec2>>> paths(4);
+    vector<thread> threads;
+    for (int i : Range(4))
+      threads.push_back(makeThread([&, i] { paths[i] = getPaths(); }));
+    for (auto& t : threads)
+      t.join();
+    for (auto& elem : paths)
+      CHECK(elem == expected);
+  }
+
   void testAStar() {
     vector<vector<double> > table { { 1, 1, 6, 1, 1}, { 1, 1, 6, 1, 1}, {1, 1, 1, 1,1}, {1, 1, 6, 1, 1}, {1, 1, 6, 1, 1}};
     ShortestPath path(Rectangle(5, 5),
@@ -202,6 +297,302 @@ class Test {
     CHECK(res == expected);*/
   }
 
+  void testDijkstra() {
+    Rectangle bounds(100, 100);
+    Table<bool> wall(bounds, false);
+    for (int i : Range(1500))
+      wall[bounds.randomVec2()] = true;
+    wall[Vec2(50, 50)] = false;
+    auto entryFun = [&](Vec2 v) { return wall[v] ? ShortestPath::infinity : 1.0; };
+    const int numRuns = 100;
+    auto time1 = steady_clock::now();
+    for (int i : Range(numRuns))
+      Dijkstra(bounds, {Vec2(50, 50)}, 10000, entryFun);
+    auto time2 = steady_clock::now();
+    for (int i : Range(numRuns))
+      BfSearch(bounds, Vec2(50, 50), [&](Vec2 v) { return !wall[v]; });
+    auto time3 = steady_clock::now();
+    INFO << "Dijkstra on 100x100: " << duration_cast<microseconds>(time2 - time1).count() / numRuns << "us, "
+        << "BfSearch: " << duration_cast<microseconds>(time3 - time2).count() / numRuns << "us";
+    Dijkstra dijkstra(bounds, {Vec2(50, 50)}, 10000, entryFun);
+    BfSearch bfSearch(bounds, Vec2(50, 50), [&](Vec2 v) { return !wall[v]; });
+    CHECKEQ(dijkstra.getAllReachable().size(), bfSearch.getAllReachable().size());
+    for (Vec2 v : bounds) {
+      CHECK(dijkstra.isReachable(v) == bfSearch.isReachable(v));
+      if (dijkstra.isReachable(v))
+        CHECK(dijkstra.getDist(v) >= v.dist8(Vec2(50, 50)));
+    }
+    for (auto& elem : dijkstra.getAllReachable())
+      CHECKEQ(dijkstra.getDist(elem.first), elem.second);
+    Dijkstra limited(bounds, {Vec2(50, 50)}, 5, entryFun);
+    for (auto& elem : limited.getAllReachable())
+      CHECK(elem.second <= 5 && elem.first.dist8(Vec2(50, 50)) <= 5);
+    Dijkstra wide(Rectangle(400, 3), {Vec2(0, 1)}, 10000, [](Vec2) { return 1.0; });
+    CHECKEQ(wide.getDist(Vec2(399, 1)), 399);
+    CHECK(!wide.isReachable(Vec2(400, 1)));
+  }
+
+  // Resident memory of the process in kilobytes, or 0 where it can't be read.
+  static long getResidentMemory() {
+    ifstream in("/proc/self/status");
+    string line;
+    while (getline(in, line))
+      if (line.compare(0, 6, "VmRSS:") == 0)
+        return atol(line.c_str() + 6);
+    return 0;
+  }
+
+  void testFieldOfViewCache() {
+    Rectangle bounds(200, 200);
+    Table<bool> blocking(bounds, false);
+    for (int i : Range(6000))
+      blocking[bounds.randomVec2()] = true;
+    long memory1 = getResidentMemory();
+    const int maxCached = 500;
+    FieldOfView bounded(blocking, maxCached);
+    FieldOfView unbounded(blocking, bounds.width() * bounds.height());
+    vector<Vec2> creatures;
+    for (int i : Range(300))
+      creatures.push_back(bounds.randomVec2());
+    const int numTurns = 100;
+    auto time1 = steady_clock::now();
+    for (int turn : Range(numTurns)) {
+      for (auto& pos : creatures) {
+        if (Random.roll(3)) {
+          Vec2 next = pos + Random.choose(Vec2::directions8());
+          if (next.inRectangle(bounds) && !blocking[next])
+            pos = next;
+        }
+        vector<Vec2> tiles = bounded.getVisibleTiles(pos);
+        CHECKEQ(tiles, unbounded.getVisibleTiles(pos));
+        CHECK(bounded.canSee(pos, pos) && unbounded.canSee(pos, pos));
+      }
+      for (int i : Range(5)) {
+        Vec2 v = bounds.randomVec2();
+        blocking[v] = !blocking[v];
+        bounded.squareChanged(v, blocking[v]);
+        unbounded.squareChanged(v, blocking[v]);
+      }
+    }
+    auto time2 = steady_clock::now();
+    long memory2 = getResidentMemory();
+    CHECK(bounded.getNumCached() <= maxCached);
+    FieldOfView fresh(blocking);
+    for (Vec2 pos : creatures)
+      CHECKEQ(vector<Vec2>(bounded.getVisibleTiles(pos)), fresh.getVisibleTiles(pos));
+    auto getHitRate = [](const FieldOfView& fov) {
+      return 100 * fov.getNumHits() / (fov.getNumHits() + fov.getNumMisses());
+    };
+    INFO << "Field of view cache: bounded " << getHitRate(bounded) << "% hits, "
+        << bounded.getMemoryUsage() / 1024 << "KB; unbounded " << getHitRate(unbounded) << "% hits, "
+        << unbounded.getMemoryUsage() / 1024 << "KB with " << unbounded.getNumCached() << " origins; "
+        << duration_cast<microseconds>(time2 - time1).count() / numTurns << "us per turn; resident memory grew by "
+        << memory2 - memory1 << "KB";
+  }
+
+  void testFieldOfViewPrefetch() {
+    Rectangle bounds(200, 200);
+    Table<bool> blocking(bounds, false);
+    for (int i : Range(6000))
+      blocking[bounds.randomVec2()] = true;
+    FieldOfView prefetched(blocking, 500);
+    FieldOfView serial(blocking, 500);
+    JobPool jobPool(4);
+    Vec2 lightSource = bounds.randomVec2();
+    prefetched.setPinned(lightSource, true);
+    vector<Vec2> creatures;
+    for (int i : Range(300))
+      creatures.push_back(bounds.randomVec2());
+    const int numTurns = 50;
+    long long prefetchTime = 0;
+    long long serialTime = 0;
+    for (int turn : Range(numTurns)) {
+      for (auto& pos : creatures)
+        if (Random.roll(3)) {
+          Vec2 next = pos + Random.choose(Vec2::directions8());
+          if (next.inRectangle(bounds) && !blocking[next])
+            pos = next;
+        }
+      auto time1 = steady_clock::now();
+      prefetched.prefetch(creatures, jobPool);
+      auto time2 = steady_clock::now();
+      for (auto& pos : creatures)
+        serial.getVisibleTiles(pos);
+      auto time3 = steady_clock::now();
+      prefetchTime += duration_cast<microseconds>(time2 - time1).count();
+      serialTime += duration_cast<microseconds>(time3 - time2).count();
+      // Prefetched entries never evict pinned ones, such as the fields of view of light sources.
+      if (turn > 0) {
+        int numMisses = prefetched.getNumMisses();
+        prefetched.getVisibleTiles(lightSource);
+        CHECKEQ(prefetched.getNumMisses(), numMisses);
+      }
+      for (int i : Range(20)) {
+        Vec2 v = bounds.randomVec2();
+        blocking[v] = !blocking[v];
+        prefetched.squareChanged(v, blocking[v]);
+        serial.squareChanged(v, blocking[v]);
+        // Moves made after the prefetch see the changed squares.
+        Vec2 pos = Random.choose(creatures);
+        CHECKEQ(vector<Vec2>(prefetched.getVisibleTiles(pos)), serial.getVisibleTiles(pos));
+      }
+      prefetched.getVisibleTiles(lightSource);
+    }
+    FieldOfView fresh(blocking);
+    for (Vec2 pos : creatures)
+      CHECKEQ(vector<Vec2>(prefetched.getVisibleTiles(pos)), fresh.getVisibleTiles(pos));
+    INFO << "Field of view prefetch: " << prefetchTime / numTurns << "us per turn on 4 threads, "
+        << serialTime / numTurns << "us serially";
+  }
+
+  void testFieldOfViewKernels() {
+    Rectangle bounds(100, 80);
+    long long recursiveTime = 0;
+    long long bitParallelTime = 0;
+    int numOrigins = 0;
+    for (int numWalls : {0, 500, 1500, 3000}) {
+      Table<bool> blocking(bounds, false);
+      for (int i : Range(numWalls))
+        blocking[bounds.randomVec2()] = true;
+      FieldOfView recursive(blocking, 1, FieldOfView::Kernel::RECURSIVE);
+      FieldOfView bitParallel(blocking, 1, FieldOfView::Kernel::BIT_PARALLEL);
+      vector<Vec2> origins {bounds.topLeft(), bounds.bottomRight() - Vec2(1, 1), Vec2(0, 40), Vec2(99, 3)};
+      for (int i : Range(300))
+        origins.push_back(bounds.randomVec2());
+      for (Vec2 origin : origins) {
+        auto time1 = steady_clock::now();
+        vector<Vec2> tiles1 = recursive.getVisibleTiles(origin);
+        auto time2 = steady_clock::now();
+        vector<Vec2> tiles2 = bitParallel.getVisibleTiles(origin);
+        auto time3 = steady_clock::now();
+        recursiveTime += duration_cast<microseconds>(time2 - time1).count();
+        bitParallelTime += duration_cast<microseconds>(time3 - time2).count();
+        ++numOrigins;
+        CHECKEQ(tiles1, tiles2);
+        for (int i : Range(20)) {
+          Vec2 v = origin + Vec2(Random.get(-30, 31), Random.get(-30, 31));
+          CHECK(recursive.canSee(origin, v) == bitParallel.canSee(origin, v));
+        }
+      }
+    }
+    INFO << "Field of view: recursive " << recursiveTime / numOrigins << "us, bit parallel "
+        << bitParallelTime / numOrigins << "us per origin";
+  }
+
+  void testFlowFieldCache() {
+    FlowFieldCache cache;
+    Rectangle bounds(10, 10);
+    Vec2 target(9, 0);
+    Table<float> costs(bounds, 1);
+    for (int y : Range(10))
+      costs[Vec2(2, y)] = FlowFieldCache::infinity;
+    auto directions = [](Vec2) { return Vec2::directions8(); };
+    auto getCost = [&costs](const MovementType&, Vec2 v) { return costs[v]; };
+    int numComputed = 0;
+    auto compute = [&] {
+      ++numComputed;
+      return FlowFieldCache::compute(bounds, target, [&costs](Vec2 v) { return costs[v]; }, directions);
+    };
+    MovementType movement(MovementTrait::WALK);
+    CHECK(!cache.get(movement, target, compute));
+    CHECK(!cache.get(movement, target, compute));
+    CHECK(!cache.get(MovementTrait::FLY, target, compute));
+    auto field = cache.get(movement, target, compute);
+    CHECK(field && numComputed == 1);
+    CHECK(cache.get(movement, target, compute) && numComputed == 1);
+    ShortestPath path(ShortestPath::FromDistances{}, bounds, [field](Vec2 v) -> double { return field->distance[v]; },
+        [](Vec2) { return Vec2::directions8(); }, target, Vec2(5, 5));
+    CHECKEQ(path.getPath().size(), 6);
+    auto checkUpToDate = [&] {
+      auto fresh = FlowFieldCache::compute(bounds, target, [&costs](Vec2 v) { return costs[v]; }, directions);
+      for (Vec2 v : bounds)
+        CHECKEQ(field->distance[v], fresh.distance[v]);
+    };
+    // A tile that isn't next to any reached one doesn't matter.
+    costs[Vec2(0, 5)] = 3;
+    cache.update(Vec2(0, 5), getCost, directions);
+    CHECK(cache.getNumFields() == 1);
+    checkUpToDate();
+    // Tiles that get cheaper are patched in place.
+    costs[Vec2(2, 5)] = 1;
+    cache.update(Vec2(2, 5), getCost, directions);
+    CHECK(cache.getNumFields() == 1);
+    CHECK(field->distance[Vec2(0, 0)] < FlowFieldCache::infinity);
+    checkUpToDate();
+    // So are ones that get more expensive if no shortest path leads through them.
+    costs[Vec2(9, 9)] = 5;
+    cache.update(Vec2(9, 9), getCost, directions);
+    CHECK(cache.getNumFields() == 1);
+    checkUpToDate();
+    costs[Vec2(5, 5)] = FlowFieldCache::infinity;
+    cache.update(Vec2(5, 5), getCost, directions);
+    CHECK(cache.getNumFields() == 0);
+    CHECK(!cache.get(movement, target, compute));
+    CHECK(numComputed == 1);
+  }
+
+  void testLazyLogging() {
+    DebugLog log;
+    CHECK(!log.isEnabled());
+    stringstream stream;
+    log.addOutput(DebugOutput::toStream(stream));
+    CHECK(log.isEnabled());
+    LogRateLimiter limiter(3);
+    int numAllowed = 0;
+    for (int i : Range(100))
+      if (limiter.allow())
+        ++numAllowed;
+    CHECKEQ(numAllowed, 3);
+    int numEvaluated = 0;
+    for (int i : Range(100))
+      INFO_LIMITED(5) << ++numEvaluated;
+    CHECK(numEvaluated <= 5);
+  }
+
+  void testCompressedStream() {
+    const char* path = "test_compressed_stream.gz";
+    vector<int> data;
+    for (int i : Range(1000000))
+      data.push_back(Random.get(1000));
+    auto time = steady_clock::now();
+    {
+      CompressedOutputStream out(path);
+      for (int x : data)
+        out << x << ' ';
+    }
+    auto written = steady_clock::now();
+    vector<int> read;
+    {
+      CompressedInputStream in(path);
+      int x;
+      while (in >> x)
+        read.push_back(x);
+    }
+    INFO << "Compressed stream write " << duration_cast<microseconds>(written - time).count() << "us read "
+        << duration_cast<microseconds>(steady_clock::now() - written).count() << "us";
+    CHECKEQ(read, data);
+    read.clear();
+    {
+      igzstream in(path);
+      int x;
+      while (in >> x)
+        read.push_back(x);
+    }
+    CHECKEQ(read, data);
+    {
+      ogzstream out(path);
+      out << "plain gzip";
+    }
+    {
+      CompressedInputStream in(path);
+      string s1, s2;
+      in >> s1 >> s2;
+      CHECKEQ(s1 + s2, "plaingzip");
+    }
+    remove(path);
+    CHECK(!CompressedInputStream(path));
+  }
+
   void testRange() {
     vector<int> a;
     vector<int> b {0,1,2,3,4,5,6};
@@ -501,6 +892,98 @@ class Test {
     INFO << s.getNumSectors() << " sectors";
   }
 
+  void testSectorsIncremental() {
+    Rectangle bounds = Level::getMaxBounds();
+    Table<bool> t(bounds, true);
+    for (int i : Range(300)) {
+      Vec2 pos(bounds.randomVec2());
+      for (Vec2 v : Rectangle(12, 12).translate(pos).intersection(bounds))
+        t[v] = false;
+    }
+    auto build = [&] {
+      Sectors ret(bounds, Table<optional<Vec2>>(bounds));
+      for (Vec2 v : bounds)
+        if (t[v])
+          ret.add(v);
+      return ret;
+    };
+    auto time = steady_clock::now();
+    Sectors s = build();
+    auto rebuildTime = duration_cast<microseconds>(steady_clock::now() - time).count();
+    // Roofs appearing and disappearing between transitions, as walls are built and mined out.
+    microseconds::rep deltaTime = 0;
+    int numChanged = 0;
+    for (int i : Range(200)) {
+      Vec2 pos(bounds.randomVec2());
+      bool covered = Random.roll(2);
+      vector<Vec2> delta;
+      for (Vec2 v : Rectangle(Random.get(2, 11), Random.get(2, 11)).translate(pos).intersection(bounds))
+        if (t[v] == covered) {
+          t[v] = !covered;
+          delta.push_back(v);
+        }
+      numChanged += delta.size();
+      time = steady_clock::now();
+      for (Vec2 v : delta)
+        if (t[v])
+          s.add(v);
+        else
+          s.remove(v);
+      deltaTime += duration_cast<microseconds>(steady_clock::now() - time).count();
+    }
+    INFO << "Sectors of " << bounds.width() << "x" << bounds.height() << " level: rebuild " << rebuildTime
+        << "us, " << numChanged << " incremental changes " << deltaTime << "us";
+    Sectors fresh = build();
+    CHECKEQ(s.getNumSectors(), fresh.getNumSectors());
+    for (int i : Range(20000)) {
+      Vec2 v = bounds.randomVec2();
+      Vec2 w = Random.roll(2) ? v + Vec2(Random.get(-20, 21), Random.get(-20, 21)) : bounds.randomVec2();
+      if (w.inRectangle(bounds))
+        CHECK(s.same(v, w) == fresh.same(v, w));
+    }
+  }
+
+  void testClusterGraph() {
+    Rectangle bounds(200, 200);
+    Sectors s(bounds, Table<optional<Vec2>>(bounds));
+    ClusterGraph graph(bounds);
+    Table<bool> t(bounds, true);
+    for (int i : Range(60)) {
+      Vec2 pos(bounds.randomVec2());
+      for (Vec2 v : Rectangle(12, 12).translate(pos).intersection(bounds))
+        t[v] = false;
+    }
+    for (Vec2 v : bounds)
+      if (t[v])
+        s.add(v);
+    auto checkWaypoints = [&] {
+      for (int i : Range(200)) {
+        Vec2 from = bounds.randomVec2();
+        Vec2 to = bounds.randomVec2();
+        if (!s.contains(from) || !s.contains(to))
+          continue;
+        auto waypoint = graph.getWaypoint(s, from, to, 3);
+        if (!s.same(from, to))
+          CHECK(!waypoint);
+        if (waypoint) {
+          CHECK(s.same(from, *waypoint));
+          CHECK(from.dist8(*waypoint) < 4 * ClusterGraph::clusterSize);
+        }
+      }
+    };
+    checkWaypoints();
+    INFO << graph.getNumNodes() << " cluster graph nodes";
+    for (int i : Range(3000)) {
+      Vec2 v = bounds.randomVec2();
+      if (Random.roll(2))
+        s.remove(v);
+      else
+        s.add(v);
+      graph.invalidate(v);
+    }
+    checkWaypoints();
+  }
+
   void testSectorsWithPortals() {
     Sectors s(Rectangle(7, 7), Table<optional<Vec2>>(7, 7));
     s.add(Vec2(2, 1));
@@ -1106,6 +1589,971 @@ class Test {
       t.matching.addTarget(t.get(v.x, v.y));
   }
 
+  template <typename T>
+  string serializeToString(T& elem) {
+    ostringstream stream;
+    {
+      OutputArchive archive(stream);
+      archive(elem);
+    }
+    return stream.str();
+  }
+
+  void testEntityContainers() {
+    for (int size : {1000, 10000, 100000}) {
+      vector<Creature::Id> ids;
+      for (int i : Range(size))
+        ids.push_back(Creature::Id());
+      EntityMap<Creature, int> entityMap;
+      map<Creature::Id, int> stdMap;
+      auto measure = [](function<void()> f) {
+        auto time = steady_clock::now();
+        f();
+        return duration_cast<microseconds>(steady_clock::now() - time).count();
+      };
+      auto insertTime = measure([&] { for (int i : All(ids)) entityMap.set(ids[i], i); });
+      auto stdInsertTime = measure([&] { for (int i : All(ids)) stdMap[ids[i]] = i; });
+      long long sum = 0;
+      long long stdSum = 0;
+      auto lookupTime = measure([&] { for (auto& id : ids) sum += entityMap.getOrFail(id); });
+      auto stdLookupTime = measure([&] { for (auto& id : ids) stdSum += stdMap.at(id); });
+      CHECKEQ(sum, stdSum);
+      sum = stdSum = 0;
+      auto iterateTime = measure([&] { for (auto& elem : entityMap) sum += elem.second; });
+      auto stdIterateTime = measure([&] { for (auto& elem : stdMap) stdSum += elem.second; });
+      CHECKEQ(sum, stdSum);
+      INFO << "EntityMap with " << size << " entities: insert " << insertTime << "us lookup " << lookupTime
+          << "us iterate " << iterateTime << "us, std::map: insert " << stdInsertTime << "us lookup " << stdLookupTime
+          << "us iterate " << stdIterateTime << "us";
+    }
+    vector<Creature::Id> ids;
+    for (int i : Range(2000))
+      ids.push_back(Creature::Id());
+    EntityMap<Creature, int> entityMap;
+    map<Creature::Id, int> stdMap;
+    EntitySet<Creature> entitySet;
+    set<Creature::Id> stdSet;
+    for (int i : Range(20000)) {
+      auto id = Random.choose(ids);
+      if (Random.roll(3)) {
+        entityMap.erase(id);
+        stdMap.erase(id);
+        entitySet.erase(id);
+        stdSet.erase(id);
+      } else {
+        entityMap.set(id, i);
+        stdMap[id] = i;
+        entitySet.insert(id);
+        stdSet.insert(id);
+      }
+      CHECKEQ(entityMap.getSize(), stdMap.size());
+      CHECKEQ(entitySet.getSize(), stdSet.size());
+    }
+    for (auto& id : ids) {
+      CHECK(entityMap.getMaybe(id) == getValueMaybe(stdMap, id));
+      CHECKEQ(entitySet.contains(id), stdSet.count(id) > 0);
+    }
+    // The containers are serialized as a class version followed by their elements in iteration order, which has the
+    // same layout as the std containers sorted by id that older saves contain.
+    auto isSavedAs = [](const string& saved, const string& stdSaved) {
+      return saved.size() == stdSaved.size() + sizeof(uint32_t) && saved.substr(sizeof(uint32_t)) == stdSaved;
+    };
+    auto load = [](const string& saved, auto& elem) {
+      istringstream stream(saved);
+      InputArchive archive(stream);
+      archive(elem);
+    };
+    vector<pair<Creature::Id, int>> mapElems;
+    for (auto& elem : entityMap)
+      mapElems.push_back(elem);
+    vector<Creature::Id> setElems;
+    for (auto& id : entitySet)
+      setElems.push_back(id);
+    CHECK(isSavedAs(serializeToString(entityMap), serializeToString(mapElems)));
+    CHECK(isSavedAs(serializeToString(entitySet), serializeToString(setElems)));
+    EntityMap<Creature, int> loaded;
+    load(serializeToString(entityMap), loaded);
+    CHECK(isSavedAs(serializeToString(loaded), serializeToString(mapElems)));
+    EntitySet<Creature> loadedSet;
+    load(serializeToString(entitySet), loadedSet);
+    CHECK(isSavedAs(serializeToString(loadedSet), serializeToString(setElems)));
+    auto version = serializeToString(entityMap).substr(0, sizeof(uint32_t));
+    EntityMap<Creature, int> loadedSorted;
+    load(version + serializeToString(stdMap), loadedSorted);
+    EntitySet<Creature> loadedSortedSet;
+    load(version + serializeToString(stdSet), loadedSortedSet);
+    for (auto& id : ids) {
+      CHECK(loadedSorted.getMaybe(id) == getValueMaybe(stdMap, id));
+      CHECKEQ(loadedSortedSet.contains(id), stdSet.count(id) > 0);
+    }
+  }
+
+  class TestController : public DoNothingController {
+    public:
+    using DoNothingController::DoNothingController;
+    virtual bool isPlayer() const override {
+      return player;
+    }
+    bool player = false;
+  };
+
+  // The scheduling rules of the TimeQueue as a map of time slots, each with a queue of players and a queue of
+  // other creatures.
+  class ReferenceTimeQueue {
+    public:
+    using Time = pair<LocalTime, bool>;
+
+    void add(Creature* c, LocalTime time) {
+      push(c, Time(time, false), false);
+      ++numCreatures;
+    }
+
+    void remove(Creature* c) {
+      erase(c);
+      --numCreatures;
+    }
+
+    Creature* getNext(double maxTime) {
+      if (numCreatures == 0)
+        return nullptr;
+      while (isEmpty(queue.begin()->second))
+        queue.erase(queue.begin());
+      auto nowTime = queue.begin()->first;
+      if (nowTime.first.getDouble() + (nowTime.second ? 0.5 : 0) > maxTime)
+        return nullptr;
+      auto next = std::next(queue.begin());
+      if (!nowTime.second && next != queue.end() && next->first.first == nowTime.first && !isEmpty(next->second) &&
+          getFront(next->second)->isPlayer())
+        return getFront(next->second);
+      return getFront(queue.begin()->second);
+    }
+
+    void increaseTime(Creature* c, TimeInterval diff) {
+      auto time = timeMap.at(c);
+      erase(c);
+      push(c, Time(time.first + diff, false), false);
+    }
+
+    void makeExtraMove(Creature* c) {
+      auto time = timeMap.at(c);
+      erase(c);
+      push(c, time.second ? Time(time.first + 1_visible, false) : Time(time.first, true), false);
+    }
+
+    void postponeMove(Creature* c) {
+      auto time = timeMap.at(c);
+      erase(c);
+      push(c, time, false);
+    }
+
+    void moveNow(Creature* c) {
+      auto time = timeMap.at(c);
+      erase(c);
+      push(c, time, true);
+    }
+
+    bool willMoveThisTurn(Creature* c) {
+      auto time = timeMap.at(c);
+      auto curTime = queue.begin()->first;
+      return time.first == curTime.first && (!time.second || curTime.second);
+    }
+
+    bool compareOrder(Creature* c1, Creature* c2) {
+      if (willMoveThisTurn(c1) != willMoveThisTurn(c2))
+        return willMoveThisTurn(c2);
+      if (!willMoveThisTurn(c1))
+        return c1->getLastMoveCounter() < c2->getLastMoveCounter();
+      if (timeMap.at(c1) != timeMap.at(c2))
+        return timeMap.at(c1) < timeMap.at(c2);
+      return getPosition(c1) < getPosition(c2);
+    }
+
+    map<Creature*, Time> timeMap;
+
+    private:
+    struct Slot {
+      deque<Creature*> players;
+      deque<Creature*> nonPlayers;
+    };
+
+    static bool isEmpty(const Slot& slot) {
+      return slot.players.empty() && slot.nonPlayers.empty();
+    }
+
+    static Creature* getFront(const Slot& slot) {
+      return slot.players.empty() ? slot.nonPlayers.front() : slot.players.front();
+    }
+
+    void push(Creature* c, Time time, bool front) {
+      auto& slot = queue[time];
+      auto& q = c->isPlayer() ? slot.players : slot.nonPlayers;
+      if (front)
+        q.push_front(c);
+      else
+        q.push_back(c);
+      timeMap[c] = time;
+    }
+
+    void erase(Creature* c) {
+      auto& slot = queue.at(timeMap.at(c));
+      for (auto q : {&slot.players, &slot.nonPlayers})
+        for (auto it = q->begin(); it != q->end(); ++it)
+          if (*it == c) {
+            q->erase(it);
+            return;
+          }
+      FATAL << "Creature not found";
+    }
+
+    int getPosition(Creature* c) {
+      auto& slot = queue.at(timeMap.at(c));
+      for (int i : All(slot.players))
+        if (slot.players[i] == c)
+          return i;
+      for (int i : All(slot.nonPlayers))
+        if (slot.nonPlayers[i] == c)
+          return 1000000000 + i;
+      FATAL << "Creature not found";
+      return -1;
+    }
+
+    map<Time, Slot> queue;
+    int numCreatures = 0;
+  };
+
+  void testTimeQueueOrder() {
+    auto contentFactory = getContentFactory();
+    TimeQueue queue;
+    ReferenceTimeQueue reference;
+    vector<Creature*> creatures;
+    vector<PCreature> removed;
+    auto setPlayer = [](Creature* c, bool player) {
+      static_cast<TestController*>(c->getController())->player = player;
+    };
+    for (int i : Range(100)) {
+      auto creature = contentFactory.getCreatures().fromId(CreatureId("IMP"), TribeId::getMonster());
+      creature->setController(makeOwner<TestController>(creature.get()));
+      setPlayer(creature.get(), Random.roll(10));
+      auto time = LocalTime(Random.get(100));
+      creatures.push_back(creature.get());
+      reference.add(creature.get(), time);
+      queue.addCreature(std::move(creature), time);
+    }
+    for (int i : Range(100000)) {
+      double maxTime = Random.roll(20) ? 0 : 1000000;
+      auto next = queue.getNextCreature(maxTime);
+      CHECKEQ(next, reference.getNext(maxTime));
+      if (!next)
+        continue;
+      auto c1 = Random.choose(creatures);
+      auto c2 = Random.choose(creatures);
+      CHECKEQ(queue.willMoveThisTurn(c1), reference.willMoveThisTurn(c1));
+      CHECKEQ(queue.compareOrder(c1, c2), reference.compareOrder(c1, c2));
+      CHECKEQ(queue.hasExtraMove(c1), reference.timeMap.at(c1).second);
+      CHECKEQ(queue.getTime(c1), reference.timeMap.at(c1).first);
+      switch (Random.get(8)) {
+        case 0:
+          queue.makeExtraMove(next);
+          reference.makeExtraMove(next);
+          break;
+        case 1:
+          queue.postponeMove(c1);
+          reference.postponeMove(c1);
+          break;
+        case 2:
+          queue.moveNow(c1);
+          reference.moveNow(c1);
+          break;
+        case 3:
+          // Same as what happens when the controller changes.
+          setPlayer(c1, !c1->isPlayer());
+          queue.postponeMove(c1);
+          reference.postponeMove(c1);
+          break;
+        case 4:
+          if (creatures.size() > 1) {
+            creatures.removeElement(c1);
+            reference.remove(c1);
+            removed.push_back(queue.removeCreature(c1));
+          }
+          break;
+        case 5:
+          if (!removed.empty()) {
+            auto time = reference.timeMap.at(next).first + TimeInterval(Random.get(-2, 3));
+            creatures.push_back(removed.back().get());
+            reference.add(removed.back().get(), time);
+            queue.addCreature(std::move(removed.back()), time);
+            removed.pop_back();
+          }
+          break;
+        default:
+          auto diff = TimeInterval(Random.get(1, 30));
+          queue.increaseTime(next, diff);
+          reference.increaseTime(next, diff);
+          break;
+      }
+    }
+  }
+
+  void testGenerationThreadOverrides() {
+    auto getNumbers = [] {
+      vector<long long> ret;
+      for (int i : Range(1000))
+        ret.push_back(Random.getLL());
+      return ret;
+    };
+    vector<vector<long long>> expected;
+    for (int seed : Range(4)) {
+      RandomGen random;
+      random.init(seed);
+      RandomGen::ThreadOverride randomOverride(random);
+      expected.push_back(getNumbers());
+    }
+    auto contentFactory = getContentFactory();
+    auto nameGenerator = contentFactory.getCreatures().getNameGenerator();
+    auto firstName = nameGenerator->getAll(NameGeneratorId::FIRST_MALE)[0];
+    vector<NameGenerator> shares;
+    for (int i : Range(4))
+      shares.push_back(nameGenerator->getShare(i, 4));
+    vector<vector<long long>> numbers(4);
+    vector<vector<string>> names(4);
+    vector<thread> threads;
+    for (int seed : Range(4))
+      threads.push_back(makeThread([&, seed] {
+        RandomGen random;
+        random.init(seed);
+        RandomGen::ThreadOverride randomOverride(random);
+        NameGenerator::ThreadOverride nameOverride(shares[seed]);
+        numbers[seed] = getNumbers();
+        for (int i : Range(20))
+          names[seed].push_back(nameGenerator->getNext(NameGeneratorId::FIRST_MALE));
+      }));
+    for (auto& t : threads)
+      t.join();
+    CHECK(numbers == expected);
+    set<string> allNames;
+    for (auto& v : names)
+      for (auto& name : v)
+        allNames.insert(name);
+    CHECKEQ(allNames.size(), 80);
+    CHECKEQ(nameGenerator->getAll(NameGeneratorId::FIRST_MALE)[0], firstName);
+    nameGenerator->skipUsedBy(shares);
+    auto allMale = nameGenerator->getAll(NameGeneratorId::FIRST_MALE);
+    CHECKEQ(allMale[allMale.size() - 80], firstName);
+    for (int i : All(allMale))
+      CHECK(allNames.count(allMale[i]) == (i >= allMale.size() - 80)) << allMale[i];
+  }
+
+  void testContentIdFreeze() {
+    auto before = ViewId("test_before_freeze");
+    freezeContentIds();
+    CHECK(ViewId("test_before_freeze") == before);
+    vector<vector<ViewId>> ids(4);
+    vector<thread> threads;
+    for (int i : Range(4))
+      threads.push_back(makeThread([&ids, i] {
+        for (int j : Range(100))
+          ids[i].push_back(ViewId(("test_after_freeze_" + toString(j)).data()));
+      }));
+    for (auto& t : threads)
+      t.join();
+    for (int i : Range(4))
+      CHECK(ids[i] == ids[0]);
+    for (int j : Range(100))
+      CHECKEQ(string(ids[0][j].data()), "test_after_freeze_" + toString(j));
+    CHECKEQ(string(before.data()), "test_before_freeze");
+  }
+
+  void testContentCacheRoundTrip() {
+    auto time1 = steady_clock::now();
+    auto contentFactory = getContentFactory();
+    auto time2 = steady_clock::now();
+    auto data = serializeToString(contentFactory);
+    ContentFactory loaded;
+    {
+      istringstream stream(data);
+      InputArchive archive(stream);
+      archive(loaded);
+    }
+    auto time3 = steady_clock::now();
+    // Unordered containers may be written in a different order, so only the size is compared.
+    CHECKEQ(serializeToString(loaded).size(), data.size());
+    INFO << "Content parsing " << duration_cast<milliseconds>(time2 - time1) << ", loading from binary "
+        << duration_cast<milliseconds>(time3 - time2);
+    CHECK(!!ItemType(CustomItemId("Bow")).get(&loaded));
+    CHECK(!!loaded.getCreatures().fromId(CreatureId("IMP"), TribeId::getMonster()));
+  }
+
+  void testParticleSimulation() {
+    fx::FXManager manager;
+    auto isSame = [](const fx::Particle& p1, const fx::Particle& p2) {
+      return p1.pos == p2.pos && p1.movement == p2.movement && p1.life == p2.life && p1.rot == p2.rot &&
+          p1.rotSpeed == p2.rotSpeed;
+    };
+    std::vector<fx::ParticleSystemId> ids;
+    for (auto name : ENUM_ALL(FXName))
+      if (manager[name])
+        for (int i : Range(20))
+          ids.push_back(manager.addSystem(name, fx::InitConfig(fx::FVec2(i * 30, 0), fx::FVec2(60, 20))));
+    int numFrames = 120;
+    int numParticles = 0;
+    int numQuads = 0;
+    long long simulateTime = 0;
+    long long quadsTime = 0;
+    std::vector<fx::DrawParticle> quads;
+    for (int frame : Range(numFrames)) {
+      auto time1 = steady_clock::now();
+      manager.simulate(1.0f / 60.0f);
+      auto time2 = steady_clock::now();
+      quads.clear();
+      for (int n : All(manager.getSystems()))
+        for (int ssid : All(manager.getSystems()[n].subSystems))
+          manager.genQuads(quads, n, ssid);
+      auto time3 = steady_clock::now();
+      simulateTime += duration_cast<microseconds>(time2 - time1).count();
+      quadsTime += duration_cast<microseconds>(time3 - time2).count();
+      numQuads += quads.size();
+      for (auto& system : manager.getSystems())
+        numParticles += system.numActiveParticles();
+    }
+    INFO << "Particles: " << numParticles / numFrames << " on average in " << ids.size() << " systems, simulation "
+        << simulateTime / numFrames << "us, " << numQuads / numFrames << " quads " << quadsTime / numFrames << "us per frame";
+    // The batched animation gives the same results as animating particles one by one.
+    int numChecked = 0;
+    for (auto id : ids)
+      if (manager.alive(id)) {
+        auto& system = manager.get(id);
+        auto& def = manager[system.defId];
+        for (int ssid : All(system.subSystems)) {
+          auto& ssdef = def[ssid];
+          if (ssdef.animateFunc != fx::defaultAnimateParticle)
+            continue;
+          fx::SubSystemContext ssctx(system, def, ssdef.particle, ssdef.emitter, manager[ssdef.particle.textureName], ssid);
+          fx::AnimationContext ctx(ssctx, 0.0, system.animTime, 1.0f / 60.0f);
+          auto particles = system[ssid].particles;
+          fx::defaultAnimateParticles(ctx, particles);
+          for (int n : Range(particles.size())) {
+            auto expected = system[ssid].particles[n];
+            fx::defaultAnimateParticle(ctx, expected);
+            CHECK(isSame(particles[n], expected));
+            ++numChecked;
+          }
+        }
+      }
+    CHECK(numChecked > 0);
+    // Every dead particle is replaced by the last one, which effects keyed on the particle index rely on.
+    fx::ParticleArray particles;
+    for (int n : Range(10)) {
+      fx::Particle p;
+      p.life = n % 3 == 0 ? 2.0f : 0.5f;
+      p.rot = n;
+      particles.push_back(p);
+    }
+    particles.removeDead();
+    CHECKEQ(particles.size(), 6);
+    CHECK(particles.rotations == std::vector<float>({8, 1, 2, 7, 4, 5}));
+  }
+
+  void testParallelParticles() {
+    auto run = [](int numThreads) {
+      Random.init(123);
+      fx::FXManager manager;
+      manager.setNumThreads(numThreads);
+      std::vector<fx::ParticleSystemId> ids;
+      for (auto name : ENUM_ALL(FXName))
+        if (manager[name])
+          for (int i : Range(5))
+            ids.push_back(manager.addSystem(name, fx::InitConfig(fx::FVec2(i * 30, 0), fx::FVec2(60, 20))));
+      std::vector<std::vector<fx::DrawParticle>> frames;
+      std::vector<int> quadCounts;
+      for (int frame : Range(90)) {
+        if (frame == 30)
+          for (int i = 0; i < ids.size(); i += 3)
+            manager.kill(ids[i], false);
+        manager.simulate(1.0f / 60.0f);
+        frames.emplace_back();
+        manager.genQuads(frames.back(), quadCounts, [](const fx::ParticleSystem&, int) { return true; });
+      }
+      return frames;
+    };
+    auto isSame = [](const fx::DrawParticle& p1, const fx::DrawParticle& p2) {
+      return !memcmp(&p1.positions, &p2.positions, sizeof(p1.positions)) &&
+          !memcmp(&p1.texCoords, &p2.texCoords, sizeof(p1.texCoords)) && p1.color == p2.color &&
+          p1.texName == p2.texName;
+    };
+    auto time1 = steady_clock::now();
+    auto serial = run(1);
+    auto time2 = steady_clock::now();
+    auto parallel = run(4);
+    auto time3 = steady_clock::now();
+    CHECKEQ(serial.size(), parallel.size());
+    int numQuads = 0;
+    for (int frame : All(serial)) {
+      CHECKEQ(serial[frame].size(), parallel[frame].size());
+      for (int n : All(serial[frame]))
+        CHECK(isSame(serial[frame][n], parallel[frame][n])) << "Frame " << frame << " quad " << n;
+      numQuads += serial[frame].size();
+    }
+    CHECK(numQuads > 0);
+    INFO << "Particles on 1 thread: " << duration_cast<milliseconds>(time2 - time1) << ", on 4 threads: "
+        << duration_cast<milliseconds>(time3 - time2);
+  }
+
+  void testActiveLastingEffects() {
+    auto contentFactory = getContentFactory();
+    auto model = Model::create(&contentFactory);
+    LevelBuilder builder(nullptr, Random, &contentFactory, 20, 20, false, none);
+    Level* level = model->buildMainLevel(std::move(builder), LevelMaker::emptyLevel(FurnitureType("GRASS"), false));
+    auto game = Game::splashScreen(std::move(model), CampaignBuilder::getEmptyCampaign(), std::move(contentFactory));
+    auto creature = game->getContentFactory()->getCreatures().fromId(CreatureId("IMP"), TribeId::getMonster());
+    Creature* c = creature.get();
+    CHECK(level->landCreature({Position(Vec2(10, 10), level)}, std::move(creature)));
+    vector<LastingEffect> effects {LastingEffect::SLEEP, LastingEffect::SLOWED, LastingEffect::SPEED,
+        LastingEffect::DAM_BONUS, LastingEffect::BLIND, LastingEffect::INVISIBLE, LastingEffect::POISON_RESISTANT,
+        LastingEffect::FIRE_RESISTANT, LastingEffect::FLYING, LastingEffect::LIGHT_SOURCE, LastingEffect::TELEPATHY};
+    // The active set must match a full scan of all effects after every change and every tick.
+    auto check = [&] {
+      EnumSet<LastingEffect> expected;
+      for (auto effect : ENUM_ALL(LastingEffect))
+        if (c->getAttributes().getTimeOut(effect) > GlobalTime(0) || c->getAttributes().isAffectedPermanently(effect))
+          expected.insert(effect);
+      CHECK(c->getAttributes().getActiveEffects() == expected);
+      for (auto effect : ENUM_ALL(LastingEffect))
+        if (!expected.contains(effect))
+          CHECK(!c->isAffected(effect));
+    };
+    for (int time : Range(1, 1000)) {
+      c->setGlobalTime(GlobalTime(time));
+      auto effect = Random.choose(effects);
+      switch (Random.get(4)) {
+        case 0: c->addEffect(effect, TimeInterval(Random.get(1, 20)), false); break;
+        case 1: c->removeEffect(effect, false); break;
+        case 2: c->addPermanentEffect(effect, 1, false); break;
+        case 3:
+          if (c->getAttributes().isAffectedPermanently(effect))
+            c->removePermanentEffect(effect, 1, false);
+          break;
+      }
+      check();
+      c->tick();
+      CHECK(!c->isDead());
+      check();
+    }
+    c->retire();
+    check();
+    for (auto effect : ENUM_ALL(LastingEffect))
+      CHECK(c->getAttributes().getTimeOut(effect) <= GlobalTime(0));
+  }
+
+  void testStackItemsStorage() {
+    auto contentFactory = getContentFactory();
+    vector<const char*> ids {"Knife", "Spear", "Sword", "BattleAxe", "WarHammer", "Club", "Bow", "LeatherGloves",
+        "IronGloves", "LeatherArmor", "ChainArmor", "LeatherHelm", "IronHelm", "WoodenShield", "Torch", "Robe"};
+    // A large storage room with some upgraded items.
+    vector<PItem> storage;
+    for (int i : Range(5000)) {
+      storage.push_back(ItemType(CustomItemId(Random.choose(ids))).get(&contentFactory));
+      if (Random.roll(4))
+        storage.back()->addModifier(AttrType(Random.get(EnumInfo<AttrType>::size)), Random.get(1, 3));
+    }
+    auto items = getWeakPointers(storage);
+    auto getExpected = [&] {
+      return getValues(groupBy<Item*, string>(items, [](Item* const& item) { return item->getNameAndModifiers(); }));
+    };
+    const int numRuns = 20;
+    auto check = [&] {
+      auto time1 = steady_clock::now();
+      vector<vector<Item*>> stacks;
+      for (int i : Range(numRuns))
+        stacks = Item::stackItems(items);
+      auto time2 = steady_clock::now();
+      vector<vector<Item*>> expected;
+      for (int i : Range(numRuns))
+        expected = getExpected();
+      auto time3 = steady_clock::now();
+      CHECK(stacks == expected);
+      INFO << "Stacking " << items.size() << " items into " << stacks.size() << " stacks: "
+          << duration_cast<microseconds>(time2 - time1).count() / numRuns << "us, by name: "
+          << duration_cast<microseconds>(time3 - time2).count() / numRuns << "us";
+    };
+    check();
+    // Changed items must move to other stacks.
+    for (int i : Range(200)) {
+      auto item = Random.choose(items);
+      if (Random.roll(2))
+        item->addModifier(AttrType(Random.get(EnumInfo<AttrType>::size)), Random.get(-2, 3));
+      else
+        item->setArtifactName("Foo" + toString(Random.get(3)));
+    }
+    check();
+  }
+
+  void testItemLedger() {
+    auto contentFactory = getContentFactory();
+    auto model = Model::create(&contentFactory);
+    LevelBuilder builder(nullptr, Random, &contentFactory, 20, 20, false, none);
+    Level* level = model->buildMainLevel(std::move(builder), LevelMaker::emptyLevel(FurnitureType("GRASS"), false));
+    vector<const char*> ids {"GoldPiece", "WoodPlank", "IronOre", "Rock", "Sword", "Bow"};
+    vector<Position> squares;
+    for (Vec2 v : Rectangle(5, 5, 15, 15))
+      squares.push_back(Position(v, level));
+    ItemLedger ledger;
+    // Only queried at the end, so it starts counting after all the changes.
+    ItemLedger lateLedger;
+    unordered_map<Position, pair<bool, EnumSet<StorageId>>, CustomHash<Position>> areas;
+    // The ledger must match a scan of all squares after every change.
+    auto check = [&] {
+      EnumMap<ItemIndex, int> territoryCounts;
+      EnumMap<StorageId, EnumMap<ItemIndex, int>> storageCounts;
+      PositionSet withItems;
+      for (auto& elem : areas) {
+        for (auto index : ENUM_ALL(ItemIndex)) {
+          int count = elem.first.getItems(index).size();
+          if (elem.second.first)
+            territoryCounts[index] += count;
+          for (auto storage : elem.second.second)
+            storageCounts[storage][index] += count;
+        }
+        if (!elem.first.getItems().empty() && (elem.second.first || !elem.second.second.isEmpty()))
+          withItems.insert(elem.first);
+      }
+      for (auto index : ENUM_ALL(ItemIndex)) {
+        CHECKEQ(ledger.getTerritoryCount(index), territoryCounts[index]);
+        for (auto storage : ENUM_ALL(StorageId))
+          CHECKEQ(ledger.getStorageCount(storage, index), storageCounts[storage][index]);
+      }
+      CHECK(ledger.getSquaresWithItems() == withItems);
+    };
+    for (int i : Range(3000)) {
+      auto pos = Random.choose(squares);
+      switch (Random.get(3)) {
+        case 0: {
+          bool territory = Random.roll(2);
+          EnumSet<StorageId> storage;
+          for (auto id : ENUM_ALL(StorageId))
+            if (Random.roll(4))
+              storage.insert(id);
+          areas[pos] = make_pair(territory, storage);
+          ledger.setAreas(pos, territory, storage);
+          lateLedger.setAreas(pos, territory, storage);
+          break;
+        }
+        case 1:
+          pos.dropItems(ItemType(CustomItemId(Random.choose(ids))).get(Random.get(1, 4), &contentFactory));
+          ledger.onItemsChanged(pos);
+          lateLedger.onItemsChanged(pos);
+          break;
+        case 2:
+          if (!pos.getItems().empty()) {
+            pos.removeItem(Random.choose(pos.getItems()));
+            ledger.onItemsChanged(pos);
+            lateLedger.onItemsChanged(pos);
+          }
+          break;
+      }
+      check();
+    }
+    for (auto index : ENUM_ALL(ItemIndex)) {
+      CHECKEQ(lateLedger.getTerritoryCount(index), ledger.getTerritoryCount(index));
+      for (auto storage : ENUM_ALL(StorageId))
+        CHECKEQ(lateLedger.getStorageCount(storage, index), ledger.getStorageCount(storage, index));
+    }
+  }
+
+  void testTaskMapClosest() {
+    auto contentFactory = getContentFactory();
+    auto model = Model::create(&contentFactory);
+    LevelBuilder builder(nullptr, Random, &contentFactory, 120, 120, false, none);
+    Level* level = model->buildMainLevel(std::move(builder), LevelMaker::emptyLevel(FurnitureType("MOUNTAIN"), true));
+    auto game = Game::splashScreen(std::move(model), CampaignBuilder::getEmptyCampaign(), std::move(contentFactory));
+    // A large cave with a separate pocket that can't be reached from it.
+    for (Vec2 v : Rectangle(5, 5, 100, 100))
+      Position(v, level).removeFurniture(FurnitureLayer::MIDDLE);
+    for (Vec2 v : Rectangle(105, 5, 115, 115))
+      Position(v, level).removeFurniture(FurnitureLayer::MIDDLE);
+    auto creature = game->getContentFactory()->getCreatures().fromId(CreatureId("IMP"), TribeId::getMonster());
+    Creature* c = creature.get();
+    CHECK(level->landCreature({Position(Vec2(50, 50), level)}, std::move(creature)));
+    TaskMap taskMap;
+    vector<WTask> tasks;
+    for (int i : Range(600)) {
+      Position pos(Random.roll(5) ? Vec2(Random.get(105, 115), Random.get(5, 115)) : Vec2(Random.get(5, 100), Random.get(5, 100)),
+          level);
+      tasks.push_back(taskMap.addTask(Task::goTo(pos), pos, MinionActivity::CONSTRUCTION));
+    }
+    auto getExpectedDist = [&] (bool priority) {
+      optional<int> ret;
+      for (WTask task : tasks)
+        if (taskMap.isPriorityTask(task) == priority && c->canNavigateToOrNeighbor(*taskMap.getPosition(task))) {
+          int dist = *taskMap.getPosition(task)->dist8(c->getPosition());
+          if (!ret || dist < *ret)
+            ret = dist;
+        }
+      return ret;
+    };
+    auto check = [&] {
+      auto time = steady_clock::now();
+      WTask closest = nullptr;
+      for (int i : Range(100))
+        closest = taskMap.getClosestTask(c, MinionActivity::CONSTRUCTION, false);
+      auto expectedPriority = getExpectedDist(true);
+      auto expected = expectedPriority ? expectedPriority : getExpectedDist(false);
+      CHECK(!!closest == !!expected);
+      if (closest) {
+        CHECKEQ(taskMap.isPriorityTask(closest), !!expectedPriority);
+        CHECKEQ(*taskMap.getPosition(closest)->dist8(c->getPosition()), *expected);
+      }
+      return duration_cast<microseconds>(steady_clock::now() - time).count() / 100;
+    };
+    auto time = check();
+    INFO << "Closest of " << tasks.size() << " tasks: " << time << "us";
+    for (int i : Range(500)) {
+      int index = Random.get(tasks.size());
+      if (Random.roll(2))
+        taskMap.removeTask(tasks[index]);
+      else
+        taskMap.removeTask(tasks[index]->getUniqueId());
+      tasks.removeIndex(index);
+      if (i % 50 == 0)
+        check();
+    }
+    taskMap.setPriorityTasks(*taskMap.getPosition(tasks.back()));
+    check();
+    for (WTask task : copyOf(tasks))
+      taskMap.removeTask(task);
+    CHECK(taskMap.getAllTasks().empty());
+    CHECK(!taskMap.getClosestTask(c, MinionActivity::CONSTRUCTION, false));
+  }
+
+  // The same battle played with and without prefetching the fields of view on worker threads.
+  void testMoveThreadsReplay() {
+    auto playBattle = [] (int numThreads, long long& time) {
+      Model::setNumMoveThreads(numThreads);
+      RandomGen random;
+      random.init(1234);
+      RandomGen::ThreadOverride randomOverride(random);
+      auto contentFactory = getContentFactory();
+      auto model = Model::create(&contentFactory);
+      LevelBuilder builder(nullptr, Random, &contentFactory, 80, 80, false, none);
+      Level* level = model->buildMainLevel(std::move(builder), LevelMaker::emptyLevel(FurnitureType("MOUNTAIN"), true));
+      Model* modelPtr = model.get();
+      auto game = Game::splashScreen(std::move(model), CampaignBuilder::getEmptyCampaign(), std::move(contentFactory));
+      Clock clock;
+      DummyView view(&clock);
+      game->initialize(nullptr, nullptr, &view, nullptr);
+      for (Vec2 v : Rectangle(5, 5, 75, 75))
+        if (v.x % 9 != 0 || v.y % 7 != 0)
+          Position(v, level).removeFurniture(FurnitureLayer::MIDDLE);
+      for (Vec2 v : Rectangle(5, 5, 75, 75))
+        if (v.x % 10 == 3 && v.y % 10 == 3)
+          Position(v, level).addFurniture(
+              game->getContentFactory()->furniture.getFurniture(FurnitureType("GROUND_TORCH"), TribeId::getMonster()));
+      vector<Creature*> creatures;
+      auto addArmy = [&] (CreatureId id, TribeId tribe, Rectangle area) {
+        for (int i : Range(50)) {
+          auto creature = game->getContentFactory()->getCreatures().fromId(id, tribe);
+          creatures.push_back(creature.get());
+          vector<Position> landing;
+          for (Vec2 v : area)
+            landing.push_back(Position(v, level));
+          CHECK(level->landCreature(Random.permutation(landing), std::move(creature)));
+        }
+      };
+      addArmy(CreatureId("KNIGHT"), TribeId::getHuman(), Rectangle(10, 10, 35, 70));
+      addArmy(CreatureId("ORC"), TribeId::getMonster(), Rectangle(45, 10, 70, 70));
+      vector<string> trace;
+      auto startTime = steady_clock::now();
+      for (int turn : Range(1, 11)) {
+        while (modelPtr->update(turn)) {}
+        for (Creature* c : creatures)
+          trace.push_back(c->isDead() ? "dead"_s :
+              toString(c->getPosition().getCoord()) + " " + toString(c->getBody().getHealth()));
+      }
+      time = duration_cast<microseconds>(steady_clock::now() - startTime).count();
+      Model::setNumMoveThreads(1);
+      return trace;
+    };
+    long long serialTime = 0;
+    long long parallelTime = 0;
+    auto serial = playBattle(1, serialTime);
+    auto parallel = playBattle(4, parallelTime);
+    int numDifferent = 0;
+    for (int i : All(serial))
+      if (serial[i] != parallel[i])
+        ++numDifferent;
+    CHECKEQ(numDifferent, 0);
+    INFO << "Battle of 100 creatures over 10 turns: " << serialTime / 1000 << "ms serially, " << parallelTime / 1000
+        << "ms with fields of view prefetched on 4 threads, " << numDifferent << " of " << serial.size()
+        << " traced states differ";
+  }
+
+  void testLightUpdates() {
+    auto contentFactory = getContentFactory();
+    auto model = Model::create(&contentFactory);
+    auto makeLevel = [&] {
+      LevelBuilder builder(nullptr, Random, &contentFactory, 60, 60, false, none);
+      return model->buildMainLevel(std::move(builder), LevelMaker::emptyLevel(FurnitureType("MOUNTAIN"), true));
+    };
+    Level* eager = makeLevel();
+    Level* batched = makeLevel();
+    auto game = Game::splashScreen(std::move(model), CampaignBuilder::getEmptyCampaign(), std::move(contentFactory));
+    auto dig = [](Level* level, Vec2 v) {
+      Position(v, level).removeFurniture(FurnitureLayer::MIDDLE);
+    };
+    for (Level* level : {eager, batched}) {
+      for (Vec2 v : Rectangle(5, 5, 25, 25))
+        dig(level, v);
+      for (Vec2 v : Rectangle(6, 6, 25, 25))
+        if (v.x % 6 == 0 && v.y % 6 == 0)
+          Position(v, level).addFurniture(
+              game->getContentFactory()->furniture.getFurniture(FurnitureType("GROUND_TORCH"), TribeId::getMonster()));
+      level->tick();
+    }
+    vector<Vec2> tunnel;
+    for (int x : Range(25, 55))
+      tunnel.push_back(Vec2(x, 15));
+    for (int y : Range(16, 40))
+      tunnel.push_back(Vec2(30, y));
+    auto time1 = steady_clock::now();
+    for (Vec2 v : tunnel) {
+      dig(eager, v);
+      eager->tick();
+    }
+    auto time2 = steady_clock::now();
+    for (Vec2 v : tunnel)
+      dig(batched, v);
+    batched->tick();
+    auto time3 = steady_clock::now();
+    INFO << "Digging " << tunnel.size() << " tiles: " << duration_cast<microseconds>(time2 - time1).count()
+        << "us with light updated after every tile, " << duration_cast<microseconds>(time3 - time2).count()
+        << "us batched";
+    for (Vec2 v : eager->getBounds())
+      CHECK(fabs(eager->getLight(v) - batched->getLight(v)) < 0.000001) << v;
+    CHECK(eager->getLight(Vec2(12, 12)) > 0);
+  }
+
+  void testLightSourcesDontDrift() {
+    auto contentFactory = getContentFactory();
+    auto model = Model::create(&contentFactory);
+    LevelBuilder builder(nullptr, Random, &contentFactory, 60, 60, false, none);
+    Level* level = model->buildMainLevel(std::move(builder), LevelMaker::emptyLevel(FurnitureType("MOUNTAIN"), true));
+    auto game = Game::splashScreen(std::move(model), CampaignBuilder::getEmptyCampaign(), std::move(contentFactory));
+    auto& furniture = game->getContentFactory()->furniture;
+    for (Vec2 v : Rectangle(5, 5, 55, 55))
+      if (v.x % 7 != 0 || v.y % 5 != 0)
+        Position(v, level).removeFurniture(FurnitureLayer::MIDDLE);
+    for (Vec2 v : Rectangle(5, 5, 55, 55))
+      if (v.x % 8 == 2 && v.y % 8 == 2)
+        Position(v, level).addFurniture(furniture.getFurniture(FurnitureType("GROUND_TORCH"), TribeId::getMonster()));
+    level->tick();
+    Table<double> initial(level->getBounds());
+    for (Vec2 v : level->getBounds())
+      initial[v] = level->getLight(v);
+    // Walls that appear and disappear again next to the edges of the lit areas must leave the light unchanged.
+    vector<Vec2> walls;
+    for (int i : Range(300)) {
+      Vec2 v(Random.get(5, 55), Random.get(5, 55));
+      if (!Position(v, level).getFurniture(FurnitureLayer::MIDDLE) && !walls.contains(v)) {
+        Position(v, level).addFurniture(furniture.getFurniture(FurnitureType("MOUNTAIN"), TribeId::getMonster()));
+        walls.push_back(v);
+      }
+      if (Random.roll(5))
+        level->tick();
+    }
+    for (Vec2 v : Random.permutation(walls)) {
+      Position(v, level).removeFurniture(FurnitureLayer::MIDDLE);
+      if (Random.roll(5))
+        level->tick();
+    }
+    level->tick();
+    for (Vec2 v : level->getBounds())
+      CHECK(fabs(level->getLight(v) - initial[v]) < 0.000001) << v;
+  }
+
+  void testVisibleCreaturesBattle() {
+    auto contentFactory = getContentFactory();
+    auto model = Model::create(&contentFactory);
+    LevelBuilder builder(nullptr, Random, &contentFactory, 100, 100, false, none);
+    Level* level = model->buildMainLevel(std::move(builder), LevelMaker::emptyLevel(FurnitureType("MOUNTAIN"), true));
+    Model* modelPtr = model.get();
+    auto game = Game::splashScreen(std::move(model), CampaignBuilder::getEmptyCampaign(), std::move(contentFactory));
+    // An open cave with scattered pillars that block some of the lines of sight, lit by torches.
+    for (Vec2 v : Rectangle(5, 5, 95, 95))
+      if (v.x % 9 != 0 || v.y % 7 != 0)
+        Position(v, level).removeFurniture(FurnitureLayer::MIDDLE);
+    for (Vec2 v : Rectangle(5, 5, 95, 95))
+      if (v.x % 10 == 3 && v.y % 10 == 3)
+        Position(v, level).addFurniture(
+            game->getContentFactory()->furniture.getFurniture(FurnitureType("GROUND_TORCH"), TribeId::getMonster()));
+    vector<Creature*> creatures;
+    auto addArmy = [&] (CreatureId id, TribeId tribe, Rectangle area) {
+      for (int i : Range(200)) {
+        auto creature = game->getContentFactory()->getCreatures().fromId(id, tribe);
+        Creature* c = creature.get();
+        vector<Position> landing;
+        for (Vec2 v : area)
+          landing.push_back(Position(v, level));
+        CHECK(level->landCreature(Random.permutation(landing), std::move(creature)));
+        creatures.push_back(c);
+      }
+    };
+    addArmy(CreatureId("KNIGHT"), TribeId::getHuman(), Rectangle(10, 10, 50, 90));
+    addArmy(CreatureId("ORC"), TribeId::getMonster(), Rectangle(45, 10, 90, 90));
+    // The way both lists were computed before, checking every candidate separately.
+    auto getReference = [] (const Creature* c, bool onlyEnemies) {
+      vector<Creature*> ret;
+      for (Creature* other : c->getPosition().getAllCreatures(FieldOfView::sightRange))
+        if ((c->canSee(other) || c->isUnknownAttacker(other)) && (!onlyEnemies || c->isEnemy(other)))
+          ret.push_back(other);
+      return ret;
+    };
+    microseconds batchedTime {0};
+    microseconds referenceTime {0};
+    int numVisible = 0;
+    int numEnemies = 0;
+    for (int turn : Range(5)) {
+      for (Creature* c : Random.permutation(creatures)) {
+        // Every creature moves, which invalidates all cached perception, just like in a real battle.
+        modelPtr->increaseMoveCounter();
+        vector<Creature*> visible, enemies, expected, expectedEnemies;
+        auto runBatched = [&] {
+          auto time = steady_clock::now();
+          visible = c->getVisibleCreatures();
+          enemies = c->getVisibleEnemies();
+          batchedTime += duration_cast<microseconds>(steady_clock::now() - time);
+        };
+        auto runReference = [&] {
+          auto time = steady_clock::now();
+          expected = getReference(c, false);
+          expectedEnemies = getReference(c, true);
+          referenceTime += duration_cast<microseconds>(steady_clock::now() - time);
+        };
+        // Alternate the order, so that both get the same share of field of view cache misses.
+        if (turn % 2) {
+          runBatched();
+          runReference();
+        } else {
+          runReference();
+          runBatched();
+        }
+        CHECK(visible == expected);
+        CHECK(enemies == expectedEnemies);
+        numVisible += visible.size();
+        numEnemies += enemies.size();
+        Vec2 dir = c->isEnemy(creatures[0]) ? Vec2(-1, 0) : Vec2(1, 0);
+        if (Random.roll(3))
+          dir = Random.choose(Vec2::directions8());
+        auto target = c->getPosition().plus(dir);
+        if (target.canEnter(c))
+          c->getPosition().moveCreature(target);
+      }
+      CHECK(numEnemies > 0);
+    }
+    INFO << "Perception of " << creatures.size() << " creatures over 5 turns: " << numVisible << " visible, "
+        << numEnemies << " enemies, " << batchedTime.count() << "us batched, " << referenceTime.count()
+        << "us one by one";
+  }
+
   void testDungeonLevel() {
     DungeonLevel level;
     CHECKEQ(level.level, 0);
@@ -1212,8 +2660,17 @@ void testAll() {
   Test().testSplitIncludeDelim();
   Test().testShortestPath();
   Test().testAStar();
+  Test().testShortestPathRepair();
+  Test().testShortestPathOnThreads();
   Test().testShortestPath2();
   Test().testShortestPathReverse();
+  Test().testFlowFieldCache();
+  Test().testFieldOfViewCache();
+  Test().testFieldOfViewPrefetch();
+  Test().testFieldOfViewKernels();
+  Test().testDijkstra();
+  Test().testLazyLogging();
+  Test().testCompressedStream();
   Test().testRange();
   Test().testRange2();
   Test().testRange3();
@@ -1234,6 +2691,8 @@ void testAll() {
   Test().testSectors2();
   Test().testSectors3();
   Test().testSectorsWithPortals();
+  Test().testSectorsIncremental();
+  Test().testClusterGraph();
   Test().testReverse();
   Test().testReverse2();
   Test().testReverse3();
@@ -1259,6 +2718,21 @@ void testAll() {
   Test().testPositionMatching2();
   Test().testPositionMatching3();
   Test().testPositionMatching4();
+  Test().testLightUpdates();
+  Test().testLightSourcesDontDrift();
+  Test().testVisibleCreaturesBattle();
+  Test().testMoveThreadsReplay();
+  Test().testTaskMapClosest();
+  Test().testActiveLastingEffects();
+  Test().testStackItemsStorage();
+  Test().testItemLedger();
+  Test().testEntityContainers();
+  Test().testTimeQueueOrder();
+  Test().testGenerationThreadOverrides();
+  Test().testContentIdFreeze();
+  Test().testContentCacheRoundTrip();
+  Test().testParticleSimulation();
+  Test().testParallelParticles();
   Test().testDungeonLevel();
   Test().testRoofSupport1();
   Test().testRoofSupport2();
@@ -21,14 +21,49 @@
 
 template <class Archive> 
 void TimeQueue::serialize(Archive& ar, const unsigned int version) { 
-  ar(creatures, timeMap, queue);
+  map<ExtendedTime, SavedQueue> queue;
+  if (Archive::is_loading::value) {
+    ar(creatures, timeMap, queue);
+    regularTurns.clear();
+    extraTurns.clear();
+    heapIndex.clear();
+    nextOrder = 0;
+    nextFirstOrder = -1;
+    currentTime = none;
+    if (!queue.empty())
+      currentTime = queue.begin()->first;
+    for (auto& elem : queue) {
+      for (auto c : elem.second.players)
+        if (c)
+          insert(Entry{elem.first, true, nextOrder++, c});
+      for (auto c : elem.second.nonPlayers)
+        if (c)
+          insert(Entry{elem.first, false, nextOrder++, c});
+    }
+  } else {
+    vector<Entry> entries = regularTurns;
+    entries.append(extraTurns);
+    sort(entries.begin(), entries.end());
+    if (currentTime)
+      queue[*currentTime];
+    for (auto& entry : entries) {
+      auto& q = queue[entry.time];
+      if (entry.player) {
+        q.orderMap.set(entry.creature, q.players.size());
+        q.players.push_back(entry.creature);
+      } else {
+        q.orderMap.set(entry.creature, 1000000000 + q.nonPlayers.size());
+        q.nonPlayers.push_back(entry.creature);
+      }
+    }
+    ar(creatures, timeMap, queue);
+  }
 }
 
 SERIALIZABLE(TimeQueue);
 
 void TimeQueue::addCreature(PCreature c, LocalTime time) {
-  timeMap.set(c.get(), time);
-  queue[time].push(c.get());
+  schedule(c.get(), time, false);
   creatures.push_back(std::move(c));
 }
 
@@ -36,94 +71,96 @@ LocalTime TimeQueue::getTime(const Creature* c) {
   return timeMap.getOrFail(c).time;
 }
 
-static void clearNull(deque<Creature*>& q) {
-  while (!q.empty() && q.back() == nullptr)
-    q.pop_back();
-  while (!q.empty() && q.front() == nullptr)
-    q.pop_front();
+TimeQueue::Heap& TimeQueue::getHeap(ExtendedTime time) {
+  return time.extraTurn ? extraTurns : regularTurns;
 }
 
-void TimeQueue::Queue::clearNull() {
-  ::clearNull(players);
-  ::clearNull(nonPlayers);
+void TimeQueue::schedule(Creature* c, ExtendedTime time, bool first) {
+  timeMap.set(c, time);
+  if (!currentTime || time < *currentTime)
+    currentTime = time;
+  insert(Entry{time, c->isPlayer(), first ? nextFirstOrder-- : nextOrder++, c});
 }
 
-void TimeQueue::Queue::push(Creature* c) {
-  clearNull();
-  if (c->isPlayer()) {
-    int order = players.empty() ? 0 : orderMap.getOrFail(players.back()) + 1;
-    orderMap.set(c, order);
-    players.push_back(c);
-  } else {
-    int order = nonPlayers.empty() ? 1000000000 : orderMap.getOrFail(nonPlayers.back()) + 1;
-    orderMap.set(c, order);
-    nonPlayers.push_back(c);
-  }
+void TimeQueue::insert(Entry entry) {
+  auto& heap = getHeap(entry.time);
+  heap.push_back(entry);
+  siftUp(heap, heap.size() - 1);
 }
 
-void TimeQueue::Queue::pushFront(Creature* c) {
-  clearNull();
-  if (c->isPlayer()) {
-    int order = players.empty() ? 0 : orderMap.getOrFail(players.front()) - 1;
-    orderMap.set(c, order);
-    players.push_front(c);
-  } else {
-    int order = nonPlayers.empty() ? 1000000000 : orderMap.getOrFail(nonPlayers.front()) - 1;
-    orderMap.set(c, order);
-    nonPlayers.push_front(c);
-  }
+void TimeQueue::unschedule(Creature* c) {
+  auto& heap = getHeap(timeMap.getOrFail(c));
+  int index = heapIndex.getOrFail(c);
+  heapIndex.erase(c);
+  if (index < heap.size() - 1) {
+    heap[index] = heap.back();
+    heap.pop_back();
+    if (index > 0 && heap[index] < heap[(index - 1) / 2])
+      siftUp(heap, index);
+    else
+      siftDown(heap, index);
+  } else
+    heap.pop_back();
 }
 
-bool TimeQueue::Queue::empty() {
-  clearNull();
-  return players.empty() && nonPlayers.empty();
-}
-
-Creature* TimeQueue::Queue::front() {
-  clearNull();
-  if (!players.empty())
-    return players.front();
-  else
-    return nonPlayers.front();
+void TimeQueue::siftUp(Heap& heap, int index) {
+  auto entry = heap[index];
+  while (index > 0) {
+    int parent = (index - 1) / 2;
+    if (!(entry < heap[parent]))
+      break;
+    heap[index] = heap[parent];
+    heapIndex.set(heap[index].creature, index);
+    index = parent;
+  }
+  heap[index] = entry;
+  heapIndex.set(entry.creature, index);
 }
 
-void TimeQueue::Queue::popFront() {
-  if (!players.empty())
-    return players.pop_front();
-  else
-    return nonPlayers.pop_front();
+void TimeQueue::siftDown(Heap& heap, int index) {
+  auto entry = heap[index];
+  while (1) {
+    int child = 2 * index + 1;
+    if (child >= heap.size())
+      break;
+    if (child + 1 < heap.size() && heap[child + 1] < heap[child])
+      ++child;
+    if (!(heap[child] < entry))
+      break;
+    heap[index] = heap[child];
+    heapIndex.set(heap[index].creature, index);
+    index = child;
+  }
+  heap[index] = entry;
+  heapIndex.set(entry.creature, index);
 }
 
-void TimeQueue::Queue::erase(Creature* c) {
-  auto eraseFrom = [&c] (deque<Creature*>& queue) {
-    for (int i : All(queue))
-      if (queue[i] == c) {
-        queue[i] = nullptr;
-        return true;
-      }
-    return false;
-  };
-  CHECK(eraseFrom(players) || eraseFrom(nonPlayers));
+const TimeQueue::Entry* TimeQueue::getFirst() const {
+  if (regularTurns.empty())
+    return extraTurns.empty() ? nullptr : &extraTurns[0];
+  if (extraTurns.empty() || regularTurns[0] < extraTurns[0])
+    return &regularTurns[0];
+  return &extraTurns[0];
 }
 
 void TimeQueue::increaseTime(Creature* c, TimeInterval diff) {
-  auto& time = timeMap.getOrFail(c);
-  queue.at(time).erase(c);
+  auto time = timeMap.getOrFail(c);
+  unschedule(c);
   time.time += diff;
   time.extraTurn = false;
-  queue[time].push(c);
+  schedule(c, time, false);
 }
 
 void TimeQueue::makeExtraMove(Creature* c) {
-  auto& time = timeMap.getOrFail(c);
-  queue.at(time).erase(c);
+  auto time = timeMap.getOrFail(c);
+  unschedule(c);
   if (!time.extraTurn)
     time.extraTurn = true;
   else {
     time.time += 1_visible;
     time.extraTurn = false;
   }
-  queue[time].push(c);
+  schedule(c, time, false);
 }
 
 bool TimeQueue::hasExtraMove(Creature* c) {
@@ -133,20 +170,20 @@ bool TimeQueue::hasExtraMove(Creature* c) {
 void TimeQueue::postponeMove(Creature* c) {
   CHECK(contains(c));
   auto time = timeMap.getOrFail(c);
-  queue.at(time).erase(c);
-  queue.at(time).push(c);
+  unschedule(c);
+  schedule(c, time, false);
 }
 
 void TimeQueue::moveNow(Creature* c) {
   CHECK(contains(c));
   auto time = timeMap.getOrFail(c);
-  queue.at(time).erase(c);
-  queue.at(time).pushFront(c);
+  unschedule(c);
+  schedule(c, time, true);
 }
 
 bool TimeQueue::willMoveThisTurn(const Creature* c) {
   auto hisTime = timeMap.getOrFail(c);
-  auto curTime = queue.begin()->first;
+  auto curTime = *currentTime;
   return hisTime.time == curTime.time && (!hisTime.extraTurn || curTime.extraTurn);
 }
 
@@ -158,20 +195,12 @@ bool TimeQueue::compareOrder(const Creature* c1, const Creature* c2) {
   if (!willMoveThisTurn(c1))
     return c1->getLastMoveCounter() < c2->getLastMoveCounter();
   auto time1 = timeMap.getOrFail(c1);
-  auto time2 = timeMap.getOrFail(c2);
-  if (time1 < time2)
-    return true;
-  if (time2 < time1)
-    return false;
-  auto& orderMap = queue.at(time1).orderMap;
-  return orderMap.getOrFail(c1) < orderMap.getOrFail(c2);
+  auto& heap = getHeap(time1);
+  return heap[heapIndex.getOrFail(c1)] < getHeap(timeMap.getOrFail(c2))[heapIndex.getOrFail(c2)];
 }
 
 bool TimeQueue::contains(Creature* c) const {
-  for (auto& creature : creatures)
-    if (creature.get() == c)
-      return true;
-  return false;
+  return heapIndex.hasKey(c);
 }
 
 TimeQueue::TimeQueue() {}
@@ -179,7 +208,7 @@ TimeQueue::TimeQueue() {}
 PCreature TimeQueue::removeCreature(Creature* cRef) {
   for (int i : All(creatures))
     if (creatures[i].get() == cRef) {
-      queue.at(timeMap.getOrFail(cRef)).erase(cRef);
+      unschedule(cRef);
       PCreature ret = std::move(creatures[i]);
       creatures.removeIndexPreserveOrder(i);
       return ret;
@@ -195,24 +224,35 @@ vector<Creature*> TimeQueue::getAllCreatures() const {
 Creature* TimeQueue::getNextCreature(double maxTime) {
   if (creatures.empty())
     return nullptr;
-  while (1) {
-    CHECK(!queue.empty());
-    if (!queue.begin()->second.empty())
-      break;
-    queue.erase(queue.begin());
-  }
-  auto nowTime = queue.begin()->first;
-  if (nowTime.getDouble() > maxTime)
+  auto first = getFirst();
+  CHECK(first);
+  currentTime = first->time;
+  if (first->time.getDouble() > maxTime)
     return nullptr;
-  auto& q = queue.begin()->second;
-  if (!nowTime.extraTurn) {
-    auto nextQueue = ++queue.begin();
-    if (nextQueue != queue.end()) {
-      if (nextQueue->first.time == nowTime.time && !nextQueue->second.empty() && nextQueue->second.front()->isPlayer())
-        return nextQueue->second.front();
-    }
+  // A player's extra turn comes before other creatures' regular turns.
+  if (!first->time.extraTurn && !extraTurns.empty() && extraTurns[0].time.time == first->time.time &&
+      extraTurns[0].creature->isPlayer())
+    return extraTurns[0].creature;
+  return first->creature;
+}
+
+vector<Creature*> TimeQueue::getCreaturesMovingUntil(LocalTime time) const {
+  vector<Creature*> ret;
+  // Only visits the subtrees of the heap whose roots are due.
+  vector<int> indexes;
+  if (!regularTurns.empty())
+    indexes.push_back(0);
+  while (!indexes.empty()) {
+    int index = indexes.back();
+    indexes.pop_back();
+    if (time < regularTurns[index].time.time)
+      continue;
+    ret.push_back(regularTurns[index].creature);
+    for (int child : {2 * index + 1, 2 * index + 2})
+      if (child < regularTurns.size())
+        indexes.push_back(child);
   }
-  return q.front();
+  return ret;
 }
 
 TimeQueue::ExtendedTime::ExtendedTime() {}
@@ -229,3 +269,11 @@ double TimeQueue::ExtendedTime::getDouble() const {
 bool TimeQueue::ExtendedTime::operator < (TimeQueue::ExtendedTime o) const {
   return time < o.time || (time == o.time && !extraTurn && o.extraTurn);
 }
+
+bool TimeQueue::Entry::operator < (const Entry& o) const {
+  if (time < o.time)
+    return true;
+  if (o.time < time)
+    return false;
+  return player > o.player || (player == o.player && order < o.order);
+}
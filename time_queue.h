@@ -38,6 +38,8 @@ class TimeQueue {
   void moveNow(Creature*);
   bool willMoveThisTurn(const Creature*);
   bool compareOrder(const Creature*, const Creature*);
+  /** Creatures whose regular turn is at the given time or earlier, in no particular order.*/
+  vector<Creature*> getCreaturesMovingUntil(LocalTime) const;
 
   template <class Archive>
   void serialize(Archive& ar, const unsigned int version);
@@ -46,21 +48,6 @@ class TimeQueue {
   bool contains(Creature*) const;
 
   vector<PCreature> SERIAL(creatures);
-  struct Queue {
-    void push(Creature*);
-    void pushFront(Creature*);
-    bool empty();
-    Creature* front();
-    void popFront();
-    void erase(Creature*);
-    deque<Creature*> SERIAL(players);
-    deque<Creature*> SERIAL(nonPlayers);
-    EntityMap<Creature, int> SERIAL(orderMap);
-    SERIALIZE_ALL(players, nonPlayers, orderMap)
-
-    private:
-    void clearNull();
-  };
   struct ExtendedTime {
     ExtendedTime();
     ExtendedTime(LocalTime);
@@ -70,7 +57,39 @@ class TimeQueue {
     bool SERIAL(extraTurn) = false;
     SERIALIZE_ALL(time, extraTurn)
   };
-  map<ExtendedTime, Queue> SERIAL(queue);
+  // Creatures move in order of time, then players before others, then in order of scheduling.
+  struct Entry {
+    ExtendedTime time;
+    bool player;
+    long long order;
+    Creature* creature;
+    bool operator < (const Entry&) const;
+  };
+  // Binary heaps of entries. Extra turns are kept separately, so that the first creature with an extra turn
+  // at the current time can be found quickly.
+  using Heap = vector<Entry>;
+  Heap& getHeap(ExtendedTime);
+  void schedule(Creature*, ExtendedTime, bool first);
+  void unschedule(Creature*);
+  void insert(Entry);
+  void siftUp(Heap&, int index);
+  void siftDown(Heap&, int index);
+  const Entry* getFirst() const;
+  Heap regularTurns;
+  Heap extraTurns;
+  EntityMap<Creature, int> heapIndex;
   EntityMap<Creature, ExtendedTime> SERIAL(timeMap);
+  long long nextOrder = 0;
+  long long nextFirstOrder = -1;
+  // Time of the first turn as of the last call to getNextCreature, or earlier if such a turn was scheduled since.
+  // Used to determine which creatures move this turn.
+  optional<ExtendedTime> currentTime;
+  // Layout of the queue in the save file.
+  struct SavedQueue {
+    deque<Creature*> SERIAL(players);
+    deque<Creature*> SERIAL(nonPlayers);
+    EntityMap<Creature, int> SERIAL(orderMap);
+    SERIALIZE_ALL(players, nonPlayers, orderMap)
+  };
 };
 
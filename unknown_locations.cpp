@@ -4,6 +4,10 @@
 
 
 void UnknownLocations::update(const vector<Position>& positions) {
+  for (auto& pos : allLocations)
+    pos.setNeedsRenderUpdate(true);
+  for (auto& pos : positions)
+    pos.setNeedsRenderUpdate(true);
   allLocations.clear();
   locationsByLevel.clear();
   for (auto pos : positions) {
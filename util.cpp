@@ -19,8 +19,24 @@
 #include "position.h"
 #include <time.h>
 
+static thread_local RandomGen* randomOverride = nullptr;
+
+RandomGen::ThreadOverride::ThreadOverride(RandomGen& random) : previous(randomOverride) {
+  randomOverride = &random;
+}
+
+RandomGen::ThreadOverride::~ThreadOverride() {
+  randomOverride = previous;
+}
+
+default_random_engine& RandomGen::getGenerator() {
+  if (randomOverride && this == &Random)
+    return randomOverride->generator;
+  return generator;
+}
+
 void RandomGen::init(int seed) {
-  generator.seed(seed);
+  getGenerator().seed(seed);
 }
 
 int RandomGen::get(int max) {
@@ -28,7 +44,7 @@ int RandomGen::get(int max) {
 }
 
 long long RandomGen::getLL() {
-  return uniform_int_distribution<long long>(-(1LL << 62), 1LL << 62)(generator);
+  return uniform_int_distribution<long long>(-(1LL << 62), 1LL << 62)(getGenerator());
 }
 
 int RandomGen::get(Range r) {
@@ -37,7 +53,7 @@ int RandomGen::get(Range r) {
 
 int RandomGen::get(int min, int max) {
   CHECK(max > min);
-  return uniform_int_distribution<int>(min, max - 1)(generator);
+  return uniform_int_distribution<int>(min, max - 1)(getGenerator());
 }
 
 std::string operator "" _s(const char* str, size_t) { 
@@ -85,11 +101,11 @@ bool RandomGen::chance(float v) {
 }
 
 double RandomGen::getDouble() {
-  return defaultDist(generator);
+  return defaultDist(getGenerator());
 }
 
 double RandomGen::getDouble(double a, double b) {
-  return uniform_real_distribution<double>(a, b)(generator);
+  return uniform_real_distribution<double>(a, b)(getGenerator());
 }
 
 pair<float, float> RandomGen::getFloat2Fast() {
@@ -101,7 +117,7 @@ pair<float, float> RandomGen::getFloat2Fast() {
 }
 
 float RandomGen::getFloat(float a, float b) {
-  return uniform_real_distribution<float>(a, b)(generator);
+  return uniform_real_distribution<float>(a, b)(getGenerator());
 }
 
 float RandomGen::getFloatFast(float a, float b) {
@@ -753,13 +753,13 @@ class RandomGen {
 
   template <typename T>
   vector<T> permutation(vector<T> v) {
-    std::shuffle(v.begin(), v.end(), generator);
+    std::shuffle(v.begin(), v.end(), getGenerator());
     return v;
   }
 
   template <typename Iterator>
   void shuffle(Iterator begin, Iterator end) {
-    std::shuffle(begin, end, generator);
+    std::shuffle(begin, end, getGenerator());
   }
 
   template <typename T>
@@ -808,7 +808,18 @@ class RandomGen {
     return chooseImpl(std::forward<T>(first), 2, std::forward<T>(second), std::forward<Args>(rest)...);
   }
 
+  /** While alive, makes the global Random draw numbers from the given generator on the current thread.*/
+  class ThreadOverride {
+    public:
+    ThreadOverride(RandomGen&);
+    ~ThreadOverride();
+
+    private:
+    RandomGen* previous;
+  };
+
   private:
+  default_random_engine& getGenerator();
   default_random_engine generator;
   std::uniform_real_distribution<double> defaultDist;
 